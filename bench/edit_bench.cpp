@@ -0,0 +1,270 @@
+// Measures per-keystroke latency of the edit -> view pipeline without a terminal.
+//
+//   make bench DEBUG=0
+//   ./build-release/bench/edit_bench.out [--max-mb N] [--rows N] [--cols N] [--dir D]
+//
+// Files from 1 KiB up to --max-mb (default 1024) are generated in --dir (default /tmp)
+// and opened the way the editor opens them. Each scripted key stream is then fed through
+// handle_key one key at a time, followed by the same frame the main loop draws, with
+// ncurses writing to /dev/null. For every stage the p50 and p99 over all keys are
+// reported in microseconds. update_state includes its own prepare_view_data call;
+// prepare_view_data is also timed on its own right after it, over the same rows. The
+// last columns are the mean and p99 of the heap allocations made by handle_key,
+// update_state and render for each key.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <ncurses.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Model.h"
+#include "View.h"
+#include "ViewModel.h"
+#include "key_codes.h"
+#include "key_handling.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+// A named stream of keys
+struct Script {
+    std::string m_name;
+    std::vector<Key> m_keys;
+};
+
+// Nanoseconds spent in each stage, one entry per key
+struct Timings {
+    std::vector<double> m_handle_key;
+    std::vector<double> m_prepare_view_data;
+    std::vector<double> m_update_state;
+    std::vector<double> m_render;
+    // heap allocations per key, over the stages the main loop runs
+    std::vector<double> m_allocations;
+};
+
+static Key key_for_char(char c) {
+    if (c == '\n') {
+        return reserved_keycode_to_key.at(ENTER_CODE);
+    }
+    if (c == ' ') {
+        return reserved_keycode_to_key.at(SPACE_CODE);
+    }
+    if (std::isalpha(c)) {
+        return Key(c, KeyType::ALPHA, KeyModifier::NONE);
+    }
+    if (std::isdigit(c)) {
+        return Key(c, KeyType::DIGIT, KeyModifier::NONE);
+    }
+    return Key(c, KeyType::PUNCTUATION, KeyModifier::NONE);
+}
+
+static void add_keys(std::vector<Key> &keys, int keycode, size_t count) {
+    for (size_t idx = 0; idx < count; ++idx) {
+        keys.push_back(reserved_keycode_to_key.at(keycode));
+    }
+}
+
+static std::vector<Script> make_scripts() {
+    std::vector<Script> scripts;
+
+    // prose typed at the cursor with a newline every so often
+    Script typing{"typing", {}};
+    std::string_view words = "the quick brown fox jumps over the lazy dog ";
+    for (size_t idx = 0; idx < 2000; ++idx) {
+        typing.m_keys.push_back(key_for_char(idx % 60 == 59 ? '\n' : words[idx % words.size()]));
+    }
+    scripts.push_back(std::move(typing));
+
+    // without bracketed paste a paste arrives as keys, just faster and with more newlines
+    Script pasting{"pasting", {}};
+    std::string_view code = "for (size_t idx = 0; idx < size; ++idx) {\n    total += values[idx];\n}\n";
+    for (size_t idx = 0; idx < 2000; ++idx) {
+        pasting.m_keys.push_back(key_for_char(code[idx % code.size()]));
+    }
+    scripts.push_back(std::move(pasting));
+
+    Script scrolling{"scrolling", {}};
+    add_keys(scrolling.m_keys, DOWN, 1000);
+    add_keys(scrolling.m_keys, UP, 1000);
+    scripts.push_back(std::move(scrolling));
+
+    // select a few lines, then delete them
+    Script selection_delete{"selection delete", {}};
+    for (size_t idx = 0; idx < 100; ++idx) {
+        add_keys(selection_delete.m_keys, SHIFT_DOWN, 3);
+        add_keys(selection_delete.m_keys, SHIFT_RIGHT, 10);
+        add_keys(selection_delete.m_keys, BACKSPACE_CODE, 1);
+    }
+    scripts.push_back(std::move(selection_delete));
+
+    return scripts;
+}
+
+// Writes size bytes of ~80 byte lines to pathname, repeating one generated block
+static void generate_file(std::string const &pathname, size_t size) {
+    std::string block;
+    for (size_t line = 0; block.size() < (1u << 20); ++line) {
+        size_t length = 20 + (line * 7919) % 120;
+        for (size_t idx = 0; idx < length; ++idx) {
+            block.push_back((char)('a' + (line + idx * 13) % 26));
+        }
+        block.push_back('\n');
+    }
+
+    FILE *file = fopen(pathname.c_str(), "w");
+    if (file == NULL) {
+        perror("edit_bench: fopen");
+        exit(1);
+    }
+    for (size_t written = 0; written < size;) {
+        size_t length = std::min(block.size(), size - written);
+        fwrite(block.data(), 1, length, file);
+        written += length;
+    }
+    fclose(file);
+}
+
+static double time_ns(std::function<void()> const &fn) {
+    auto start = bench_clock::now();
+    fn();
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+static double percentile(std::vector<double> values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t idx = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + idx, values.end());
+    return values[idx];
+}
+
+// Opens pathname in a fresh editor and plays script against it from the middle of the file
+static Timings run_script(std::string const &pathname, Script const &script, int rows) {
+    Model model = Model::initialize();
+    model.open_file(pathname);
+    while (model.is_loading()) {
+        model.poll_loading(true);
+    }
+    model.move_cursor_to_row(model.num_lines() / 2);
+
+    ViewModel view_model = ViewModel(&model);
+    View view = View::on_window(&view_model, stdscr);
+    // the first frame draws every row, which isn't what a keystroke costs
+    view.update_state();
+    view.render();
+
+    // the status bar takes the bottom row
+    size_t text_rows = rows - 1;
+    Timings timings;
+    // so that recording a key's numbers doesn't count towards the next key's allocations
+    for (std::vector<double> *stage : {&timings.m_handle_key, &timings.m_prepare_view_data,
+                                       &timings.m_update_state, &timings.m_render, &timings.m_allocations}) {
+        stage->reserve(script.m_keys.size());
+    }
+    for (Key const &key : script.m_keys) {
+        size_t allocations_before = allocation_count;
+        timings.m_handle_key.push_back(time_ns([&]() { handle_key(model, key); }));
+        timings.m_update_state.push_back(time_ns([&]() { view.update_state(); }));
+        size_t allocations = allocation_count - allocations_before;
+        timings.m_prepare_view_data.push_back(
+            time_ns([&]() { view_model.prepare_view_data(view_model.first_row(), text_rows); }));
+        allocations_before = allocation_count;
+        timings.m_render.push_back(time_ns([&]() { view.render(); }));
+        allocations += allocation_count - allocations_before;
+        timings.m_allocations.push_back(allocations);
+    }
+    return timings;
+}
+
+int main(int argc, char **argv) {
+    size_t max_mb = 1024;
+    int rows = 50;
+    int cols = 160;
+    std::string directory = "/tmp";
+    for (int idx = 1; idx + 1 < argc; idx += 2) {
+        std::string arg = argv[idx];
+        if (arg == "--max-mb") {
+            max_mb = std::strtoull(argv[idx + 1], nullptr, 10);
+        } else if (arg == "--rows") {
+            rows = std::atoi(argv[idx + 1]);
+        } else if (arg == "--cols") {
+            cols = std::atoi(argv[idx + 1]);
+        } else if (arg == "--dir") {
+            directory = argv[idx + 1];
+        } else {
+            fprintf(stderr, "edit_bench: unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    // a terminal of the requested size that nobody reads from or looks at
+    FILE *null_out = fopen("/dev/null", "w");
+    FILE *null_in = fopen("/dev/null", "r");
+    setenv("LINES", std::to_string(rows).c_str(), 1);
+    setenv("COLUMNS", std::to_string(cols).c_str(), 1);
+    SCREEN *screen = newterm("xterm-256color", null_out, null_in);
+    if (screen == NULL) {
+        screen = newterm("dumb", null_out, null_in);
+    }
+    if (screen == NULL) {
+        fprintf(stderr, "edit_bench: could not set up a terminal\n");
+        return 1;
+    }
+    set_term(screen);
+    start_color();
+    use_default_colors();
+    View::init_view_colours();
+
+    std::vector<size_t> sizes;
+    for (size_t size = 1 << 10; size <= (max_mb << 20); size *= 32) {
+        sizes.push_back(size);
+    }
+    std::vector<Script> scripts = make_scripts();
+
+    std::vector<std::string> lines;
+    for (size_t size : sizes) {
+        std::string pathname = directory + "/elditor-edit-bench-" + std::to_string(size) + ".txt";
+        generate_file(pathname, size);
+        for (Script const &script : scripts) {
+            Timings timings = run_script(pathname, script, rows);
+            char line[256];
+            int length = snprintf(line, sizeof(line), "%12zu %-18s", size, script.m_name.c_str());
+            for (std::vector<double> const *stage : {&timings.m_handle_key, &timings.m_prepare_view_data,
+                                                     &timings.m_update_state, &timings.m_render}) {
+                length += snprintf(line + length, sizeof(line) - length, " %9.1f %9.1f",
+                                   percentile(*stage, 0.5) / 1e3, percentile(*stage, 0.99) / 1e3);
+            }
+            std::vector<double> const &allocations = timings.m_allocations;
+            double total_allocations = 0;
+            for (double count : allocations) {
+                total_allocations += count;
+            }
+            double mean_allocations = total_allocations / std::max<size_t>(allocations.size(), 1);
+            snprintf(line + length, sizeof(line) - length, " %9.2f %9.0f", mean_allocations,
+                     percentile(allocations, 0.99));
+            lines.push_back(line);
+        }
+        unlink(pathname.c_str());
+    }
+
+    endwin();
+    delscreen(screen);
+
+    printf("%dx%d terminal, times in microseconds\n", cols, rows);
+    printf("%12s %-18s %19s %19s %19s %19s %19s\n", "bytes", "script", "handle_key", "prepare_view_data",
+           "update_state", "render", "allocations");
+    printf("%12s %-18s", "", "");
+    for (int stage = 0; stage < 4; ++stage) {
+        printf(" %9s %9s", "p50", "p99");
+    }
+    printf(" %9s %9s\n", "mean", "p99");
+    for (std::string const &line : lines) {
+        printf("%s\n", line.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Measures how fast each NewlineScanner method builds a line-start table.
+//
+//   make bench DEBUG=0
+//   ./build-release/bench/newline_bench.out [--max-mb N] [files...]
+//
+// With no files the sample_files are used. Generated inputs from 1 MiB up to
+// --max-mb (default 256) are added, once with ~80 byte lines and once with ~8 byte lines.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "NewlineScanner.h"
+#include "file.h"
+
+struct Input {
+    std::string m_name;
+    std::string m_text;
+};
+
+// What TextBuffer did before the scanner: one find_first_of call per line
+static void find_newlines_find_first_of(std::string_view text, std::vector<size_t> &newlines) {
+    size_t pos = 0;
+    while (true) {
+        size_t newl_idx = text.find_first_of("\n", pos);
+        if (newl_idx == std::string_view::npos) {
+            return;
+        }
+        newlines.push_back(newl_idx);
+        pos = newl_idx + 1;
+    }
+}
+
+static std::string generate_text(size_t size, size_t mean_line_length, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<size_t> line_length(0, 2 * mean_line_length);
+    std::uniform_int_distribution<int> letter(' ', '~');
+    std::string text;
+    text.reserve(size);
+    while (text.size() < size) {
+        size_t length = std::min(line_length(rng), size - text.size());
+        for (size_t idx = 0; idx < length; ++idx) {
+            text.push_back((char)letter(rng));
+        }
+        if (text.size() < size) {
+            text.push_back('\n');
+        }
+    }
+    return text;
+}
+
+// Runs fn enough times to get a stable reading and returns the best GB/s
+template <typename F>
+static double measure(std::string_view text, size_t &count, F &&fn) {
+    using clock = std::chrono::steady_clock;
+    size_t repetitions = std::max<size_t>(3, (64u << 20) / std::max<size_t>(text.size(), 1));
+    double best_seconds = 1e30;
+    std::vector<size_t> newlines;
+    for (size_t rep = 0; rep < repetitions; ++rep) {
+        newlines.clear();
+        auto start = clock::now();
+        fn(text, newlines);
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        best_seconds = std::min(best_seconds, elapsed.count());
+    }
+    count = newlines.size();
+    return best_seconds > 0 ? text.size() / best_seconds / 1e9 : 0;
+}
+
+int main(int argc, char **argv) {
+    size_t max_mb = 256;
+    std::vector<std::string> paths;
+    for (int idx = 1; idx < argc; ++idx) {
+        std::string arg = argv[idx];
+        if (arg == "--max-mb" && idx + 1 < argc) {
+            max_mb = std::strtoull(argv[++idx], nullptr, 10);
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty()) {
+        paths = {"sample_files/simple.txt", "sample_files/multiline.txt"};
+    }
+
+    std::vector<Input> inputs;
+    for (std::string const &path : paths) {
+        FileHandle file_handle(path);
+        MappedFile mapped = file_handle.map();
+        inputs.push_back({path, std::string{mapped.view()}});
+    }
+    for (size_t mb = 1; mb <= max_mb; mb *= 8) {
+        inputs.push_back({"generated " + std::to_string(mb) + " MiB, ~80 B lines", generate_text(mb << 20, 80, 1)});
+        inputs.push_back({"generated " + std::to_string(mb) + " MiB, ~8 B lines", generate_text(mb << 20, 8, 2)});
+    }
+
+    std::vector<NewlineScanner::Method> methods{NewlineScanner::Method::SCALAR};
+#ifdef ELDITOR_X86_SIMD
+    methods.push_back(NewlineScanner::Method::SSE2);
+    if (NewlineScanner::best_method() == NewlineScanner::Method::AVX2) {
+        methods.push_back(NewlineScanner::Method::AVX2);
+    }
+#endif
+
+    printf("%-36s %14s %10s", "input", "bytes", "newlines");
+    printf(" %14s", "find_first_of");
+    for (NewlineScanner::Method method : methods) {
+        printf(" %10s", NewlineScanner::method_name(method));
+    }
+    printf("   (GB/s)\n");
+
+    for (Input const &input : inputs) {
+        size_t expected = 0;
+        double baseline = measure(input.m_text, expected, [](std::string_view text, std::vector<size_t> &newlines) {
+            find_newlines_find_first_of(text, newlines);
+        });
+        printf("%-36s %14zu %10zu %14.2f", input.m_name.c_str(), input.m_text.size(), expected, baseline);
+
+        for (NewlineScanner::Method method : methods) {
+            size_t count = 0;
+            double rate = measure(input.m_text, count, [method](std::string_view text, std::vector<size_t> &newlines) {
+                NewlineScanner::find_newlines(text, 0, newlines, method);
+            });
+            if (count != expected) {
+                fprintf(stderr, "%s found %zu newlines, expected %zu\n", NewlineScanner::method_name(method), count,
+                        expected);
+                return 1;
+            }
+            printf(" %10.2f", rate);
+        }
+        printf("\n");
+    }
+    return 0;
+}
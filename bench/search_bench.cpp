@@ -0,0 +1,173 @@
+// Measures find, find-all and replace-all throughput on a fragmented buffer.
+//
+//   make bench DEBUG=0
+//   ./build-release/bench/search_bench.out [--max-mb N] [--threads N]
+//
+// Generated prose from 1 MiB up to --max-mb (default 64) is loaded into a TextBuffer and
+// broken up by a few thousand small edits, so matches also have to be found across pieces.
+// find_all runs once on a single thread and once on --threads threads (default: one per
+// core); replace_all includes its find_all. Regex patterns are then found one match after
+// another, the way find-next walks them, with compile times for a new and a cached pattern.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LiteralMatcher.h"
+#include "Regex.h"
+#include "TextBuffer.h"
+#include "ThreadPool.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+struct Pattern {
+    std::string m_text;
+    bool m_fold_case;
+};
+
+static std::string generate_text(size_t size, uint32_t seed) {
+    static char const *const words[] = {"the",   "quick",  "brown",  "fox",    "jumps", "over",  "lazy",
+                                        "dog",   "needle", "Needle", "buffer", "piece", "table", "search",
+                                        "match", "cursor", "render", "frame",  "key",   "line"};
+    size_t const num_words = sizeof(words) / sizeof(words[0]);
+    std::mt19937 rng(seed);
+    std::string text;
+    text.reserve(size + 16);
+    size_t line_length = 0;
+    while (text.size() < size) {
+        char const *word = words[rng() % num_words];
+        text.append(word);
+        line_length += strlen(word);
+        if (line_length > 70) {
+            text.push_back('\n');
+            line_length = 0;
+        } else {
+            text.push_back(' ');
+        }
+    }
+    text.resize(size);
+    return text;
+}
+
+static TextBuffer make_buffer(std::string const &text) {
+    TextBuffer buffer{text};
+    std::mt19937 rng(7);
+    for (size_t idx = 0; idx < 4000; ++idx) {
+        buffer.insert_at(rng() % buffer.size(), "needle ");
+    }
+    return buffer;
+}
+
+template <typename F>
+static double time_seconds(F &&fn) {
+    auto start = bench_clock::now();
+    fn();
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+    size_t max_mb = 64;
+    size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int idx = 1; idx + 1 < argc; idx += 2) {
+        std::string arg = argv[idx];
+        if (arg == "--max-mb") {
+            max_mb = std::strtoull(argv[idx + 1], nullptr, 10);
+        } else if (arg == "--threads") {
+            num_threads = std::max<size_t>(1, std::strtoull(argv[idx + 1], nullptr, 10));
+        } else {
+            fprintf(stderr, "search_bench: unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<Pattern> patterns{
+        {"line", false},
+        {"needle", false},
+        {"needle", true},
+        {"the lazy dog", false},
+        {"quick brown fox jumps over the lazy dog needle", false},
+    };
+    std::vector<std::string> regex_patterns{
+        "ne+dle",
+        "^line",
+        "(quick|lazy) [a-z]+ (fox|dog)",
+        "[0-9]{3}",
+    };
+    char const *const strategy_names[] = {"memchr", "first/last", "horspool"};
+
+    ThreadPool single_thread{1};
+    ThreadPool all_threads{num_threads};
+
+    printf("%-10s %-24s %-10s %10s %10s %14s %14s %14s %12s\n", "MiB", "pattern", "strategy", "matches",
+           "first (us)", "1 thread (M/s)", "N threads (M/s)", "N threads GB/s", "replace (ms)");
+    for (size_t mb = 1; mb <= max_mb; mb *= 4) {
+        std::string text = generate_text(mb << 20, (uint32_t)mb);
+        TextBuffer buffer = make_buffer(text);
+
+        for (Pattern const &pattern : patterns) {
+            LiteralMatcher matcher{pattern.m_text, pattern.m_fold_case};
+
+            double first_seconds = time_seconds([&]() { buffer.find(matcher, 0); });
+            std::vector<size_t> single_matches;
+            double single_seconds =
+                time_seconds([&]() { single_matches = buffer.find_all(matcher, single_thread); });
+            std::vector<size_t> matches;
+            double parallel_seconds =
+                time_seconds([&]() { matches = buffer.find_all(matcher, all_threads); });
+            if (matches != single_matches) {
+                fprintf(stderr, "search_bench: thread counts disagree on %s\n", pattern.m_text.c_str());
+                return 1;
+            }
+
+            TextBuffer scratch = make_buffer(text);
+            double replace_seconds = time_seconds([&]() {
+                std::vector<size_t> found = scratch.find_all(matcher, all_threads);
+                scratch.replace_all(found, matcher.size(), "REPLACED");
+            });
+
+            std::string label = (pattern.m_fold_case ? "(i) " : "") + pattern.m_text.substr(0, 20);
+            printf("%-10zu %-24s %-10s %10zu %10.1f %14.1f %14.1f %14.2f %12.1f\n", mb, label.c_str(),
+                   strategy_names[(int)matcher.strategy()], matches.size(), first_seconds * 1e6,
+                   single_matches.size() / single_seconds / 1e6, matches.size() / parallel_seconds / 1e6,
+                   buffer.size() / parallel_seconds / 1e9, replace_seconds * 1e3);
+        }
+    }
+
+    printf("\n%-10s %-32s %10s %12s %12s %10s %12s %12s\n", "MiB", "regex", "matches", "compile (us)",
+           "cached (us)", "first (us)", "matches (M/s)", "GB/s");
+    for (size_t mb = 1; mb <= max_mb; mb *= 4) {
+        std::string text = generate_text(mb << 20, (uint32_t)mb);
+        TextBuffer buffer = make_buffer(text);
+
+        RegexCache cache;
+        for (std::string const &pattern : regex_patterns) {
+            std::string error;
+            double compile_seconds = time_seconds([&]() { cache.get(pattern, false, error); });
+            std::shared_ptr<Regex> regex;
+            double cached_seconds = time_seconds([&]() { regex = cache.get(pattern, false, error); });
+            if (regex == nullptr) {
+                fprintf(stderr, "search_bench: %s: %s\n", pattern.c_str(), error.c_str());
+                return 1;
+            }
+
+            double first_seconds = time_seconds([&]() { buffer.find(*regex, 0); });
+            size_t num_matches = 0;
+            double all_seconds = time_seconds([&]() {
+                std::optional<RegexMatch> match = buffer.find(*regex, 0);
+                for (; match.has_value(); match = buffer.find(*regex, match->m_offset + match->m_length)) {
+                    num_matches++;
+                }
+            });
+            printf("%-10zu %-32s %10zu %12.1f %12.1f %10.1f %12.2f %12.2f\n", mb, pattern.c_str(),
+                   num_matches, compile_seconds * 1e6, cached_seconds * 1e6, first_seconds * 1e6,
+                   num_matches / all_seconds / 1e6, buffer.size() / all_seconds / 1e9);
+        }
+    }
+    return 0;
+}
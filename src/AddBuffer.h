@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// The append-only buffer that edits write their text into. It is made of blocks that are
+// never moved, resized or freed while the buffer lives, so a view into it stays valid no
+// matter how much gets appended afterwards. That is what lets another thread read a
+// snapshot of the pieces (e.g. to save them) while editing carries on.
+class AddBuffer {
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    struct Block {
+        std::unique_ptr<char[]> m_data;
+        // offset of m_data[0]
+        size_t m_base;
+        size_t m_size;
+        size_t m_capacity;
+    };
+
+    std::vector<Block> m_blocks;
+
+  public:
+    AddBuffer() {
+    }
+
+    AddBuffer(AddBuffer &&) = default;
+    AddBuffer &operator=(AddBuffer &&) = default;
+
+    // Appends text and returns the offset it was stored at. Each append is stored
+    // contiguously; when it doesn't fit in the current block a new block is started one
+    // offset past the end of the old one's capacity, so text in different blocks never
+    // looks adjacent.
+    size_t append(std::string_view text) {
+        if (m_blocks.empty() || m_blocks.back().m_capacity - m_blocks.back().m_size < text.size()) {
+            size_t base = m_blocks.empty() ? 0 : m_blocks.back().m_base + m_blocks.back().m_capacity + 1;
+            size_t capacity = std::max(BLOCK_SIZE, text.size());
+            m_blocks.push_back(Block{std::make_unique<char[]>(capacity), base, 0, capacity});
+        }
+        Block &block = m_blocks.back();
+        size_t offset = block.m_base + block.m_size;
+        std::copy(text.begin(), text.end(), block.m_data.get() + block.m_size);
+        block.m_size += text.size();
+        return offset;
+    }
+
+    // The text at [offset, offset + length), which must have come from a single append
+    std::string_view view(size_t offset, size_t length) const {
+        auto it = std::upper_bound(m_blocks.begin(), m_blocks.end(), offset,
+                                   [](size_t value, Block const &block) { return value < block.m_base; });
+        assert(it != m_blocks.begin());
+        Block const &block = *(it - 1);
+        assert(offset + length <= block.m_base + block.m_size);
+        return std::string_view{block.m_data.get() + (offset - block.m_base), length};
+    }
+};
@@ -5,6 +5,13 @@
 enum class COLOUR {
   NORMAL,
   CURSOR,
+  MATCH,
+  KEYWORD,
+  TYPE,
+  STRING,
+  NUMBER,
+  COMMENT,
+  PREPROCESSOR,
 };
 
 enum class ATTRIBUTE {
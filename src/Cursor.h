@@ -92,6 +92,14 @@ class Cursor {
         return m_trailing_point;
     }
 
+    CursorPoint const &active_point() const {
+        return m_active_point;
+    }
+
+    CursorPoint const &trailing_point() const {
+        return m_trailing_point;
+    }
+
     CursorPoint &get_left_point() {
         if (active_point_is_behind_trailing_point()) {
             return m_active_point;
@@ -0,0 +1,584 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "PieceTable.h"
+#include "TextBuffer.h"
+#include "file.h"
+
+// What replaying a journal came to
+struct JournalReplay {
+    // whether the journal's edits were made over the file as it is now; if not, nothing
+    // was replayed
+    bool m_matched;
+    size_t m_num_edits;
+    // how much of the journal was read and applied; anything after it was torn off by the
+    // crash or doesn't make sense
+    size_t m_length;
+    // where the last edit replayed left off, for the cursor to go
+    size_t m_end_offset;
+};
+
+// An append-only log of the edits made to a file since it was last saved, kept next to it
+// so that a crash or a dropped connection doesn't lose them. Recording an edit only copies
+// it into a buffer; a background thread writes what has built up out in one go and
+// fdatasyncs it, so a crash loses at most the last FLUSH_INTERVAL of typing.
+//
+// The journal starts with the stamp of the file its edits were made over. A save marks
+// where its snapshot was taken and, once the file is replaced, appends the new file's
+// stamp, so edits made while the save ran can be replayed over whichever file survived.
+// A save that nothing was edited during removes the journal instead. Bytes something else
+// appended to the file are only marked with its new stamp: they go on the end of the buffer,
+// past every edit, so the edits before them replay over the longer file just the same.
+//
+// Records are a 64 bit length, a checksum of what follows, then the record's type and
+// fields, all in the machine's byte order; a journal is only ever read where it was written.
+class EditJournal {
+    static constexpr char MAGIC[8] = {'E', 'L', 'D', 'J', 'R', 'N', 'L', '1'};
+    static constexpr size_t FILE_HEADER_SIZE = sizeof(MAGIC) + 3 * sizeof(uint64_t);
+    static constexpr size_t RECORD_HEADER_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+    static constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(200);
+    // a batch this big is written out without waiting, e.g. after a large paste
+    static constexpr size_t FLUSH_BYTES = 1 << 20;
+
+    enum class RecordType : uint8_t {
+        // offset, then the text
+        INSERT,
+        // offset and length
+        REMOVE,
+        // how many ranges, the ranges as offset and length, then the text that replaces each
+        REPLACE,
+        // a save took its snapshot here
+        SAVE_STARTED,
+        // the save started last finished, leaving a file with this stamp
+        SAVED,
+        // the file was appended to on disk, leaving one with this stamp, and the buffer read
+        // what was appended onto its end
+        APPENDED,
+    };
+
+    std::string const m_pathname;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    // records the worker hasn't written yet
+    std::vector<char> m_pending;
+    // whether m_pending starts a new journal, rather than carrying on the one on disk
+    bool m_pending_starts_file;
+    bool m_remove_file;
+    bool m_stopping;
+    // whether there is a journal, on disk or still pending; until there is, m_base is what
+    // the next one will start with
+    bool m_started;
+    FileStamp m_base;
+    size_t m_edits_since_save_started;
+    // what went wrong writing the journal, until take_error hands it over
+    std::string m_error;
+
+    // worker thread only
+    int m_fd;
+    // how much of the journal already on disk is good, when carrying on from it
+    size_t m_existing_length;
+    std::vector<char> m_writing;
+
+    std::thread m_thread;
+
+  public:
+    // A journal at pathname for edits made over the file stamped base. With existing_length
+    // set it carries on from the first existing_length bytes of the one already there.
+    EditJournal(std::string pathname, FileStamp base, size_t existing_length = 0)
+        : m_pathname(std::move(pathname)), m_pending_starts_file(false), m_remove_file(false),
+          m_stopping(false), m_started(existing_length > 0), m_base(base), m_edits_since_save_started(0),
+          m_fd(-1), m_existing_length(existing_length) {
+        m_thread = std::thread([this]() { work(); });
+    }
+
+    // writes out whatever is still pending before going
+    ~EditJournal() {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stopping = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+        if (m_fd != -1) {
+            close(m_fd);
+        }
+    }
+
+    EditJournal(EditJournal const &) = delete;
+    EditJournal &operator=(EditJournal const &) = delete;
+    EditJournal(EditJournal &&) = delete;
+    EditJournal &operator=(EditJournal &&) = delete;
+
+    // Where the journal for the file at pathname goes: a hidden file next to it
+    static std::string pathname_for(std::string const &pathname) {
+        size_t slash_idx = pathname.rfind('/');
+        size_t name_idx = slash_idx == std::string::npos ? 0 : slash_idx + 1;
+        return pathname.substr(0, name_idx) + "." + pathname.substr(name_idx) + ".elditor-journal";
+    }
+
+    void record_insert(size_t offset, std::string_view text) {
+        append_record(RecordType::INSERT, [&]() {
+            append_u64(offset);
+            append(text.data(), text.size());
+        });
+    }
+
+    void record_remove(size_t offset, size_t length) {
+        append_record(RecordType::REMOVE, [&]() {
+            append_u64(offset);
+            append_u64(length);
+        });
+    }
+
+    // ranges sorted and apart, like PieceTable::replace_ranges takes them
+    void record_replace(std::vector<TextRange> const &ranges, std::string_view text) {
+        record_replace(ranges.size(), [&](size_t idx) { return ranges[idx]; }, text);
+    }
+
+    // The same for match_length bytes at each of offsets, like replace_all
+    void record_replace_all(std::vector<size_t> const &offsets, size_t match_length, std::string_view text) {
+        auto range_at = [&](size_t idx) { return TextRange{offsets[idx], match_length}; };
+        record_replace(offsets.size(), range_at, text);
+    }
+
+    // A save has taken its snapshot, with every edit recorded so far in it
+    void mark_save_started() {
+        std::lock_guard lock{m_mutex};
+        m_edits_since_save_started = 0;
+        if (m_started) {
+            append_record_locked(RecordType::SAVE_STARTED, []() {});
+        }
+    }
+
+    // The save started last has replaced the file with one stamped stamp. Unless there
+    // were edits made after its snapshot, the journal has nothing left to keep.
+    void mark_saved(FileStamp const &stamp) {
+        std::lock_guard lock{m_mutex};
+        if (m_started && m_edits_since_save_started > 0) {
+            append_record_locked(RecordType::SAVED, [&]() { append_stamp(stamp); });
+            return;
+        }
+        start_over_locked(stamp);
+    }
+
+    // The file was appended to behind our back and is now stamped stamp, with what was
+    // appended read onto the end of the buffer; the edits so far still stand over it
+    void mark_appended(FileStamp const &stamp) {
+        std::lock_guard lock{m_mutex};
+        if (!m_started) {
+            m_base = stamp;
+            return;
+        }
+        append_record_locked(RecordType::APPENDED, [&]() { append_stamp(stamp); });
+    }
+
+    // What last went wrong writing or removing the journal, if anything, for the status bar;
+    // the worker can't print it while the terminal is being drawn on
+    std::string take_error() {
+        std::lock_guard lock{m_mutex};
+        return std::exchange(m_error, std::string{});
+    }
+
+    // Removes the journal, for when its edits aren't wanted any more
+    void discard() {
+        std::lock_guard lock{m_mutex};
+        start_over_locked(m_base);
+    }
+
+    // Removes the journal and records edits from here on over the file stamped base, for
+    // when the buffer has been reloaded from a file changed behind our back
+    void start_over(FileStamp const &base) {
+        std::lock_guard lock{m_mutex};
+        start_over_locked(base);
+    }
+
+    // Applies the edits in the journal at pathname to buffer, which holds the file stamped
+    // stamp, if that's the file they were made over or one a save during them left. Reading
+    // stops at the first record that was torn off or doesn't fit the text. Runs of typing
+    // and deleting are put back together and applied as one edit each. nullopt if there is
+    // no journal, or if there is one it couldn't read, in which case error says why.
+    static std::optional<JournalReplay> replay(std::string const &pathname, FileStamp const &stamp,
+                                               TextBuffer &buffer, std::string &error) {
+        std::optional<std::string> contents = read_file(pathname, error);
+        if (!contents.has_value()) {
+            return std::nullopt;
+        }
+        std::string_view journal = *contents;
+        if (journal.size() < FILE_HEADER_SIZE || memcmp(journal.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            return JournalReplay{false, 0, 0, 0};
+        }
+
+        // find the intact records, and the last point the edits after which apply to stamp
+        struct Record {
+            RecordType m_type;
+            std::string_view m_fields;
+            size_t m_end;
+        };
+        std::vector<Record> records;
+        std::optional<size_t> first_to_replay;
+        if (read_stamp(journal.substr(sizeof(MAGIC))) == stamp) {
+            first_to_replay = 0;
+        }
+        size_t save_started_idx = 0;
+        // where replaying starts for the file the records so far were made over
+        size_t base_start_idx = 0;
+        for (size_t pos = FILE_HEADER_SIZE; journal.size() - pos >= RECORD_HEADER_SIZE;) {
+            uint64_t length = read_u64(journal.substr(pos));
+            uint32_t checksum;
+            memcpy(&checksum, journal.data() + pos + sizeof(uint64_t), sizeof(checksum));
+            pos += RECORD_HEADER_SIZE;
+            if (length == 0 || length > journal.size() - pos ||
+                checksum != checksum_of(journal.data() + pos, length)) {
+                break;
+            }
+            Record record{(RecordType)journal[pos], journal.substr(pos + 1, length - 1), pos + length};
+            bool has_stamp = record.m_fields.size() >= 3 * sizeof(uint64_t);
+            if (record.m_type == RecordType::SAVE_STARTED) {
+                save_started_idx = records.size() + 1;
+            } else if (record.m_type == RecordType::SAVED && has_stamp) {
+                base_start_idx = save_started_idx;
+                if (read_stamp(record.m_fields) == stamp) {
+                    first_to_replay = save_started_idx;
+                }
+            } else if (record.m_type == RecordType::APPENDED && has_stamp &&
+                       read_stamp(record.m_fields) == stamp) {
+                // the appended bytes are past every edit, so all of them since the base apply
+                first_to_replay = base_start_idx;
+            }
+            records.push_back(record);
+            pos += length;
+        }
+        if (!first_to_replay.has_value()) {
+            return JournalReplay{false, 0, 0, 0};
+        }
+
+        JournalReplay replay{true, 0, FILE_HEADER_SIZE, 0};
+        if (*first_to_replay > 0) {
+            replay.m_length = records[*first_to_replay - 1].m_end;
+        }
+        EditRun run{RecordType::INSERT, 0, {}, 0};
+        bool has_run = false;
+        auto apply_run = [&]() {
+            if (!has_run) {
+                return;
+            }
+            if (run.m_type == RecordType::INSERT) {
+                buffer.insert_at(run.m_offset, run.m_text);
+            } else {
+                buffer.remove_at(run.m_offset, run.m_length);
+            }
+            has_run = false;
+        };
+        size_t size = buffer.size();
+        for (size_t idx = *first_to_replay; idx < records.size(); ++idx) {
+            Record const &record = records[idx];
+            std::string_view fields = record.m_fields;
+            if (record.m_type == RecordType::INSERT) {
+                if (fields.size() < sizeof(uint64_t)) {
+                    break;
+                }
+                size_t offset = read_u64(fields);
+                if (offset > size) {
+                    break;
+                }
+                std::string_view text = fields.substr(sizeof(uint64_t));
+                bool continues_run = has_run && run.m_type == RecordType::INSERT;
+                if (!continues_run || offset != run.m_offset + run.m_text.size()) {
+                    apply_run();
+                    run = EditRun{RecordType::INSERT, offset, {}, 0};
+                    has_run = true;
+                }
+                run.m_text.append(text);
+                size += text.size();
+                replay.m_end_offset = offset + text.size();
+            } else if (record.m_type == RecordType::REMOVE) {
+                if (fields.size() < 2 * sizeof(uint64_t)) {
+                    break;
+                }
+                size_t offset = read_u64(fields);
+                size_t length = read_u64(fields.substr(sizeof(uint64_t)));
+                if (offset > size || length > size - offset) {
+                    break;
+                }
+                bool continues_run = has_run && run.m_type == RecordType::REMOVE;
+                if (continues_run && offset + length == run.m_offset) {
+                    // backspace
+                    run.m_offset = offset;
+                    run.m_length += length;
+                } else if (continues_run && offset == run.m_offset) {
+                    // delete
+                    run.m_length += length;
+                } else {
+                    apply_run();
+                    run = EditRun{RecordType::REMOVE, offset, {}, length};
+                    has_run = true;
+                }
+                size -= length;
+                replay.m_end_offset = offset;
+            } else if (record.m_type == RecordType::REPLACE) {
+                std::optional<std::vector<TextRange>> ranges = read_ranges(fields, size);
+                if (!ranges.has_value()) {
+                    break;
+                }
+                std::string_view text = fields.substr(sizeof(uint64_t) * (1 + 2 * ranges->size()));
+                apply_run();
+                buffer.replace_ranges(*ranges, text);
+                size_t removed = 0;
+                for (TextRange const &range : *ranges) {
+                    removed += range.m_length;
+                }
+                TextRange const &last = ranges->back();
+                replay.m_end_offset = last.m_offset + last.m_length - removed + ranges->size() * text.size();
+                size = size - removed + ranges->size() * text.size();
+            }
+            if (record.m_type == RecordType::INSERT || record.m_type == RecordType::REMOVE ||
+                record.m_type == RecordType::REPLACE) {
+                replay.m_num_edits++;
+            }
+            replay.m_length = record.m_end;
+        }
+        apply_run();
+        return replay;
+    }
+
+  private:
+    // edits being put back together while replaying
+    struct EditRun {
+        RecordType m_type;
+        size_t m_offset;
+        std::string m_text;
+        size_t m_length;
+    };
+
+    template <typename RangeAt>
+    void record_replace(size_t count, RangeAt &&range_at, std::string_view text) {
+        append_record(RecordType::REPLACE, [&]() {
+            append_u64(count);
+            for (size_t idx = 0; idx < count; ++idx) {
+                TextRange range = range_at(idx);
+                append_u64(range.m_offset);
+                append_u64(range.m_length);
+            }
+            append(text.data(), text.size());
+        });
+    }
+
+    template <typename F>
+    void append_record(RecordType type, F &&append_fields) {
+        std::lock_guard lock{m_mutex};
+        append_record_locked(type, append_fields);
+        m_edits_since_save_started++;
+    }
+
+    // Adds a record to the batch, starting the journal first if there isn't one yet
+    template <typename F>
+    void append_record_locked(RecordType type, F &&append_fields) {
+        // the worker sleeps until there is something to write
+        bool wake_worker = m_pending.empty();
+        if (!m_started) {
+            m_started = true;
+            m_pending_starts_file = true;
+            append(MAGIC, sizeof(MAGIC));
+            append_stamp(m_base);
+        }
+        size_t header_pos = m_pending.size();
+        m_pending.resize(header_pos + RECORD_HEADER_SIZE);
+        m_pending.push_back((char)type);
+        append_fields();
+        uint64_t length = m_pending.size() - header_pos - RECORD_HEADER_SIZE;
+        uint32_t checksum = checksum_of(m_pending.data() + header_pos + RECORD_HEADER_SIZE, length);
+        memcpy(m_pending.data() + header_pos, &length, sizeof(length));
+        memcpy(m_pending.data() + header_pos + sizeof(length), &checksum, sizeof(checksum));
+        if (wake_worker || m_pending.size() >= FLUSH_BYTES) {
+            m_wake.notify_one();
+        }
+    }
+
+    // Drops the journal; the next edit starts a new one over the file stamped base
+    void start_over_locked(FileStamp const &base) {
+        if (m_started) {
+            m_remove_file = true;
+            m_wake.notify_one();
+        }
+        m_pending.clear();
+        m_pending_starts_file = false;
+        m_started = false;
+        m_base = base;
+    }
+
+    void append(void const *data, size_t size) {
+        char const *bytes = static_cast<char const *>(data);
+        m_pending.insert(m_pending.end(), bytes, bytes + size);
+    }
+
+    void append_u64(uint64_t value) {
+        append(&value, sizeof(value));
+    }
+
+    void append_stamp(FileStamp const &stamp) {
+        append_u64(stamp.m_inode);
+        append_u64(stamp.m_size);
+        append_u64((uint64_t)stamp.m_mtime_ns);
+    }
+
+    static uint64_t read_u64(std::string_view bytes) {
+        uint64_t value;
+        memcpy(&value, bytes.data(), sizeof(value));
+        return value;
+    }
+
+    static FileStamp read_stamp(std::string_view bytes) {
+        return FileStamp{read_u64(bytes), read_u64(bytes.substr(8)), (int64_t)read_u64(bytes.substr(16))};
+    }
+
+    // The ranges of a REPLACE record, if they're sorted, apart and within size bytes
+    static std::optional<std::vector<TextRange>> read_ranges(std::string_view fields, size_t size) {
+        if (fields.size() < sizeof(uint64_t)) {
+            return std::nullopt;
+        }
+        uint64_t count = read_u64(fields);
+        if (count == 0 || count > (fields.size() - sizeof(uint64_t)) / (2 * sizeof(uint64_t))) {
+            return std::nullopt;
+        }
+        std::vector<TextRange> ranges;
+        ranges.reserve(count);
+        size_t end = 0;
+        for (size_t idx = 0; idx < count; ++idx) {
+            size_t pos = sizeof(uint64_t) * (1 + 2 * idx);
+            TextRange range{read_u64(fields.substr(pos)), read_u64(fields.substr(pos + sizeof(uint64_t)))};
+            bool overlaps = idx > 0 && range.m_offset < end;
+            if (overlaps || range.m_offset > size || range.m_length > size - range.m_offset) {
+                return std::nullopt;
+            }
+            end = range.m_offset + range.m_length;
+            ranges.push_back(range);
+        }
+        return ranges;
+    }
+
+    // FNV-1a; it only has to catch a record that was half written when we crashed
+    static uint32_t checksum_of(char const *data, size_t length) {
+        uint32_t hash = 2166136261u;
+        for (size_t idx = 0; idx < length; ++idx) {
+            hash = (hash ^ (unsigned char)data[idx]) * 16777619u;
+        }
+        return hash;
+    }
+
+    static std::optional<std::string> read_file(std::string const &pathname, std::string &error) {
+        int fd = ::open(pathname.data(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            if (errno != ENOENT) {
+                int errsv = errno;
+                error = std::string("Error opening journal: ") + strerror(errsv);
+            }
+            return std::nullopt;
+        }
+        std::string contents;
+        char block[1 << 16];
+        while (true) {
+            ssize_t count = read(fd, block, sizeof(block));
+            if (count == -1 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                // a read error leaves whatever came before it to replay
+                break;
+            }
+            contents.append(block, count);
+        }
+        close(fd);
+        return contents;
+    }
+
+    void work() {
+        while (true) {
+            bool starts_file;
+            bool remove_file;
+            bool stopping;
+            {
+                std::unique_lock lock{m_mutex};
+                m_wake.wait(lock, [this]() { return m_stopping || m_remove_file || !m_pending.empty(); });
+                // give the batch a little while to fill up
+                m_wake.wait_for(lock, FLUSH_INTERVAL, [this]() {
+                    return m_stopping || m_remove_file || m_pending.size() >= FLUSH_BYTES;
+                });
+                std::swap(m_pending, m_writing);
+                starts_file = m_pending_starts_file;
+                m_pending_starts_file = false;
+                remove_file = m_remove_file;
+                m_remove_file = false;
+                stopping = m_stopping;
+            }
+            if (remove_file) {
+                remove_journal();
+            }
+            if (!m_writing.empty()) {
+                write_batch(starts_file);
+                m_writing.clear();
+            }
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    // Keeps what went wrong, with errno's description, for take_error
+    void report(char const *what) {
+        int errsv = errno;
+        std::lock_guard lock{m_mutex};
+        m_error = std::string(what) + ": " + strerror(errsv);
+    }
+
+    void remove_journal() {
+        if (m_fd != -1) {
+            close(m_fd);
+            m_fd = -1;
+        }
+        m_existing_length = 0;
+        if (unlink(m_pathname.data()) == -1 && errno != ENOENT) {
+            report("Error removing journal");
+        }
+    }
+
+    void write_batch(bool starts_file) {
+        if (starts_file && m_fd != -1) {
+            close(m_fd);
+            m_fd = -1;
+        }
+        if (m_fd == -1) {
+            int flags = O_WRONLY | O_APPEND | O_CLOEXEC | (starts_file ? O_CREAT | O_TRUNC : 0);
+            m_fd = ::open(m_pathname.data(), flags, 0600);
+            if (m_fd == -1) {
+                report("Error opening journal");
+                return;
+            }
+            // cut off whatever a crash left half written after the part that was replayed
+            if (!starts_file && ftruncate(m_fd, m_existing_length) == -1) {
+                report("Error truncating journal");
+            }
+        }
+        if (!write_all(m_fd, {std::string_view{m_writing.data(), m_writing.size()}})) {
+            report("Error writing journal");
+            return;
+        }
+        fdatasync(m_fd);
+        if (starts_file) {
+            // a new journal only survives a crash once its directory entry is on disk
+            size_t slash_idx = m_pathname.rfind('/');
+            sync_directory(slash_idx == std::string::npos ? "." : m_pathname.substr(0, slash_idx + 1));
+        }
+    }
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Prefix sums over a sequence of counts where single counts change often: both updating a
+// count and summing a prefix are O(log n), as is finding how far a sum reaches.
+class FenwickTree {
+    // 1-based; m_tree[idx] is the sum of the counts in (idx - lowest_bit(idx), idx]
+    std::vector<size_t> m_tree;
+
+  public:
+    FenwickTree() : m_tree(1, 0) {
+    }
+
+    // Starts over with counts, in linear time
+    void assign(std::vector<size_t> const &counts) {
+        m_tree.assign(counts.size() + 1, 0);
+        for (size_t idx = 1; idx < m_tree.size(); ++idx) {
+            m_tree[idx] += counts[idx - 1];
+            size_t parent = idx + (idx & -idx);
+            if (parent < m_tree.size()) {
+                m_tree[parent] += m_tree[idx];
+            }
+        }
+    }
+
+    size_t size() const {
+        return m_tree.size() - 1;
+    }
+
+    // Changes the count at idx from old_count to new_count
+    void update(size_t idx, size_t old_count, size_t new_count) {
+        // unsigned wraparound makes this work for counts that shrink too
+        size_t delta = new_count - old_count;
+        for (idx++; idx < m_tree.size(); idx += idx & -idx) {
+            m_tree[idx] += delta;
+        }
+    }
+
+    // The sum of the first count counts
+    size_t prefix_sum(size_t count) const {
+        size_t sum = 0;
+        for (; count > 0; count -= count & -count) {
+            sum += m_tree[count];
+        }
+        return sum;
+    }
+
+    size_t total() const {
+        return prefix_sum(size());
+    }
+
+    // How many of the leading counts fit within value, i.e. the largest k with
+    // prefix_sum(k) <= value
+    size_t count_within(size_t value) const {
+        size_t step = 1;
+        while (step * 2 < m_tree.size()) {
+            step *= 2;
+        }
+        size_t idx = 0;
+        for (; step > 0; step /= 2) {
+            if (idx + step < m_tree.size() && m_tree[idx + step] <= value) {
+                idx += step;
+                value -= m_tree[idx];
+            }
+        }
+        return idx;
+    }
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "NewlineScanner.h"
+#include "file.h"
+
+// The newlines found in one consecutive stretch of a file
+struct LoadedChunk {
+    size_t m_length;
+    // offsets from the start of the file
+    std::vector<size_t> m_newlines;
+};
+
+// Indexes a mapped file on a background thread, handing back one chunk at a time so the
+// editor can show the start of the file while the rest is still being scanned. The first
+// chunk is kept small so the first screenful is ready almost immediately.
+class FileLoader {
+    static constexpr size_t FIRST_CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t CHUNK_SIZE = 4 * 1024 * 1024;
+
+    // owned by the TextBuffer being loaded, which must outlive us
+    MappedFile const *m_mapping;
+
+    std::mutex m_mutex;
+    std::condition_variable m_chunk_ready;
+    std::vector<LoadedChunk> m_ready_chunks;
+    bool m_scanning_done;
+
+    std::atomic<bool> m_stop_requested;
+    std::atomic<size_t> m_bytes_scanned;
+    std::thread m_thread;
+
+  public:
+    FileLoader(MappedFile const *mapping)
+        : m_mapping(mapping), m_scanning_done(false), m_stop_requested(false), m_bytes_scanned(0) {
+        m_thread = std::thread([this]() { scan(); });
+    }
+
+    ~FileLoader() {
+        m_stop_requested = true;
+        m_thread.join();
+    }
+
+    FileLoader(FileLoader const &) = delete;
+    FileLoader &operator=(FileLoader const &) = delete;
+    FileLoader(FileLoader &&) = delete;
+    FileLoader &operator=(FileLoader &&) = delete;
+
+    // Takes every chunk scanned so far, in file order; with wait set this blocks until
+    // there is at least one chunk or the scan is over
+    std::vector<LoadedChunk> take_chunks(bool wait) {
+        std::unique_lock lock{m_mutex};
+        if (wait) {
+            m_chunk_ready.wait(lock, [this]() { return !m_ready_chunks.empty() || m_scanning_done; });
+        }
+        std::vector<LoadedChunk> chunks;
+        std::swap(chunks, m_ready_chunks);
+        return chunks;
+    }
+
+    // True once every chunk has been scanned (they may not have been taken yet)
+    bool scanning_done() {
+        std::lock_guard lock{m_mutex};
+        return m_scanning_done;
+    }
+
+    size_t bytes_scanned() const {
+        return m_bytes_scanned;
+    }
+
+    size_t total_bytes() const {
+        return m_mapping->size();
+    }
+
+  private:
+    void scan() {
+        m_mapping->advise_sequential();
+        std::string_view text = m_mapping->view();
+        size_t offset = 0;
+        size_t chunk_size = FIRST_CHUNK_SIZE;
+        while (offset < text.size() && !m_stop_requested) {
+            size_t length = std::min(chunk_size, text.size() - offset);
+            LoadedChunk chunk{length, {}};
+            NewlineScanner::find_newlines(text.substr(offset, length), offset, chunk.m_newlines);
+            // done with these pages until something displays them
+            m_mapping->release_pages(offset, length);
+
+            offset += length;
+            chunk_size = CHUNK_SIZE;
+            m_bytes_scanned = offset;
+            {
+                std::lock_guard lock{m_mutex};
+                m_ready_chunks.push_back(std::move(chunk));
+            }
+            m_chunk_ready.notify_one();
+        }
+
+        {
+            std::lock_guard lock{m_mutex};
+            m_scanning_done = true;
+        }
+        m_chunk_ready.notify_one();
+    }
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "file.h"
+
+// Writes a snapshot of the buffer out to a file on a background thread, so a save never
+// stalls typing. The snapshot is just the buffer's pieces: the text they point at is never
+// moved or overwritten, so edits made while the save runs don't touch what it reads.
+class FileSaver {
+    std::string m_pathname;
+    // views into a TextBuffer, which must outlive us
+    std::vector<std::string_view> m_chunks;
+    size_t m_size;
+
+    std::atomic<bool> m_done;
+    std::atomic<bool> m_succeeded;
+    // why it failed; only written before m_done is set
+    std::string m_error;
+    std::thread m_thread;
+
+  public:
+    FileSaver(std::string pathname, std::vector<std::string_view> chunks)
+        : m_pathname(std::move(pathname)), m_chunks(std::move(chunks)), m_size(0), m_done(false),
+          m_succeeded(false) {
+        for (std::string_view chunk : m_chunks) {
+            m_size += chunk.size();
+        }
+        m_thread = std::thread([this]() {
+            m_succeeded = FileHandle::write_atomically(m_pathname, m_chunks, m_error);
+            m_done = true;
+        });
+    }
+
+    // a save can't be abandoned halfway, the file is only replaced once it's all written
+    ~FileSaver() {
+        m_thread.join();
+    }
+
+    FileSaver(FileSaver const &) = delete;
+    FileSaver &operator=(FileSaver const &) = delete;
+    FileSaver(FileSaver &&) = delete;
+    FileSaver &operator=(FileSaver &&) = delete;
+
+    bool done() const {
+        return m_done;
+    }
+
+    // Only meaningful once done
+    bool succeeded() const {
+        return m_succeeded;
+    }
+
+    // Why it failed, once done without succeeding
+    std::string const &error() const {
+        return m_error;
+    }
+
+    // How many bytes the snapshot holds
+    size_t size() const {
+        return m_size;
+    }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <errno.h>
+#include <iostream>
+#include <string.h>
+#include <string>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// Notices when the file at a pathname is written, replaced or removed, by us or anyone
+// else. Writes are watched on the file itself, so writes to its neighbours, like our own
+// journal, don't wake us. Its directory is only watched for names coming and going, so a
+// file replaced by renaming another over it, the way most editors save, is still followed.
+// The main loop waits on fd() alongside the terminal.
+class FileWatcher {
+    static constexpr uint32_t FILE_EVENTS = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB;
+    static constexpr uint32_t DIRECTORY_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+    int m_fd;
+    std::string m_pathname;
+    // the file's name within the watched directory
+    std::string m_name;
+    int m_directory_wd;
+    // the watch on whatever file is at the pathname; it moves to a new one when one is
+    // renamed or created there
+    int m_file_wd;
+
+  public:
+    FileWatcher(std::string const &pathname)
+        : m_fd(-1), m_pathname(pathname), m_directory_wd(-1), m_file_wd(-1) {
+        size_t slash_idx = pathname.rfind('/');
+        std::string directory = slash_idx == std::string::npos ? "." : pathname.substr(0, slash_idx + 1);
+        m_name = slash_idx == std::string::npos ? pathname : pathname.substr(slash_idx + 1);
+
+        m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_fd == -1) {
+            int errsv = errno;
+            std::cerr << "FileWatcher Constructor: Error starting inotify. " << strerror(errsv) << std::endl;
+            return;
+        }
+        m_directory_wd = inotify_add_watch(m_fd, directory.data(), DIRECTORY_EVENTS);
+        if (m_directory_wd == -1) {
+            int errsv = errno;
+            std::cerr << "FileWatcher Constructor: Error watching the directory. " << strerror(errsv)
+                      << std::endl;
+            close(m_fd);
+            m_fd = -1;
+            return;
+        }
+        watch_file();
+    }
+
+    ~FileWatcher() {
+        if (m_fd != -1) {
+            close(m_fd);
+        }
+    }
+
+    FileWatcher(FileWatcher const &) = delete;
+    FileWatcher &operator=(FileWatcher const &) = delete;
+    FileWatcher(FileWatcher &&) = delete;
+    FileWatcher &operator=(FileWatcher &&) = delete;
+
+    // Readable when there are events to take; -1 if the file can't be watched
+    int fd() const {
+        return m_fd;
+    }
+
+    // Takes every pending event and returns whether any of them were about our file. A
+    // burst of writes comes down to one answer, so a file being appended to quickly is
+    // only looked at once a frame. Events about other files are just dropped.
+    bool take_changes() {
+        if (m_fd == -1) {
+            return false;
+        }
+        bool changed = false;
+        alignas(inotify_event) char events[4096];
+        while (true) {
+            ssize_t length = read(m_fd, events, sizeof(events));
+            if (length == -1 && errno == EINTR) {
+                continue;
+            }
+            if (length <= 0) {
+                return changed;
+            }
+            for (ssize_t pos = 0; pos < length;) {
+                inotify_event const *event = reinterpret_cast<inotify_event const *>(events + pos);
+                pos += sizeof(inotify_event) + event->len;
+                if (event->wd == m_file_wd) {
+                    changed = true;
+                } else if (event->wd == m_directory_wd && (event->mask & IN_IGNORED) != 0) {
+                    // the directory itself went away
+                    changed = true;
+                } else if (event->wd == m_directory_wd && event->len > 0 && m_name == event->name) {
+                    changed = true;
+                    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+                        watch_file();
+                    }
+                }
+            }
+        }
+    }
+
+  private:
+    void watch_file() {
+        int file_wd = inotify_add_watch(m_fd, m_pathname.data(), FILE_EVENTS);
+        // the file that was there before doesn't concern us any more
+        if (m_file_wd != -1 && file_wd != m_file_wd) {
+            inotify_rm_watch(m_fd, m_file_wd);
+        }
+        m_file_wd = file_wd;
+    }
+};
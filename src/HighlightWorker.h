@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "SyntaxHighlighter.h"
+#include "TextBuffer.h"
+#include "TextSnapshot.h"
+
+// The end states of a window of rows, as of one version of the buffer
+struct HighlightResult {
+    size_t m_version;
+    size_t m_first_row;
+    std::vector<LexState> m_end_states;
+};
+
+// Keeps a SyntaxHighlighter up to date on a background thread, so an edit that changes how
+// everything below it lexes never holds up a frame. Each batch of edits goes over with a
+// snapshot of the buffer tagged with a new version, and once the worker has caught up it
+// sends back the end states of the rows around the view. Until a newer result comes in,
+// rows are mapped back through the edits made since the one we have; a row whose previous
+// row was edited isn't known, and is left for the view to show as plain text.
+class HighlightWorker {
+    // how many rows get lexed between checks for newer work
+    static constexpr size_t ROWS_PER_CHECK = 1024;
+    // rows either side of the view that results cover, so scrolling a little doesn't have
+    // to wait for the worker
+    static constexpr size_t WINDOW_MARGIN = 256;
+
+    // what the worker should do next; edits pile up here until it takes them
+    struct Job {
+        size_t m_version;
+        // only set if there were edits
+        std::optional<TextSnapshot> m_snapshot;
+        std::vector<LineChange> m_changes;
+        size_t m_first_row;
+        size_t m_num_rows;
+    };
+
+    Language const m_language;
+
+    // main thread only
+    size_t m_version;
+    std::optional<HighlightResult> m_result;
+    // the edits made since m_result's version, along with the version each one made
+    std::vector<std::pair<size_t, LineChange>> m_unreported_changes;
+    size_t m_requested_first_row;
+    size_t m_requested_num_rows;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_job_ready;
+    std::optional<Job> m_job;
+    std::optional<HighlightResult> m_finished;
+    bool m_working;
+    bool m_stopping;
+
+    // worker thread only
+    SyntaxHighlighter m_highlighter;
+
+    std::thread m_thread;
+
+  public:
+    HighlightWorker(Language language)
+        : m_language(language), m_version(0), m_requested_first_row(0), m_requested_num_rows(0),
+          m_working(false), m_stopping(false) {
+        m_thread = std::thread([this]() { work(); });
+    }
+
+    ~HighlightWorker() {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stopping = true;
+        }
+        m_job_ready.notify_one();
+        m_thread.join();
+    }
+
+    HighlightWorker(HighlightWorker const &) = delete;
+    HighlightWorker &operator=(HighlightWorker const &) = delete;
+    HighlightWorker(HighlightWorker &&) = delete;
+    HighlightWorker &operator=(HighlightWorker &&) = delete;
+
+    Language language() const {
+        return m_language;
+    }
+
+    // Picks up the latest result, then hands the worker changes, the edits made to buffer
+    // since the last call, and the num_rows rows from first_row that are about to be shown
+    void update(TextBuffer const &buffer, std::vector<LineChange> const &changes, size_t first_row,
+                size_t num_rows) {
+        take_result();
+        bool in_window = first_row >= m_requested_first_row &&
+                         first_row + num_rows <= m_requested_first_row + m_requested_num_rows;
+        if (changes.empty() && in_window) {
+            return;
+        }
+        if (!changes.empty()) {
+            m_version++;
+            for (LineChange const &change : changes) {
+                m_unreported_changes.emplace_back(m_version, change);
+            }
+        }
+        m_requested_first_row = first_row - std::min(first_row, WINDOW_MARGIN);
+        m_requested_num_rows = first_row - m_requested_first_row + num_rows + WINDOW_MARGIN;
+
+        {
+            std::lock_guard lock{m_mutex};
+            if (!m_job.has_value()) {
+                m_job.emplace();
+            }
+            m_job->m_version = m_version;
+            if (!changes.empty()) {
+                m_job->m_snapshot = buffer.get_snapshot();
+                m_job->m_changes.insert(m_job->m_changes.end(), changes.begin(), changes.end());
+            }
+            m_job->m_first_row = m_requested_first_row;
+            m_job->m_num_rows = m_requested_num_rows;
+        }
+        m_job_ready.notify_one();
+    }
+
+    // The state row starts in as far as the latest result goes, or nullopt if the result
+    // doesn't cover it or the row before it has been edited since
+    std::optional<LexState> start_state(size_t row) const {
+        if (row == 0) {
+            return LexState::NORMAL;
+        }
+        if (!m_result.has_value()) {
+            return std::nullopt;
+        }
+        // follow the row before back to where it was in the result's version
+        size_t previous = row - 1;
+        for (auto it = m_unreported_changes.rbegin(); it != m_unreported_changes.rend(); ++it) {
+            LineChange const &change = it->second;
+            if (previous < change.m_first_row) {
+                continue;
+            }
+            size_t new_count = std::max<size_t>(change.m_new_count, 1);
+            if (change.m_old_count == LineChange::ALL_ROWS || previous < change.m_first_row + new_count) {
+                return std::nullopt;
+            }
+            previous = previous - new_count + change.m_old_count;
+        }
+        std::vector<LexState> const &end_states = m_result->m_end_states;
+        if (previous < m_result->m_first_row || previous - m_result->m_first_row >= end_states.size()) {
+            return std::nullopt;
+        }
+        return end_states[previous - m_result->m_first_row];
+    }
+
+    // Whether there is work queued or under way, or a result that hasn't been picked up
+    bool busy() const {
+        std::lock_guard lock{m_mutex};
+        return m_job.has_value() || m_working || m_finished.has_value();
+    }
+
+  private:
+    void take_result() {
+        {
+            std::lock_guard lock{m_mutex};
+            if (!m_finished.has_value()) {
+                return;
+            }
+            m_result = std::move(m_finished);
+            m_finished.reset();
+        }
+        size_t version = m_result->m_version;
+        std::erase_if(m_unreported_changes, [&](auto const &change) { return change.first <= version; });
+    }
+
+    void work() {
+        TextSnapshot snapshot;
+        while (true) {
+            Job job;
+            {
+                std::unique_lock lock{m_mutex};
+                m_working = false;
+                m_job_ready.wait(lock, [this]() { return m_stopping || m_job.has_value(); });
+                if (m_stopping) {
+                    return;
+                }
+                job = std::move(*m_job);
+                m_job.reset();
+                m_working = true;
+            }
+
+            if (job.m_snapshot.has_value()) {
+                snapshot = std::move(*job.m_snapshot);
+            }
+            for (LineChange const &change : job.m_changes) {
+                if (change.m_old_count == LineChange::ALL_ROWS) {
+                    m_highlighter.reset(m_language, change.m_new_count);
+                } else {
+                    m_highlighter.apply(change);
+                }
+            }
+
+            size_t end_row = std::min(job.m_first_row + job.m_num_rows, snapshot.num_lines());
+            if (!lex_up_to(snapshot, end_row)) {
+                // whatever got lexed is kept; the newer job carries on from there
+                continue;
+            }
+            HighlightResult result{job.m_version, job.m_first_row, {}};
+            for (size_t row = job.m_first_row; row < end_row; ++row) {
+                result.m_end_states.push_back(m_highlighter.end_state(row));
+            }
+            std::lock_guard lock{m_mutex};
+            m_finished = std::move(result);
+        }
+    }
+
+    // Lexes stale rows until every row before end_row is up to date. Returns false without
+    // finishing if newer work comes in or we are stopping.
+    bool lex_up_to(TextSnapshot const &snapshot, size_t end_row) {
+        size_t rows_since_check = 0;
+        bool interrupted = false;
+        while (!interrupted && m_highlighter.first_stale_row() < end_row) {
+            snapshot.for_each_line(m_highlighter.first_stale_row(), [&](size_t row, std::string_view line) {
+                // re-lexing settled, or skipped ahead to rows that were never lexed
+                if (row != m_highlighter.first_stale_row() || row >= end_row) {
+                    return false;
+                }
+                m_highlighter.relex_first_stale_row(line);
+                if (++rows_since_check == ROWS_PER_CHECK) {
+                    rows_since_check = 0;
+                    std::lock_guard lock{m_mutex};
+                    interrupted = m_stopping || m_job.has_value();
+                }
+                return !interrupted;
+            });
+        }
+        return !interrupted;
+    }
+};
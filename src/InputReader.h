@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdio>
+#include <ncurses.h>
+#include <optional>
+#include <poll.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "key_codes.h"
+
+// Something for the main loop to act on: either a single key, or a run of text that was
+// typed or pasted in between two frames
+struct InputEvent {
+    // empty when this is a run of text
+    std::optional<Key> m_key;
+    std::string m_text;
+    // whether m_text came from a bracketed paste rather than being typed
+    bool m_is_paste;
+};
+
+// Reads everything the terminal has sent since the last frame, so a burst of input costs
+// one frame instead of one per character. Insertable keys that arrive together become one
+// run of text, and bracketed pastes come through whole, with \r turned into \n.
+class InputReader {
+    // how long to wait for the rest of a paste that is still arriving
+    static constexpr int PASTE_WAIT_MS = 100;
+
+    WINDOW *m_window_ptr;
+    // whether we're between a paste's begin and end markers
+    bool m_in_paste;
+    // whether the last read was woken by its wake_fd alone, rather than the terminal
+    bool m_woke_for_fd;
+
+  public:
+    InputReader(WINDOW *window_ptr) : m_window_ptr(window_ptr), m_in_paste(false), m_woke_for_fd(false) {
+        define_key("\x1b[200~", PASTE_BEGIN_CODE);
+        define_key("\x1b[201~", PASTE_END_CODE);
+        // ask the terminal to mark pastes
+        fputs("\x1b[?2004h", stdout);
+        fflush(stdout);
+    }
+
+    ~InputReader() {
+        fputs("\x1b[?2004l", stdout);
+        fflush(stdout);
+    }
+
+    InputReader(InputReader const &) = delete;
+    InputReader &operator=(InputReader const &) = delete;
+    InputReader(InputReader &&) = delete;
+    InputReader &operator=(InputReader &&) = delete;
+
+    // Waits up to timeout_ms (forever if negative) for input, or for wake_fd to become
+    // readable if there is one, then takes everything else that is already pending without
+    // blocking. Returns nothing if the wait timed out or it was wake_fd that woke us.
+    std::vector<InputEvent> read(int timeout_ms, int wake_fd = -1) {
+        std::vector<InputEvent> events;
+        m_woke_for_fd = false;
+        if (wake_fd == -1) {
+            wtimeout(m_window_ptr, timeout_ms);
+        } else {
+            // each read ends by taking everything ncurses had buffered, so waiting on the
+            // terminal itself can't miss keys. A signal, like a resize, just ends the wait.
+            pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+            if (poll(fds, 2, timeout_ms) > 0) {
+                m_woke_for_fd = fds[0].revents == 0 && fds[1].revents != 0;
+            }
+            wtimeout(m_window_ptr, 0);
+        }
+        int keycode = wgetch(m_window_ptr);
+        while (keycode != ERR) {
+            add_keycode(events, keycode);
+            // a paste that has started should arrive in full before we draw anything
+            wtimeout(m_window_ptr, m_in_paste ? PASTE_WAIT_MS : 0);
+            keycode = wgetch(m_window_ptr);
+        }
+        return events;
+    }
+
+    bool woke_for_fd() const {
+        return m_woke_for_fd;
+    }
+
+  private:
+    void add_keycode(std::vector<InputEvent> &events, int keycode) {
+        if (keycode == PASTE_BEGIN_CODE) {
+            m_in_paste = true;
+            return;
+        }
+        if (keycode == PASTE_END_CODE) {
+            m_in_paste = false;
+            return;
+        }
+
+        if (m_in_paste) {
+            // anything past a byte is a key ncurses decoded, which a paste shouldn't contain
+            if (keycode < 256) {
+                add_text(events, keycode == '\r' ? '\n' : (char)keycode, true);
+            }
+            return;
+        }
+
+        // the bytes of a typed multi-byte UTF-8 character come in one at a time, and only make
+        // sense together as text
+        if (keycode >= 0x80 && keycode < 256) {
+            add_text(events, (char)keycode, false);
+            return;
+        }
+
+        std::optional<Key> key = keycode_to_key(keycode);
+        if (!key.has_value()) {
+            return;
+        }
+        if (key->is_insertable()) {
+            add_text(events, key->get_char(), false);
+        } else if (key->is_type(KeyType::ENTER) && !key->is_modified()) {
+            add_text(events, '\n', false);
+        } else {
+            events.push_back(InputEvent{key, "", false});
+        }
+    }
+
+    // Extends the last run of text if it's the same kind, otherwise starts a new one
+    void add_text(std::vector<InputEvent> &events, char c, bool is_paste) {
+        if (events.empty() || events.back().m_key.has_value() || events.back().m_is_paste != is_paste) {
+            events.push_back(InputEvent{std::nullopt, "", is_paste});
+        }
+        events.back().m_text.push_back(c);
+    }
+};
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "TextBuffer.h"
+#include "Utf8.h"
+
+// Where the characters of one line start and which screen columns they're drawn at. A
+// character here is what the cursor steps over in one go: a code point along with any
+// combining marks, variation selectors and zero width joined code points after it, or a
+// pair of regional indicators making up a flag. It takes up the sum of its code points'
+// widths, which is how much room ncurses gives it. Columns are counted from the start of
+// the line and carry on past its end one per byte, for the cursor sitting there.
+//
+// Pure ASCII lines, which are most of them, keep no tables; every byte is a character a
+// column wide, so bytes and columns are the same thing.
+class LineColumns {
+    size_t m_size;
+    // for lines with anything but ASCII in them: the byte each character starts at and the
+    // column it's drawn at, both with one more entry for the end of the line
+    std::vector<size_t> m_starts;
+    std::vector<size_t> m_columns;
+
+  public:
+    LineColumns() : m_size(0) {
+    }
+
+    explicit LineColumns(std::string_view line) : m_size(line.size()) {
+        if (Utf8::is_ascii(line)) {
+            return;
+        }
+        size_t column = 0;
+        size_t pos = 0;
+        while (pos < line.size()) {
+            m_starts.push_back(pos);
+            m_columns.push_back(column);
+            size_t length;
+            char32_t code_point = Utf8::decode(line, pos, length);
+            column += Utf8::width(code_point);
+            pos += length;
+            bool is_flag_half = Utf8::is_regional_indicator(code_point);
+            // pull in whatever attaches to this code point
+            while (pos < line.size()) {
+                char32_t next = Utf8::decode(line, pos, length);
+                bool joined = code_point == Utf8::ZERO_WIDTH_JOINER && next != Utf8::REPLACEMENT;
+                bool other_flag_half = is_flag_half && Utf8::is_regional_indicator(next);
+                if (!joined && !other_flag_half && !Utf8::extends_previous(next)) {
+                    break;
+                }
+                is_flag_half = false;
+                code_point = next;
+                column += Utf8::width(code_point);
+                pos += length;
+            }
+        }
+        m_starts.push_back(pos);
+        m_columns.push_back(column);
+    }
+
+    bool is_ascii() const {
+        return m_starts.empty();
+    }
+
+    // in bytes
+    size_t size() const {
+        return m_size;
+    }
+
+    // How many columns the whole line takes up
+    size_t width() const {
+        return is_ascii() ? m_size : m_columns.back();
+    }
+
+    // The column that the character holding byte starts at
+    size_t column_of(size_t byte) const {
+        if (is_ascii()) {
+            return byte;
+        }
+        if (byte >= m_size) {
+            return width() + (byte - m_size);
+        }
+        return m_columns[char_index(byte)];
+    }
+
+    // The column where a range of bytes that stops just before byte stops on screen; a
+    // range that ends partway through a character covers all of it
+    size_t end_column_of(size_t byte) const {
+        if (is_ascii() || byte >= m_size) {
+            return column_of(byte);
+        }
+        size_t idx = char_index(byte);
+        return m_starts[idx] == byte ? m_columns[idx] : m_columns[idx + 1];
+    }
+
+    // The start of the character drawn over column, or past the end of the line as far as
+    // column is past its last one
+    size_t byte_at_column(size_t column) const {
+        if (is_ascii()) {
+            return column;
+        }
+        if (column >= width()) {
+            return m_size + (column - width());
+        }
+        return m_starts[column_index(column)];
+    }
+
+    // Where the character after the one holding byte starts
+    size_t next(size_t byte) const {
+        assert(byte < m_size);
+        return is_ascii() ? byte + 1 : m_starts[char_index(byte) + 1];
+    }
+
+    // Where the character before the one holding byte starts
+    size_t prev(size_t byte) const {
+        assert(byte > 0 && byte <= m_size);
+        if (is_ascii()) {
+            return byte - 1;
+        }
+        return m_starts[std::upper_bound(m_starts.begin(), m_starts.end(), byte - 1) - m_starts.begin() - 1];
+    }
+
+    // Calls fn(start, end, column, end_column) for each character, from the one covering
+    // first_column up to the one covering the column before end_column. A combining mark at
+    // the very start of a line, with nothing to combine with, covers no column and is skipped.
+    template <typename F>
+    void for_each_char(size_t first_column, size_t end_column, F &&fn) const {
+        end_column = std::min(end_column, width());
+        if (first_column >= end_column) {
+            return;
+        }
+        if (is_ascii()) {
+            for (size_t column = first_column; column < end_column; ++column) {
+                fn(column, column + 1, column, column + 1);
+            }
+            return;
+        }
+        size_t idx = column_index(first_column);
+        for (; m_columns[idx] < end_column; ++idx) {
+            fn(m_starts[idx], m_starts[idx + 1], m_columns[idx], m_columns[idx + 1]);
+        }
+    }
+
+  private:
+    size_t char_index(size_t byte) const {
+        return std::upper_bound(m_starts.begin(), m_starts.end(), byte) - m_starts.begin() - 1;
+    }
+
+    // the last character starting at or before column
+    size_t column_index(size_t column) const {
+        return std::upper_bound(m_columns.begin(), m_columns.end(), column) - m_columns.begin() - 1;
+    }
+};
+
+// The LineColumns of recently used rows, so moving the cursor along a line or redrawing it
+// doesn't decode it again. Edits only throw away the rows they touched, and the rows below
+// an edit that adds or removes rows are moved along with it. The map's nodes are reused
+// rather than freed, so typing along a row doesn't allocate one for it on every key.
+class LineColumnsCache {
+    // the cache starts over rather than grow past this many rows
+    static constexpr size_t MAX_ROWS = 4096;
+    // how many nodes of dropped rows are kept for reuse
+    static constexpr size_t MAX_SPARE_NODES = 64;
+
+    using RowMap = std::unordered_map<size_t, LineColumns>;
+
+    RowMap m_rows;
+    std::vector<RowMap::node_type> m_spare_nodes;
+    // the rows apply is moving, kept so that its storage gets reused
+    std::vector<RowMap::node_type> m_moving;
+
+  public:
+    // The columns of row if they're cached
+    LineColumns const *find(size_t row) const {
+        auto it = m_rows.find(row);
+        return it == m_rows.end() ? nullptr : &it->second;
+    }
+
+    // Works out row's columns from line, its current contents. The reference is good until
+    // the next insert or edit.
+    LineColumns const &insert(size_t row, std::string_view line) {
+        if (m_rows.size() >= MAX_ROWS) {
+            m_rows.clear();
+        }
+        if (m_spare_nodes.empty() || m_rows.contains(row)) {
+            return m_rows.insert_or_assign(row, LineColumns{line}).first->second;
+        }
+        RowMap::node_type node = std::move(m_spare_nodes.back());
+        m_spare_nodes.pop_back();
+        node.key() = row;
+        node.mapped() = LineColumns{line};
+        return m_rows.insert(std::move(node)).position->second;
+    }
+
+    void apply(LineChange const &change) {
+        if (change.m_old_count == LineChange::ALL_ROWS) {
+            m_rows.clear();
+            return;
+        }
+        size_t first = change.m_first_row;
+        size_t end = first + change.m_old_count;
+        size_t new_count = std::max<size_t>(change.m_new_count, 1);
+        if (change.m_old_count == new_count) {
+            // a replace-all can touch far more rows than are cached
+            if (change.m_old_count > m_rows.size()) {
+                std::erase_if(m_rows, [&](auto const &row) { return row.first >= first && row.first < end; });
+            } else {
+                for (size_t row = first; row < end; ++row) {
+                    drop(m_rows.find(row));
+                }
+            }
+            return;
+        }
+        // the rows below the edit are taken out and put back under their new numbers
+        for (auto it = m_rows.begin(); it != m_rows.end();) {
+            auto next = std::next(it);
+            if (it->first >= end) {
+                m_moving.push_back(m_rows.extract(it));
+            } else if (it->first >= first) {
+                drop(it);
+            }
+            it = next;
+        }
+        for (RowMap::node_type &node : m_moving) {
+            node.key() = node.key() - change.m_old_count + new_count;
+            m_rows.insert(std::move(node));
+        }
+        m_moving.clear();
+    }
+
+  private:
+    // Takes the row at it, if there is one, out of the cache and keeps its node for later
+    void drop(RowMap::iterator it) {
+        if (it == m_rows.end()) {
+            return;
+        }
+        RowMap::node_type node = m_rows.extract(it);
+        if (m_spare_nodes.size() < MAX_SPARE_NODES) {
+            m_spare_nodes.push_back(std::move(node));
+        }
+    }
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ELDITOR_X86_SIMD 1
+#endif
+
+// Finds a fixed string in text, optionally ignoring ASCII case. How it looks depends on the
+// pattern:
+//  - a single byte is a memchr
+//  - short patterns compare the pattern's first and last bytes against 32 positions at a
+//    time (AVX2) and only check the rest where both match, which rules out almost every
+//    position for the cost of two vector compares
+//  - long patterns, and short ones on CPUs without AVX2, use Boyer-Moore-Horspool, which
+//    skips ahead by up to the pattern's length on each mismatch
+class LiteralMatcher {
+  public:
+    enum class Strategy {
+        MEMCHR,
+        FIRST_LAST_FILTER,
+        HORSPOOL,
+    };
+
+    // from here on Horspool's skips beat testing every position, even 32 at a time
+    static constexpr size_t LONG_PATTERN_LENGTH = 32;
+
+  private:
+    // folded to lower case when m_fold_case is set
+    std::string m_pattern;
+    bool m_fold_case;
+    Strategy m_strategy;
+    // how far Horspool may shift when the byte under the pattern's last position is c
+    std::array<size_t, 256> m_skip;
+
+  public:
+    LiteralMatcher(std::string_view pattern, bool fold_case)
+        : m_pattern(pattern), m_fold_case(fold_case), m_strategy(choose_strategy(pattern.size(), fold_case)),
+          m_skip{} {
+        assert(!pattern.empty());
+        if (m_fold_case) {
+            for (char &c : m_pattern) {
+                c = fold(c);
+            }
+        }
+        if (m_strategy == Strategy::HORSPOOL) {
+            build_skip_table();
+        }
+    }
+
+    size_t size() const {
+        return m_pattern.size();
+    }
+
+    bool folds_case() const {
+        return m_fold_case;
+    }
+
+    Strategy strategy() const {
+        return m_strategy;
+    }
+
+    // Index of the first match in text at or after from, or npos
+    size_t find(std::string_view text, size_t from = 0) const {
+        if (from >= text.size() || text.size() - from < m_pattern.size()) {
+            return std::string_view::npos;
+        }
+        switch (m_strategy) {
+        case Strategy::MEMCHR: {
+            void const *found = memchr(text.data() + from, m_pattern[0], text.size() - from);
+            return found == nullptr ? std::string_view::npos : static_cast<char const *>(found) - text.data();
+        }
+#ifdef ELDITOR_X86_SIMD
+        case Strategy::FIRST_LAST_FILTER:
+            return find_first_last_avx2(text, from);
+#endif
+        default:
+            return find_horspool(text, from);
+        }
+    }
+
+    // Whether the pattern sits at text[0]; text has to be at least size() long
+    bool matches_at(char const *text) const {
+        if (!m_fold_case) {
+            return memcmp(text, m_pattern.data(), m_pattern.size()) == 0;
+        }
+        for (size_t idx = 0; idx < m_pattern.size(); ++idx) {
+            if (fold(text[idx]) != m_pattern[idx]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+  private:
+    static char fold(char c) {
+        return (char)std::tolower((unsigned char)c);
+    }
+
+    static char unfold(char c) {
+        return (char)std::toupper((unsigned char)c);
+    }
+
+    static bool has_avx2() {
+#ifdef ELDITOR_X86_SIMD
+        static bool const supported = []() {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") != 0;
+        }();
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+    static Strategy choose_strategy(size_t length, bool fold_case) {
+        if (length == 1 && !fold_case) {
+            return Strategy::MEMCHR;
+        }
+        if (length < LONG_PATTERN_LENGTH && has_avx2()) {
+            return Strategy::FIRST_LAST_FILTER;
+        }
+        return Strategy::HORSPOOL;
+    }
+
+    void build_skip_table() {
+        size_t last = m_pattern.size() - 1;
+        m_skip.fill(m_pattern.size());
+        for (size_t idx = 0; idx < last; ++idx) {
+            unsigned char c = (unsigned char)m_pattern[idx];
+            m_skip[c] = last - idx;
+            if (m_fold_case) {
+                m_skip[(unsigned char)unfold((char)c)] = last - idx;
+            }
+        }
+    }
+
+    size_t find_horspool(std::string_view text, size_t from) const {
+        size_t last = m_pattern.size() - 1;
+        size_t idx = from;
+        while (idx + last < text.size()) {
+            if (matches_at(text.data() + idx)) {
+                return idx;
+            }
+            idx += m_skip[(unsigned char)text[idx + last]];
+        }
+        return std::string_view::npos;
+    }
+
+#ifdef ELDITOR_X86_SIMD
+    __attribute__((target("avx2"))) size_t find_first_last_avx2(std::string_view text, size_t from) const {
+        char const *data = text.data();
+        size_t last = m_pattern.size() - 1;
+        // when folding, a letter matches either case, so compare against both
+        __m256i const first_lower = _mm256_set1_epi8(m_pattern[0]);
+        __m256i const first_upper = _mm256_set1_epi8(m_fold_case ? unfold(m_pattern[0]) : m_pattern[0]);
+        __m256i const last_lower = _mm256_set1_epi8(m_pattern[last]);
+        __m256i const last_upper = _mm256_set1_epi8(m_fold_case ? unfold(m_pattern[last]) : m_pattern[last]);
+
+        size_t idx = from;
+        for (; idx + last + 32 <= text.size(); idx += 32) {
+            __m256i first_block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx));
+            __m256i last_block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx + last));
+            __m256i first_eq = _mm256_or_si256(_mm256_cmpeq_epi8(first_block, first_lower),
+                                               _mm256_cmpeq_epi8(first_block, first_upper));
+            __m256i last_eq = _mm256_or_si256(_mm256_cmpeq_epi8(last_block, last_lower),
+                                              _mm256_cmpeq_epi8(last_block, last_upper));
+            unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(first_eq, last_eq));
+            while (mask != 0) {
+                size_t candidate = idx + __builtin_ctz(mask);
+                if (matches_at(data + candidate)) {
+                    return candidate;
+                }
+                mask &= mask - 1;
+            }
+        }
+        // whatever is left is too short for a full block
+        for (; idx + last < text.size(); ++idx) {
+            if (matches_at(data + idx)) {
+                return idx;
+            }
+        }
+        return std::string_view::npos;
+    }
+#endif
+};
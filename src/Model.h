@@ -1,19 +1,867 @@
 #pragma once
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <memory>
+#include <optional>
+
+#include "EditJournal.h"
+#include "FileLoader.h"
+#include "FileSaver.h"
+#include "FileWatcher.h"
+#include "HighlightWorker.h"
+#include "LineColumns.h"
+#include "LiteralMatcher.h"
+#include "Regex.h"
+#include "ThreadPool.h"
 #include "Text.h"
 #include "TextBuffer.h"
+#include "UndoHistory.h"
+#include "WrapLayout.h"
 #include "file.h"
 
+enum class PromptType {
+    GO_TO_LINE,
+    FIND,
+    FIND_REGEX,
+    // asks what to replace, then REPLACE_WITH asks what with
+    REPLACE,
+    REPLACE_WITH,
+};
+
+// A one line question asked in the status bar, along with what has been typed so far
+struct Prompt {
+    PromptType m_type;
+    std::string m_label;
+    std::string m_input;
+};
+
 // Conceptually stores the state of the program
 class Model {
+    // how much of the end of the file on disk is kept to check that a file which grew was
+    // only appended to
+    static constexpr size_t DISK_TAIL_LENGTH = 4096;
+    // how much of an append is read at a time, and at most per frame, so that catching up
+    // with a lot of appended text doesn't hold up the keyboard
+    static constexpr size_t APPEND_CHUNK_SIZE = 4 << 20;
+    static constexpr size_t MAX_APPEND_PER_POLL = 32 << 20;
+    // a file being written to constantly is looked at no more often than this, however
+    // many changes the watcher reports in between
+    static constexpr std::chrono::milliseconds DISK_CHECK_INTERVAL{50};
+
     Cursor m_cursor;
     FileHandle m_file_handle;
     TextBuffer m_text_buffer;
+    // set while m_text_buffer is still being filled in from the file; declared after the
+    // buffer so it stops reading the buffer's mapping before the buffer goes away
+    std::unique_ptr<FileLoader> m_file_loader;
+    // set while a save is being written out; like the loader it reads the buffer, so it is
+    // declared after it
+    std::unique_ptr<FileSaver> m_file_saver;
+    // whether there were more saves asked for while one was running
+    bool m_save_again;
+    // every edit to the open file since it was last saved, for getting them back after a
+    // crash; unset until the file is fully loaded and any journal left behind is replayed
+    std::unique_ptr<EditJournal> m_journal;
+    // how many edits have been made, and how many of those the file on disk has as of the
+    // last save and the one in flight; the buffer is unsaved while the first two differ
+    size_t m_edit_count;
+    size_t m_saved_edit_count;
+    size_t m_saving_edit_count;
+    // tells us when something changes the open file on disk; unset with no file open
+    std::unique_ptr<FileWatcher> m_file_watcher;
+    // the file on disk as the buffer last matched it, with m_size how much of it the buffer
+    // holds, and the last few KB of that; they tell an append apart from a rewrite
+    FileStamp m_disk_stamp;
+    std::string m_disk_tail;
+    // a change the watcher saw while loading or saving, looked at once that's done
+    bool m_disk_change_pending;
+    // the same for a read of the mapping past the file's end, see MappingGuard
+    bool m_mapping_cut_short;
+    // the file changed on disk while we had unsaved edits, so the next save only warns
+    bool m_disk_conflict;
+    std::chrono::steady_clock::time_point m_last_disk_check;
+    // with follow on, text appended to the file on disk keeps the cursor, and so the view,
+    // at the end of the buffer, as long as the cursor was already there
+    bool m_follow;
+    // lexes snapshots of the buffer in the background; unset if the file isn't in a language
+    // we highlight. It reads the buffer's storage too, so it's also declared after it.
+    std::unique_ptr<HighlightWorker> m_highlight_worker;
+    // edits the buffer has reported that the highlighting worker hasn't been told about
+    std::vector<LineChange> m_line_changes;
+    UndoHistory m_undo_history;
+    std::optional<Prompt> m_prompt;
+    // the last thing searched for, either a literal or a regex but never both; its matches
+    // stay highlighted until the search is cleared
+    std::optional<LiteralMatcher> m_search;
+    std::shared_ptr<Regex> m_regex_search;
+    RegexCache m_regex_cache;
+    // where the cursor was when the find prompt opened; each edit to the pattern searches
+    // again from here
+    size_t m_search_origin;
+    // what the REPLACE prompt got, while REPLACE_WITH is open
+    std::string m_replace_pattern;
+    // for work that is split across cores, like replace-all; started by the first of it,
+    // so a Model that never searches never starts the threads
+    std::unique_ptr<ThreadPool> m_thread_pool;
+    // a one-off note for the status bar, e.g. why a key did nothing
+    std::string m_message;
+    bool m_show_trace_overlay;
+    // with word wrap on, rows longer than the view is wide carry on over the lines below;
+    // only kept up to date while it's on
+    bool m_word_wrap;
+    WrapLayout m_wrap_layout;
+    // where the characters of recently used rows are, for rows that aren't all ASCII
+    LineColumnsCache m_line_columns;
+    // what rows are read into when their columns aren't cached
+    std::string m_row_text;
+    // where the last move up or down left the cursor; while it's still there its original
+    // column is a screen column rather than a byte
+    std::optional<CursorPoint> m_vertical_move_end;
+    // cursors besides m_cursor, in document order; edits and moves happen at all of them
+    // at once. Anything that jumps the cursor somewhere drops them.
+    std::vector<Cursor> m_extra_cursors;
 
-    Model() : m_cursor{0, 0, 0} {
+    Model()
+        : m_cursor{0, 0, 0}, m_save_again(false), m_edit_count(0), m_saved_edit_count(0),
+          m_saving_edit_count(0), m_disk_stamp{0, 0, 0}, m_disk_change_pending(false),
+          m_mapping_cut_short(false), m_disk_conflict(false), m_follow(false), m_search_origin(0),
+          m_show_trace_overlay(false), m_word_wrap(false) {
     }
 
     Model(std::string pathname)
-        : m_cursor{0, 0, 0}, m_file_handle(std::move(pathname)), m_text_buffer(m_file_handle.read()) {
+        : m_cursor{0, 0, 0}, m_file_handle(std::move(pathname)), m_text_buffer(m_file_handle.map()),
+          m_save_again(false), m_edit_count(0), m_saved_edit_count(0), m_saving_edit_count(0),
+          m_disk_stamp{0, 0, 0}, m_disk_change_pending(false), m_mapping_cut_short(false),
+          m_disk_conflict(false), m_follow(false), m_search_origin(0), m_show_trace_overlay(false),
+          m_word_wrap(false) {
+        m_file_watcher = std::make_unique<FileWatcher>(m_file_handle.pathname());
+        remember_disk_state(m_text_buffer.file_mapping().size());
+        start_highlighting();
+        resume_journal();
+    }
+
+    // Starts a highlighting worker for the file we have open, if it's in a language we know
+    void start_highlighting() {
+        Language language = SyntaxHighlighter::language_for(m_file_handle.pathname());
+        if (language != Language::NONE) {
+            m_highlight_worker = std::make_unique<HighlightWorker>(language);
+        }
+    }
+
+    // Replays the journal a crash left next to the file we just loaded, if there is one, and
+    // carries on journalling our own edits to it. A journal written over some other version
+    // of the file is moved out of the way rather than replayed.
+    void resume_journal() {
+        std::string pathname = EditJournal::pathname_for(m_file_handle.pathname());
+        FileStamp stamp = m_file_handle.stamp();
+        size_t existing_length = 0;
+        std::string error;
+        std::optional<JournalReplay> replay = EditJournal::replay(pathname, stamp, m_text_buffer, error);
+        if (!error.empty()) {
+            // starting a new one would write over edits that may still be in it
+            m_message = error + "; not journalling";
+            return;
+        }
+        if (replay.has_value() && !replay->m_matched) {
+            std::string old_pathname = pathname + ".old";
+            if (rename(pathname.data(), old_pathname.data()) == 0) {
+                m_message = "Found a journal for another version of this file; moved it to " + old_pathname;
+            } else {
+                m_message = "Found a journal for another version of this file; not journalling";
+                return;
+            }
+        } else if (replay.has_value()) {
+            existing_length = replay->m_length;
+            if (replay->m_num_edits > 0) {
+                // what was recovered isn't on disk yet
+                m_edit_count += replay->m_num_edits;
+                move_cursor_to_offset(replay->m_end_offset);
+                m_message = "Recovered " + std::to_string(replay->m_num_edits) + " unsaved edits";
+            }
+        }
+        m_journal = std::make_unique<EditJournal>(std::move(pathname), stamp, existing_length);
+    }
+
+    // Snapshots the buffer and starts writing it out
+    void start_saving() {
+        m_file_saver = std::make_unique<FileSaver>(m_file_handle.pathname(), m_text_buffer.get_chunks());
+        m_saving_edit_count = m_edit_count;
+        if (m_journal != nullptr) {
+            m_journal->mark_save_started();
+        }
+    }
+
+    // Waits for the save in flight, if any, and reports how it went
+    void finish_saving() {
+        if (!is_saving()) {
+            return;
+        }
+        if (m_file_saver->succeeded()) {
+            // the file we had open was replaced by the one we wrote
+            m_file_handle.reopen();
+            if (m_journal != nullptr) {
+                m_journal->mark_saved(m_file_handle.stamp());
+            }
+            m_saved_edit_count = m_saving_edit_count;
+            m_disk_conflict = false;
+            remember_disk_state(m_file_saver->size());
+            m_message = "Saved " + std::to_string(m_file_saver->size()) + " bytes";
+        } else {
+            m_message = "Save failed: " + m_file_saver->error();
+        }
+        m_file_saver.reset();
+    }
+
+    // Removes the selection and starts a new undo group for it
+    void remove_selection(Cursor const &cursor_before) {
+        assert(m_cursor.in_selection_mode());
+        size_t offset = m_text_buffer.offset_of(m_cursor.get_left_point());
+        EditRecord edit{EditType::REMOVE, offset, m_text_buffer.get_string_selected_by(m_cursor)};
+        m_text_buffer.remove_string_at(m_cursor);
+        journal_remove(offset, edit.m_text.size());
+        m_undo_history.record(std::move(edit), cursor_before, m_cursor, false);
+    }
+
+    // The rest of the file still gets appended to the end of the buffer while loading,
+    // so edits have to wait until it's all there
+    bool refuse_edit_while_loading() {
+        if (is_loading()) {
+            m_message = "Still loading; editing is disabled until the whole file is in";
+            return true;
+        }
+        return false;
+    }
+
+    // Every edit made to the buffer is counted, and told to the journal once there is one
+    void journal_insert(size_t offset, std::string_view text) {
+        m_edit_count++;
+        if (m_journal != nullptr) {
+            m_journal->record_insert(offset, text);
+        }
+    }
+
+    void journal_remove(size_t offset, size_t length) {
+        m_edit_count++;
+        if (m_journal != nullptr) {
+            m_journal->record_remove(offset, length);
+        }
+    }
+
+    void journal_replace(std::vector<TextRange> const &ranges, std::string_view text) {
+        m_edit_count++;
+        if (m_journal != nullptr) {
+            m_journal->record_replace(ranges, text);
+        }
+    }
+
+    void journal_replace_all(std::vector<size_t> const &offsets, size_t length, std::string_view text) {
+        m_edit_count++;
+        if (m_journal != nullptr) {
+            m_journal->record_replace_all(offsets, length, text);
+        }
+    }
+
+    bool has_unsaved_edits() const {
+        return m_edit_count != m_saved_edit_count;
+    }
+
+    // Remembers the file we have open as the one on disk that the buffer matches, of which
+    // the buffer holds the first size bytes
+    void remember_disk_state(size_t size) {
+        m_disk_stamp = m_file_handle.stamp();
+        m_disk_stamp.m_size = size;
+        size_t tail_length = std::min(size, DISK_TAIL_LENGTH);
+        m_disk_tail = m_file_handle.read_range(size - tail_length, tail_length);
+    }
+
+    // Whether the file on disk, stamped stamp, is the one we have open with only bytes
+    // added on the end, judging by the end of what we read of it being unchanged
+    bool only_appended_on_disk(FileStamp const &stamp) {
+        if (stamp.m_inode != m_disk_stamp.m_inode || stamp.m_size < m_disk_stamp.m_size) {
+            return false;
+        }
+        size_t tail_offset = m_disk_stamp.m_size - m_disk_tail.size();
+        return m_file_handle.read_range(tail_offset, m_disk_tail.size()) == m_disk_tail;
+    }
+
+    // Brings the buffer up to date with the file on disk, stamped stamp, with as little
+    // work as the change allows. A file that has only grown gets just the new bytes read
+    // in, even under unsaved edits, and one that something renamed over ours is diffed
+    // against the buffer so only the region that differs is replaced. Otherwise the file
+    // was rewritten where it is, which changes what our mapping of it reads too, so it's
+    // loaded again from scratch.
+    void reload_from_disk(FileStamp const &stamp) {
+        bool in_sync = m_text_buffer.size() == m_disk_stamp.m_size;
+        if (only_appended_on_disk(stamp)) {
+            load_appended(stamp.m_size);
+        } else if (stamp.m_inode != m_disk_stamp.m_inode && in_sync) {
+            m_file_handle.reopen();
+            reload_changed_region();
+        } else {
+            reload_whole_file();
+            m_message = "Reloaded " + m_file_handle.pathname() + "; it changed on disk";
+            return;
+        }
+        if (m_journal == nullptr) {
+            return;
+        }
+        if (has_unsaved_edits()) {
+            // the edits still stand over the longer file
+            m_journal->mark_appended(m_disk_stamp);
+        } else {
+            m_journal->start_over(m_disk_stamp);
+        }
+    }
+
+    // Loads whatever is at our pathname now from scratch
+    void reload_whole_file() {
+        m_file_handle.reopen();
+        // what was journalled was over the old contents
+        if (m_journal != nullptr) {
+            m_journal->discard();
+        }
+        m_journal.reset();
+        load_file();
+    }
+
+    // Deals with the file having been cut short under the buffer's mapping; the part that's
+    // gone reads as zero bytes now, so a clean buffer is loaded again
+    void poll_mapping_cut_short() {
+        m_mapping_cut_short = MappingGuard::take_cut_short() || m_mapping_cut_short;
+        if (!m_mapping_cut_short || is_loading() || is_saving() || !m_file_handle.is_handle_to_file()) {
+            return;
+        }
+        m_mapping_cut_short = false;
+        if (has_unsaved_edits()) {
+            m_disk_conflict = true;
+            m_message = "The file was cut short on disk; what was cut off reads as zero bytes";
+            return;
+        }
+        reload_whole_file();
+        m_message = "Reloaded " + m_file_handle.pathname() + "; it was cut short on disk";
+    }
+
+    // Reads whatever has been appended to the file past what the buffer holds, up to size
+    // bytes in all; only what's new is read, and it goes on the end of the buffer without
+    // touching the rows before. The undo history and the cursors stay, since nothing before
+    // them moved. A big append is read over several frames.
+    void load_appended(size_t size) {
+        size_t offset = m_disk_stamp.m_size;
+        size_t end = std::min(size, offset + MAX_APPEND_PER_POLL);
+        bool at_end = m_extra_cursors.empty() && !m_cursor.in_selection_mode() &&
+                      cursor_offset() == m_text_buffer.size();
+        while (offset < end) {
+            std::string chunk = m_file_handle.read_range(offset, std::min(APPEND_CHUNK_SIZE, end - offset));
+            if (chunk.empty()) {
+                // it was cut short meanwhile; whatever changed gets noticed next time
+                break;
+            }
+            m_text_buffer.insert_at(m_text_buffer.size(), chunk);
+            offset += chunk.size();
+        }
+        if (m_follow && at_end) {
+            move_cursor_to_offset(m_text_buffer.size());
+        } else if (offset > m_disk_stamp.m_size) {
+            m_message = "Read " + std::to_string(offset - m_disk_stamp.m_size) + " bytes appended on disk";
+        }
+        m_disk_change_pending = offset == end && end < size;
+        remember_disk_state(offset);
+    }
+
+    // Replaces the part of the buffer that differs from the file our handle has open now,
+    // keeping the common start and end, which stay in the old mapping
+    void reload_changed_region() {
+        MappedFile mapping = m_file_handle.map();
+        std::string_view text = mapping.view();
+        size_t prefix = m_text_buffer.common_prefix_with(text);
+        size_t suffix = m_text_buffer.common_suffix_with(text, prefix);
+        size_t old_length = m_text_buffer.size() - prefix - suffix;
+        std::string_view middle = text.substr(prefix, text.size() - prefix - suffix);
+
+        size_t cursor_offset = m_text_buffer.offset_of(m_cursor.active_point());
+        if (old_length > 0 || !middle.empty()) {
+            m_text_buffer.replace_ranges({TextRange{prefix, old_length}}, middle);
+        }
+        // the cursor keeps its place in the text around the change, and one inside it
+        // stays within it
+        if (cursor_offset >= prefix + old_length) {
+            cursor_offset = cursor_offset - old_length + middle.size();
+        } else {
+            cursor_offset = std::min(cursor_offset, prefix + middle.size());
+        }
+        // the undo history's offsets are into the text as it was
+        m_undo_history.clear();
+        m_vertical_move_end.reset();
+        move_cursor_to_offset(cursor_offset);
+        m_message = "Reloaded " + std::to_string(middle.size()) + " changed bytes from disk";
+        remember_disk_state(text.size());
+    }
+
+    // Looks at the file on disk if the watcher saw it change, at most once an interval
+    void poll_file_changes() {
+        if (!take_file_changes() || is_loading() || is_saving()) {
+            return;
+        }
+        // a file cut short can't wait for the interval: the sooner it's reloaded, the less
+        // chance anything reads the mapping past its new end
+        bool cut_short = m_file_handle.stamp().m_size < m_disk_stamp.m_size;
+        if (!cut_short && std::chrono::steady_clock::now() - m_last_disk_check < DISK_CHECK_INTERVAL) {
+            return;
+        }
+        check_file_on_disk();
+    }
+
+    // Brings the buffer up to date with the file on disk, unless that would lose unsaved
+    // edits; bytes appended to it never do
+    void check_file_on_disk() {
+        m_last_disk_check = std::chrono::steady_clock::now();
+        m_disk_change_pending = false;
+        std::optional<FileStamp> stamp = m_file_handle.stamp_on_disk();
+        if (!stamp.has_value()) {
+            m_message = "The file was removed on disk; saving will write it again";
+            return;
+        }
+        if (*stamp == m_disk_stamp) {
+            return;
+        }
+        if (has_unsaved_edits() && !only_appended_on_disk(*stamp)) {
+            m_disk_conflict = true;
+            m_message = "The file changed on disk; not reloading it over unsaved edits";
+            return;
+        }
+        reload_from_disk(*stamp);
+    }
+
+    // Reads the file our handle has open into a fresh buffer, starting the rest of it
+    // loading in the background
+    void load_file() {
+        // the worker may still be reading the old buffer
+        m_highlight_worker.reset();
+        m_text_buffer = TextBuffer(m_file_handle.map(), true);
+        remember_disk_state(m_text_buffer.file_mapping().size());
+        m_saved_edit_count = m_edit_count;
+        m_disk_conflict = false;
+        start_highlighting();
+        m_file_loader = std::make_unique<FileLoader>(&m_text_buffer.file_mapping());
+        m_cursor.reset_to_point(CursorPoint{0, 0, 0});
+        m_extra_cursors.clear();
+        m_vertical_move_end.reset();
+        m_undo_history.clear();
+        poll_loading(true);
+    }
+
+    ThreadPool &thread_pool() {
+        if (m_thread_pool == nullptr) {
+            m_thread_pool = std::make_unique<ThreadPool>();
+        }
+        return *m_thread_pool;
+    }
+
+    // Searches ignore case unless the pattern has capitals in it
+    static bool should_fold_case(std::string_view pattern) {
+        auto is_upper = [](char c) { return std::isupper((unsigned char)c) != 0; };
+        return std::none_of(pattern.begin(), pattern.end(), is_upper);
+    }
+
+    bool is_find_prompt() const {
+        return m_prompt.has_value() &&
+               (m_prompt->m_type == PromptType::FIND || m_prompt->m_type == PromptType::FIND_REGEX);
+    }
+
+    // While a find prompt is open every change to the pattern searches again from where
+    // the prompt was opened
+    void search_as_you_type() {
+        if (!is_find_prompt()) {
+            return;
+        }
+        move_cursor_to_offset(m_search_origin);
+        if (m_prompt->m_type == PromptType::FIND) {
+            start_search(m_prompt->m_input);
+        } else {
+            start_regex_search(m_prompt->m_input);
+        }
+    }
+
+    std::optional<size_t> find_from(size_t offset) const {
+        if (m_regex_search != nullptr) {
+            std::optional<RegexMatch> match = m_text_buffer.find(*m_regex_search, offset);
+            return match.has_value() ? std::optional<size_t>{match->m_offset} : std::nullopt;
+        }
+        return m_text_buffer.find(*m_search, offset);
+    }
+
+    void find_next_from(size_t offset) {
+        std::optional<size_t> found = find_from(offset);
+        if (!found.has_value() && offset > 0) {
+            found = find_from(0);
+            if (found.has_value()) {
+                m_message = "Search wrapped";
+            }
+        }
+        if (!found.has_value()) {
+            m_message = "Not found";
+            return;
+        }
+        move_cursor_to_offset(*found);
+    }
+
+    // Collects the buffer's recent edits for everything that keeps something per row
+    void take_line_changes() {
+        size_t first_new = m_line_changes.size();
+        m_text_buffer.take_line_changes(m_line_changes);
+        for (size_t idx = first_new; idx < m_line_changes.size(); ++idx) {
+            if (m_word_wrap) {
+                m_wrap_layout.apply(m_line_changes[idx]);
+            }
+            m_line_columns.apply(m_line_changes[idx]);
+        }
+    }
+
+    // Where row's wrapped segments start
+    std::vector<size_t> segment_starts(size_t row) {
+        std::string line = m_text_buffer.get_line_as_string(row);
+        return WrapLayout::segment_starts(line, line_columns(row, line), m_wrap_layout.width());
+    }
+
+    // Moves point to the start of the character before it, or onto the end of the row
+    // above from the start of its row
+    void move_point_left(CursorPoint &point) {
+        if (point.col() == 0) {
+            m_text_buffer.move_cursor_left(point);
+            return;
+        }
+        point.col() = line_columns(point.row()).prev(point.col());
+        point.reset_original_col();
+    }
+
+    // Moves point to the start of the character after it, or onto the start of the row
+    // below from the end of its row
+    void move_point_right(CursorPoint &point) {
+        if (point.col() == m_text_buffer.line_length(point.row())) {
+            m_text_buffer.move_cursor_right(point);
+            return;
+        }
+        point.col() = line_columns(point.row()).next(point.col());
+        point.reset_original_col();
+    }
+
+    // Whether the cursor is still where the last move up or down left it
+    bool vertical_move_continues() const {
+        return m_vertical_move_end.has_value() && *m_vertical_move_end == m_cursor.active_point();
+    }
+
+    // Moves point up or down a row, onto the character drawn over the column it started
+    // at. With sticky set the column sticks across rows that are too short for it, which
+    // lasts until the cursor moves any other way.
+    void move_point_vertically(CursorPoint &point, bool up, bool sticky) {
+        if (!sticky) {
+            point.original_col() = line_columns(point.row()).column_of(point.col());
+        }
+        size_t row = point.row();
+        if (up) {
+            m_text_buffer.move_cursor_up(point);
+        } else {
+            m_text_buffer.move_cursor_down(point);
+        }
+        LineColumns const &columns = line_columns(point.row());
+        if (point.row() != row) {
+            point.col() = columns.byte_at_column(std::min(point.original_col(), columns.width()));
+        } else {
+            // it went to the start or end of the top or bottom row instead
+            point.original_col() = columns.column_of(point.col());
+        }
+        m_vertical_move_end = point;
+    }
+
+    // With word wrap on, moves point to the line above or below on screen, as near to the
+    // same column on it as it can. Returns false if wrapping is off or there's no such line.
+    bool move_point_visually(CursorPoint &point, bool up) {
+        if (!m_word_wrap) {
+            return false;
+        }
+        size_t first_row = point.row() - std::min<size_t>(point.row(), 1);
+        measure_rows(first_row, point.row() + 2 - first_row);
+        std::vector<size_t> starts = segment_starts(point.row());
+        size_t segment = WrapLayout::segment_of(starts, point.col());
+        size_t line = m_wrap_layout.first_line_of(point.row()) + segment;
+        if (up ? line == 0 : line + 1 == m_wrap_layout.num_visual_lines()) {
+            return false;
+        }
+        LineColumns const &columns = line_columns(point.row());
+        size_t column = columns.column_of(point.col()) - columns.column_of(starts[segment]);
+
+        VisualPosition target = m_wrap_layout.position_of_line(up ? line - 1 : line + 1);
+        std::vector<size_t> target_starts = segment_starts(target.m_row);
+        LineColumns const &target_columns = line_columns(target.m_row);
+        // a segment that's followed by another ends just before the character that starts
+        // it, the last one at the end of the row
+        size_t target_end = m_text_buffer.line_length(target.m_row);
+        if (target.m_segment + 1 < target_starts.size()) {
+            target_end = target_columns.prev(target_starts[target.m_segment + 1]);
+        }
+        size_t target_column = target_columns.column_of(target_starts[target.m_segment]) + column;
+        point.row() = target.m_row;
+        point.col() = std::min(target_columns.byte_at_column(target_column), target_end);
+        point.reset_original_col();
+        return true;
+    }
+
+    // Calls fn on every cursor, the extra ones first so that the primary one is the last to
+    // move, then drops cursors that have run into each other
+    template <typename F>
+    void for_each_cursor(F &&fn) {
+        for (Cursor &cursor : m_extra_cursors) {
+            fn(cursor);
+        }
+        fn(m_cursor);
+        merge_cursors();
+    }
+
+    // Puts the extra cursors back in document order and folds cursors whose selections
+    // overlap or touch, or that sit in the same place, into one; the primary cursor swallows
+    // any it runs into. Afterwards the left points are in order and so are the right points,
+    // which is what the view relies on to find the cursors it shows by bisection.
+    void merge_cursors() {
+        if (m_extra_cursors.empty()) {
+            return;
+        }
+        std::vector<Cursor> &cursors = m_extra_cursors;
+        Cursor const primary = m_cursor;
+        cursors.push_back(primary);
+        std::sort(cursors.begin(), cursors.end(), [](Cursor const &a, Cursor const &b) {
+            CursorPoint a_left = a.get_left_point();
+            CursorPoint b_left = b.get_left_point();
+            if (!a_left.in_same_place(b_left)) {
+                return a_left.is_behind(b_left);
+            }
+            return a.get_right_point().is_behind(b.get_right_point());
+        });
+        // a cursor just like the primary one would be folded into it anyway
+        auto is_primary = [&](Cursor const &cursor) {
+            return cursor.active_point().in_same_place(primary.active_point()) &&
+                   cursor.trailing_point().in_same_place(primary.trailing_point());
+        };
+
+        size_t kept = 0;
+        size_t primary_idx = 0;
+        for (size_t idx = 0; idx < cursors.size(); ++idx) {
+            Cursor const &cursor = cursors[idx];
+            if (kept > 0) {
+                Cursor &last = cursors[kept - 1];
+                if (!last.get_right_point().is_behind(cursor.get_left_point())) {
+                    // the merged selection keeps the direction of the one that started first
+                    if (last.get_right_point().is_behind(cursor.get_right_point())) {
+                        last.get_right_point() = cursor.get_right_point();
+                    }
+                    primary_idx = is_primary(cursor) ? kept - 1 : primary_idx;
+                    continue;
+                }
+            }
+            primary_idx = is_primary(cursor) ? kept : primary_idx;
+            cursors[kept++] = cursor;
+        }
+        cursors.erase(cursors.begin() + kept, cursors.end());
+        m_cursor = cursors[primary_idx];
+        cursors.erase(cursors.begin() + primary_idx);
+    }
+
+    // Moves every cursor a line up or down, extending their selections with extend set
+    void move_cursors_vertically(bool up, bool extend) {
+        m_undo_history.close_group();
+        bool sticky = vertical_move_continues();
+        for_each_cursor([&](Cursor &cursor) {
+            if (!move_point_visually(cursor.active_point(), up)) {
+                move_point_vertically(cursor.active_point(), up, sticky);
+            }
+            if (!extend) {
+                cursor.reset_trailing_point();
+            }
+        });
+    }
+
+    // Applies one keystroke at every cursor in a single rebuild of the buffer, instead of
+    // an edit per cursor that shifts everything after it: each cursor's selection, or with
+    // remove_previous the character before it, is replaced by text. Cursors are converted
+    // to and from offsets with a walk over the buffer too, not a search each. Cursors whose ranges
+    // overlap make one edit. The keystroke undoes in one step, putting every cursor back.
+    void edit_at_all_cursors(std::string_view text, bool remove_previous) {
+        struct CursorEdit {
+            TextRange m_range;
+            bool m_primary;
+        };
+        // the primary cursor goes last, after the extra ones
+        size_t num_cursors = m_extra_cursors.size() + 1;
+        auto cursor_at = [&](size_t idx) -> Cursor const & {
+            return idx < m_extra_cursors.size() ? m_extra_cursors[idx] : m_cursor;
+        };
+        std::vector<CursorPoint> points;
+        points.reserve(2 * num_cursors);
+        for (size_t idx = 0; idx < num_cursors; ++idx) {
+            points.push_back(cursor_at(idx).get_left_point());
+            points.push_back(cursor_at(idx).get_right_point());
+        }
+        std::vector<size_t> offsets = m_text_buffer.offsets_of(points);
+
+        std::vector<CursorEdit> edits;
+        edits.reserve(num_cursors);
+        for (size_t idx = 0; idx < num_cursors; ++idx) {
+            Cursor const &cursor = cursor_at(idx);
+            size_t left = offsets[2 * idx];
+            TextRange range{left, offsets[2 * idx + 1] - left};
+            if (!cursor.in_selection_mode() && remove_previous && left > 0) {
+                // a character can be several bytes; a newline is one
+                size_t char_length = 1;
+                if (cursor.col() > 0) {
+                    char_length = cursor.col() - line_columns(cursor.row()).prev(cursor.col());
+                }
+                range = TextRange{left - char_length, char_length};
+            }
+            edits.push_back(CursorEdit{range, idx == num_cursors - 1});
+        }
+        std::sort(edits.begin(), edits.end(), [](CursorEdit const &a, CursorEdit const &b) {
+            TextRange const &x = a.m_range;
+            TextRange const &y = b.m_range;
+            return x.m_offset < y.m_offset || (x.m_offset == y.m_offset && x.m_length < y.m_length);
+        });
+
+        std::vector<TextRange> ranges;
+        ranges.reserve(edits.size());
+        size_t primary_idx = 0;
+        for (CursorEdit const &edit : edits) {
+            TextRange const &range = edit.m_range;
+            if (!ranges.empty()) {
+                TextRange &last = ranges.back();
+                size_t last_end = last.m_offset + last.m_length;
+                bool both_empty = range.m_length == 0 && last.m_length == 0;
+                if (range.m_offset < last_end || (both_empty && range.m_offset == last.m_offset)) {
+                    last.m_length = std::max(last_end, range.m_offset + range.m_length) - last.m_offset;
+                    primary_idx = edit.m_primary ? ranges.size() - 1 : primary_idx;
+                    continue;
+                }
+            }
+            primary_idx = edit.m_primary ? ranges.size() : primary_idx;
+            ranges.push_back(range);
+        }
+
+        // recorded as a remove and an insert per range, at the offsets they have once the
+        // earlier ranges have been replaced, for undo to put back in one go
+        EditGroup group{{}, m_cursor, m_cursor, m_extra_cursors};
+        group.m_at_all_cursors = true;
+        group.m_edits.reserve(2 * ranges.size());
+        std::vector<size_t> cursor_offsets;
+        cursor_offsets.reserve(ranges.size());
+        size_t removed = 0;
+        for (size_t idx = 0; idx < ranges.size(); ++idx) {
+            size_t offset = ranges[idx].m_offset - removed + idx * text.size();
+            if (ranges[idx].m_length > 0) {
+                std::string replaced = m_text_buffer.substr(ranges[idx].m_offset, ranges[idx].m_length);
+                group.m_edits.push_back(EditRecord{EditType::REMOVE, offset, std::move(replaced)});
+            }
+            if (!text.empty()) {
+                group.m_edits.push_back(EditRecord{EditType::INSERT, offset, std::string{text}});
+            }
+            cursor_offsets.push_back(offset + text.size());
+            removed += ranges[idx].m_length;
+        }
+        if (group.m_edits.empty()) {
+            // e.g. backspace with every cursor at the start of the buffer
+            return;
+        }
+        m_text_buffer.replace_ranges(ranges, text);
+        journal_replace(ranges, text);
+
+        // removing characters can bring cursors together
+        std::vector<CursorPoint> cursor_points = m_text_buffer.points_at(cursor_offsets);
+        std::vector<Cursor> cursors;
+        cursors.reserve(ranges.size());
+        size_t primary_cursor = 0;
+        for (size_t idx = 0; idx < cursor_offsets.size(); ++idx) {
+            if (idx == 0 || cursor_offsets[idx] != cursor_offsets[idx - 1]) {
+                CursorPoint const &point = cursor_points[idx];
+                cursors.emplace_back(point.row(), point.col(), point.col());
+            }
+            primary_cursor = idx == primary_idx ? cursors.size() - 1 : primary_cursor;
+        }
+        m_cursor = cursors[primary_cursor];
+        cursors.erase(cursors.begin() + primary_cursor);
+        m_extra_cursors = std::move(cursors);
+
+        group.m_cursor_after = m_cursor;
+        group.m_extra_cursors_after = m_extra_cursors;
+        m_undo_history.record_group(std::move(group));
+    }
+
+    // One range of an edit made at every cursor: where it is once the ranges before it are
+    // done, and the text it held and the text it was replaced with
+    struct RangeEdit {
+        size_t m_offset;
+        std::string_view m_removed;
+        std::string_view m_inserted;
+    };
+
+    // The ranges of a group edit_at_all_cursors recorded. A range's insert follows its
+    // remove at the same offset; the next range can't start with an insert there, since a
+    // range that only inserts sits between others that insert too.
+    static std::vector<RangeEdit> range_edits(EditGroup const &group) {
+        std::vector<RangeEdit> edits;
+        edits.reserve(group.m_edits.size());
+        for (size_t idx = 0; idx < group.m_edits.size(); ++idx) {
+            EditRecord const &record = group.m_edits[idx];
+            if (record.m_type == EditType::REMOVE) {
+                edits.push_back(RangeEdit{record.m_offset, record.m_text, {}});
+                continue;
+            }
+            bool follows_remove = idx > 0 && group.m_edits[idx - 1].m_type == EditType::REMOVE &&
+                                  group.m_edits[idx - 1].m_offset == record.m_offset;
+            if (follows_remove) {
+                edits.back().m_inserted = record.m_text;
+            } else {
+                edits.push_back(RangeEdit{record.m_offset, {}, record.m_text});
+            }
+        }
+        return edits;
+    }
+
+    // Puts back what an edit at every cursor replaced, in one rebuild of the buffer
+    void undo_at_all_cursors(EditGroup const &group) {
+        std::vector<RangeEdit> edits = range_edits(group);
+        std::vector<TextRange> ranges;
+        std::vector<std::string_view> replacements;
+        ranges.reserve(edits.size());
+        replacements.reserve(edits.size());
+        for (RangeEdit const &edit : edits) {
+            // the ranges after this one don't move it
+            ranges.push_back(TextRange{edit.m_offset, edit.m_inserted.size()});
+            replacements.push_back(edit.m_removed);
+        }
+        m_text_buffer.replace_ranges(ranges, replacements);
+        // the journal takes it a record at a time, which comes to the same thing
+        for (auto it = group.m_edits.rbegin(); it != group.m_edits.rend(); ++it) {
+            if (it->m_type == EditType::INSERT) {
+                journal_remove(it->m_offset, it->m_text.size());
+            } else {
+                journal_insert(it->m_offset, it->m_text);
+            }
+        }
+    }
+
+    // Makes an edit at every cursor again, in one rebuild of the buffer
+    void redo_at_all_cursors(EditGroup const &group) {
+        std::vector<RangeEdit> edits = range_edits(group);
+        std::vector<TextRange> ranges;
+        ranges.reserve(edits.size());
+        // how much the ranges before this one grew the buffer by, which can be negative
+        size_t grown = 0;
+        for (RangeEdit const &edit : edits) {
+            ranges.push_back(TextRange{edit.m_offset - grown, edit.m_removed.size()});
+            grown += edit.m_inserted.size() - edit.m_removed.size();
+        }
+        // every range was replaced with the same keystroke
+        std::string_view text = edits.front().m_inserted;
+        m_text_buffer.replace_ranges(ranges, text);
+        journal_replace(ranges, text);
     }
 
   public:
@@ -21,7 +869,11 @@ class Model {
     Model &operator=(Model const &) = delete;
     Model(Model &&) = delete;
     Model &operator=(Model &&) = delete;
+    // quitting throws away what wasn't saved, so the journal goes too
     ~Model() {
+        if (m_journal != nullptr) {
+            m_journal->discard();
+        }
     }
 
     static Model initialize() {
@@ -33,24 +885,86 @@ class Model {
         return Model(std::move(pathname));
     }
 
+    // Opens pathname and starts loading it in the background; this returns as soon as the
+    // first screenful is in
     void open_file(std::string pathname) {
-        // if our file handle has a file right now
-        if (m_file_handle.is_handle_to_file()) {
+        finish_saving();
+        m_save_again = false;
+        if (is_loading()) {
+            // a file can't have been edited while it was loading, so there's nothing to write out
+            m_file_loader.reset();
+        } else if (m_file_handle.is_handle_to_file()) {
+            // if our file handle has a file right now
             // write out the contents
-            m_file_handle.save(m_text_buffer.get_as_string());
+            std::string error;
+            if (!m_file_handle.save(m_text_buffer.get_chunks(), error)) {
+                m_message = "Save failed: " + error;
+            } else if (m_journal != nullptr) {
+                m_journal->discard();
+            }
         }
+        // whatever the journal still has pending goes out before it's closed
+        m_journal.reset();
 
         // open the new file
         m_file_handle.open(std::move(pathname));
-        m_text_buffer = TextBuffer(m_file_handle.read());
+        m_file_watcher = std::make_unique<FileWatcher>(m_file_handle.pathname());
+        m_disk_change_pending = false;
+        load_file();
+    }
+
+    // Moves whatever the loader has scanned so far into the buffer. With wait set this
+    // blocks until at least one more chunk is ready.
+    void poll_loading(bool wait = false) {
+        if (!is_loading()) {
+            return;
+        }
+        for (LoadedChunk const &chunk : m_file_loader->take_chunks(wait)) {
+            m_text_buffer.load_chunk(chunk.m_length, chunk.m_newlines);
+        }
+        if (m_text_buffer.fully_loaded()) {
+            m_file_loader.reset();
+            resume_journal();
+        }
+    }
+
+    bool is_loading() const {
+        return m_file_loader != nullptr;
+    }
+
+    // How much of the file has been scanned, out of 100
+    size_t load_percent() const {
+        if (!is_loading() || m_file_loader->total_bytes() == 0) {
+            return 100;
+        }
+        return m_file_loader->bytes_scanned() * 100 / m_file_loader->total_bytes();
     }
 
+    // Starts writing the buffer out in the background; poll_saving reports when it's done
     void save_to_file() {
+        if (is_loading()) {
+            m_message = "Still loading; nothing has been changed yet";
+            return;
+        }
         // if our file handle has a file right now
         if (m_file_handle.is_handle_to_file()) {
-            // write out the contents
-            // std::cerr << "Model: Save was called!" << std::endl;
-            m_file_handle.save(m_text_buffer.get_as_string());
+            // a change the watcher saw that hasn't been looked at yet can't be written over
+            // without a warning either
+            if (m_file_watcher != nullptr && !is_saving() &&
+                (m_file_watcher->take_changes() || m_disk_change_pending)) {
+                check_file_on_disk();
+            }
+            if (m_disk_conflict) {
+                m_disk_conflict = false;
+                m_message = "The file changed on disk since it was loaded; save again to overwrite it";
+                return;
+            }
+            if (is_saving()) {
+                // the save in flight has an older snapshot, so write again once it's done
+                m_save_again = true;
+                return;
+            }
+            start_saving();
         } else {
             // we should prompt the user for a name instead of simply returning
             std::cerr << "Model: No file open to save to right now." << std::endl;
@@ -58,73 +972,677 @@ class Model {
         }
     }
 
-    void insert_string(std::string &&to_insert) {
+    // Reports a finished save, starting the next one if more were asked for meanwhile
+    void poll_saving() {
+        if (!is_saving() || !m_file_saver->done()) {
+            return;
+        }
+        finish_saving();
+        if (m_save_again) {
+            m_save_again = false;
+            start_saving();
+        }
+    }
+
+    bool is_saving() const {
+        return m_file_saver != nullptr;
+    }
+
+    // Picks up whatever loading or saving has got done in the background, and any change
+    // made to the file on disk
+    void poll_background_work() {
+        poll_loading();
+        poll_saving();
+        poll_mapping_cut_short();
+        poll_file_changes();
+        poll_journal();
+    }
+
+    // Shows whatever went wrong writing the journal since the last frame
+    void poll_journal() {
+        if (m_journal == nullptr) {
+            return;
+        }
+        if (std::string error = m_journal->take_error(); !error.empty()) {
+            m_message = error;
+        }
+    }
+
+    // Takes what the watcher has seen and returns whether there is a change to the open file
+    // waiting to be looked at. Events about other files in its directory are dropped here,
+    // so the main loop can go back to waiting without drawing a frame for them.
+    bool take_file_changes() {
+        if (m_file_watcher != nullptr && m_file_watcher->take_changes()) {
+            m_disk_change_pending = true;
+        }
+        return m_disk_change_pending;
+    }
+
+    // What the main loop should wait on besides the terminal, or -1 for nothing. While a
+    // change is already waiting to be looked at, more of them don't need to wake us; the
+    // loop comes round for it on its own.
+    int file_watch_fd() const {
+        return m_file_watcher != nullptr && !m_disk_change_pending ? m_file_watcher->fd() : -1;
+    }
+
+    bool has_background_work() const {
+        bool highlighting = m_highlight_worker != nullptr && m_highlight_worker->busy();
+        return is_loading() || is_saving() || highlighting || m_disk_change_pending;
+    }
+
+    // Inserts text at the cursor, replacing the selection if there is one. Keystrokes that
+    // continue the previous one are undone together with it.
+    void insert_string(std::string &&to_insert, bool is_keystroke = true) {
+        if (refuse_edit_while_loading()) {
+            return;
+        }
+        if (!m_extra_cursors.empty()) {
+            edit_at_all_cursors(to_insert, false);
+            return;
+        }
+        Cursor cursor_before = m_cursor;
+        bool replaced_selection = false;
         if (m_cursor.in_selection_mode()) {
-            m_text_buffer.remove_string_at(m_cursor);
+            remove_selection(cursor_before);
+            replaced_selection = true;
         }
+
+        EditRecord edit{EditType::INSERT, m_text_buffer.offset_of(m_cursor.active_point()), to_insert};
+        journal_insert(edit.m_offset, edit.m_text);
         m_text_buffer.insert_string_at(std::move(to_insert), m_cursor);
+        if (replaced_selection) {
+            m_undo_history.append_to_newest_group(std::move(edit), m_cursor, is_keystroke);
+        } else {
+            m_undo_history.record(std::move(edit), cursor_before, m_cursor, is_keystroke);
+        }
     }
 
+    // Removes the selection, or the character before the cursor
     void remove_char() {
-        m_text_buffer.remove_string_at(m_cursor);
+        if (refuse_edit_while_loading()) {
+            return;
+        }
+        if (!m_extra_cursors.empty()) {
+            edit_at_all_cursors("", true);
+            return;
+        }
+        Cursor cursor_before = m_cursor;
+        if (m_cursor.in_selection_mode()) {
+            remove_selection(cursor_before);
+            return;
+        }
+
+        size_t offset = m_text_buffer.offset_of(m_cursor.active_point());
+        if (offset == 0) {
+            return;
+        }
+        // a character can be several bytes; a newline is one
+        size_t char_length = 1;
+        if (m_cursor.col() > 0) {
+            char_length = m_cursor.col() - line_columns(m_cursor.row()).prev(m_cursor.col());
+        }
+        size_t char_offset = offset - char_length;
+        EditRecord edit{EditType::REMOVE, char_offset, m_text_buffer.substr(char_offset, char_length)};
+        m_text_buffer.remove_string_at(m_cursor, char_length);
+        journal_remove(char_offset, char_length);
+        m_undo_history.record(std::move(edit), cursor_before, m_cursor, true);
     }
 
-    // Base cursor movement
+    // Reverts the most recent group of edits
+    void undo() {
+        if (refuse_edit_while_loading()) {
+            return;
+        }
+        EditGroup const *group = m_undo_history.undo();
+        if (group == nullptr) {
+            return;
+        }
+        if (group->m_at_all_cursors) {
+            undo_at_all_cursors(*group);
+        } else {
+            for (auto it = group->m_edits.rbegin(); it != group->m_edits.rend(); ++it) {
+                if (it->m_type == EditType::INSERT) {
+                    m_text_buffer.remove_at(it->m_offset, it->m_text.size());
+                    journal_remove(it->m_offset, it->m_text.size());
+                } else {
+                    m_text_buffer.insert_at(it->m_offset, it->m_text);
+                    journal_insert(it->m_offset, it->m_text);
+                }
+            }
+        }
+        m_cursor = group->m_cursor_before;
+        m_extra_cursors = group->m_extra_cursors_before;
+    }
+
+    // Reapplies the most recently undone group of edits
+    void redo() {
+        if (refuse_edit_while_loading()) {
+            return;
+        }
+        EditGroup const *group = m_undo_history.redo();
+        if (group == nullptr) {
+            return;
+        }
+        if (group->m_at_all_cursors) {
+            redo_at_all_cursors(*group);
+        } else {
+            for (EditRecord const &edit : group->m_edits) {
+                if (edit.m_type == EditType::INSERT) {
+                    m_text_buffer.insert_at(edit.m_offset, edit.m_text);
+                    journal_insert(edit.m_offset, edit.m_text);
+                } else {
+                    m_text_buffer.remove_at(edit.m_offset, edit.m_text.size());
+                    journal_remove(edit.m_offset, edit.m_text.size());
+                }
+            }
+        }
+        m_cursor = group->m_cursor_after;
+        m_extra_cursors = group->m_extra_cursors_after;
+    }
+
+    // Caps how much memory the undo history may hold on to
+    void set_undo_memory_limit(size_t memory_limit) {
+        m_undo_history.set_memory_limit(memory_limit);
+    }
+
+    // Base cursor movement; every cursor moves
 
     void move_cursor_up() {
-        m_text_buffer.move_cursor_up(m_cursor.active_point());
-        m_cursor.reset_trailing_point();
+        move_cursors_vertically(true, false);
     }
 
     void move_cursor_down() {
-        m_text_buffer.move_cursor_down(m_cursor.active_point());
-        m_cursor.reset_trailing_point();
+        move_cursors_vertically(false, false);
     }
 
     void move_cursor_left() {
-        if (m_cursor.in_selection_mode()) {
-            CursorPoint left_point = m_cursor.get_left_point();
-            m_cursor.reset_to_point(left_point);
-        } else {
-            m_text_buffer.move_cursor_left(m_cursor.active_point());
-            m_cursor.reset_trailing_point();
-        }
+        m_undo_history.close_group();
+        for_each_cursor([&](Cursor &cursor) {
+            if (cursor.in_selection_mode()) {
+                CursorPoint left_point = cursor.get_left_point();
+                cursor.reset_to_point(left_point);
+            } else {
+                move_point_left(cursor.active_point());
+                cursor.reset_trailing_point();
+            }
+        });
     }
 
     void move_cursor_right() {
-        if (m_cursor.in_selection_mode()) {
-            CursorPoint right_point = m_cursor.get_right_point();
-            m_cursor.reset_to_point(right_point);
-        } else {
-            m_text_buffer.move_cursor_right(m_cursor.active_point());
-            m_cursor.reset_trailing_point();
-        }
+        m_undo_history.close_group();
+        for_each_cursor([&](Cursor &cursor) {
+            if (cursor.in_selection_mode()) {
+                CursorPoint right_point = cursor.get_right_point();
+                cursor.reset_to_point(right_point);
+            } else {
+                move_point_right(cursor.active_point());
+                cursor.reset_trailing_point();
+            }
+        });
     }
 
     // Shift cursor movement
 
     void shift_cursor_up() {
-        m_text_buffer.move_cursor_up(m_cursor.active_point());
+        move_cursors_vertically(true, true);
     }
 
     void shift_cursor_down() {
-        m_text_buffer.move_cursor_down(m_cursor.active_point());
+        move_cursors_vertically(false, true);
     }
 
     void shift_cursor_left() {
-        m_text_buffer.move_cursor_left(m_cursor.active_point());
+        m_undo_history.close_group();
+        for_each_cursor([&](Cursor &cursor) { move_point_left(cursor.active_point()); });
     }
 
     void shift_cursor_right() {
-        m_text_buffer.move_cursor_right(m_cursor.active_point());
+        m_undo_history.close_group();
+        for_each_cursor([&](Cursor &cursor) { move_point_right(cursor.active_point()); });
+    }
+
+    // Jumps
+
+    // Moves the cursor to the start of row, clamped to the last row
+    void move_cursor_to_row(size_t row) {
+        m_undo_history.close_group();
+        row = std::min(row, m_text_buffer.num_lines() - 1);
+        m_cursor.reset_to_point(CursorPoint{row, 0, 0});
+        m_extra_cursors.clear();
+    }
+
+    // Moves the cursor onto the byte at offset, clamped to the end of the buffer
+    void move_cursor_to_offset(size_t offset) {
+        m_undo_history.close_group();
+        offset = std::min(offset, m_text_buffer.size());
+        m_cursor.reset_to_point(m_text_buffer.point_at(offset));
+        m_extra_cursors.clear();
+    }
+
+    // Prompts
+
+    void open_prompt(PromptType type) {
+        switch (type) {
+        case PromptType::GO_TO_LINE:
+            m_prompt = Prompt{type, "Go to line: ", ""};
+            break;
+        case PromptType::FIND:
+            m_prompt = Prompt{type, "Find: ", ""};
+            m_search_origin = cursor_offset();
+            break;
+        case PromptType::FIND_REGEX:
+            m_prompt = Prompt{type, "Find regex: ", ""};
+            m_search_origin = cursor_offset();
+            break;
+        case PromptType::REPLACE:
+            m_prompt = Prompt{type, "Replace: ", ""};
+            break;
+        case PromptType::REPLACE_WITH:
+            m_prompt = Prompt{type, "Replace \"" + m_replace_pattern + "\" with: ", ""};
+            break;
+        }
+    }
+
+    bool in_prompt() const {
+        return m_prompt.has_value();
+    }
+
+    void prompt_insert(char c) {
+        assert(in_prompt());
+        m_prompt->m_input.push_back(c);
+        search_as_you_type();
+    }
+
+    void prompt_backspace() {
+        assert(in_prompt());
+        std::string &input = m_prompt->m_input;
+        if (!input.empty()) {
+            // take the whole of a multi-byte character, not just its last byte
+            size_t length = 1;
+            while (length < input.size() && (input[input.size() - length] & 0xc0) == 0x80) {
+                length++;
+            }
+            input.resize(input.size() - length);
+            search_as_you_type();
+        }
+    }
+
+    // Cancelling a find goes back to where it started
+    void cancel_prompt() {
+        if (is_find_prompt()) {
+            clear_search();
+            move_cursor_to_offset(m_search_origin);
+        }
+        m_prompt.reset();
+    }
+
+    // Acts on what was typed into the prompt and closes it
+    void submit_prompt() {
+        assert(in_prompt());
+        Prompt prompt = std::move(m_prompt.value());
+        m_prompt.reset();
+
+        switch (prompt.m_type) {
+        case PromptType::GO_TO_LINE: {
+            // lines are shown 1-indexed; anything that isn't a number is ignored
+            size_t line_number = 0;
+            std::string_view input = prompt.m_input;
+            auto [ptr, ec] = std::from_chars(input.data(), input.data() + input.size(), line_number);
+            if (ec == std::errc() && line_number > 0) {
+                move_cursor_to_row(line_number - 1);
+            }
+            break;
+        }
+        case PromptType::FIND:
+            start_search(prompt.m_input);
+            break;
+        case PromptType::FIND_REGEX:
+            start_regex_search(prompt.m_input);
+            break;
+        case PromptType::REPLACE:
+            if (!prompt.m_input.empty()) {
+                m_replace_pattern = std::move(prompt.m_input);
+                open_prompt(PromptType::REPLACE_WITH);
+            }
+            break;
+        case PromptType::REPLACE_WITH:
+            replace_all(m_replace_pattern, prompt.m_input);
+            break;
+        }
+    }
+
+    // Search
+
+    // Searches for pattern from the cursor on. Case is ignored unless the pattern has
+    // capitals in it.
+    void start_search(std::string_view pattern) {
+        if (pattern.empty()) {
+            clear_search();
+            return;
+        }
+        m_regex_search.reset();
+        m_search.emplace(pattern, should_fold_case(pattern));
+        find_next_from(cursor_offset());
+    }
+
+    // Like start_search, for a regex. Patterns that were searched for recently aren't
+    // compiled again.
+    void start_regex_search(std::string_view pattern) {
+        clear_search();
+        if (pattern.empty()) {
+            return;
+        }
+        std::string error;
+        m_regex_search = m_regex_cache.get(pattern, should_fold_case(pattern), error);
+        if (m_regex_search == nullptr) {
+            m_message = error;
+            return;
+        }
+        find_next_from(cursor_offset());
+    }
+
+    // Moves to the next match after the cursor, wrapping around at the end of the buffer
+    void find_next() {
+        if (!m_search.has_value() && m_regex_search == nullptr) {
+            m_message = "Nothing to search for; Ctrl+F starts a search";
+            return;
+        }
+        size_t from = std::min(cursor_offset() + 1, m_text_buffer.size());
+        // a regex match can't start inside the one at the cursor, or [0-9]+ would stop at
+        // every digit
+        if (m_regex_search != nullptr) {
+            std::optional<RegexMatch> here = m_text_buffer.find(*m_regex_search, cursor_offset());
+            if (here.has_value() && here->m_offset == cursor_offset()) {
+                from = here->m_offset + here->m_length;
+            }
+        }
+        find_next_from(from);
+    }
+
+    void clear_search() {
+        m_search.reset();
+        m_regex_search.reset();
+    }
+
+    // Replaces every match of pattern at once; the whole replacement undoes in one step
+    void replace_all(std::string_view pattern, std::string_view replacement) {
+        if (refuse_edit_while_loading()) {
+            return;
+        }
+        LiteralMatcher matcher{pattern, should_fold_case(pattern)};
+        std::vector<size_t> matches = m_text_buffer.find_all(matcher, thread_pool());
+        if (matches.empty()) {
+            m_message = "Not found";
+            return;
+        }
+
+        // undo replays this as a remove and an insert per match, at the offsets they have
+        // once the earlier matches have been replaced
+        EditGroup group{{}, m_cursor, m_cursor};
+        group.m_edits.reserve(2 * matches.size());
+        for (size_t idx = 0; idx < matches.size(); ++idx) {
+            size_t offset = matches[idx] - idx * pattern.size() + idx * replacement.size();
+            std::string matched = m_text_buffer.substr(matches[idx], pattern.size());
+            group.m_edits.push_back(EditRecord{EditType::REMOVE, offset, std::move(matched)});
+            if (!replacement.empty()) {
+                group.m_edits.push_back(EditRecord{EditType::INSERT, offset, std::string{replacement}});
+            }
+        }
+
+        size_t offset_before = cursor_offset();
+        m_text_buffer.replace_all(matches, pattern.size(), replacement);
+        journal_replace_all(matches, pattern.size(), replacement);
+        move_cursor_to_offset(std::min(offset_before, m_text_buffer.size()));
+        group.m_cursor_after = m_cursor;
+        m_undo_history.record_group(std::move(group));
+        m_message = "Replaced " + std::to_string(matches.size()) + " matches";
+    }
+
+    // Puts a cursor on every match of the current search, each selecting its match, so
+    // what's typed next replaces them all. The primary cursor goes to the first match at
+    // or after it.
+    void select_all_matches() {
+        if (!m_search.has_value() && m_regex_search == nullptr) {
+            m_message = "Nothing to search for; Ctrl+F starts a search";
+            return;
+        }
+        std::vector<TextRange> matches;
+        if (m_search.has_value()) {
+            for (size_t offset : m_text_buffer.find_all(*m_search, thread_pool())) {
+                matches.push_back(TextRange{offset, m_search->size()});
+            }
+        } else {
+            size_t from = 0;
+            while (std::optional<RegexMatch> match = m_text_buffer.find(*m_regex_search, from)) {
+                matches.push_back(TextRange{match->m_offset, match->m_length});
+                // an empty match would be found again from where it is
+                from = match->m_offset + std::max<size_t>(match->m_length, 1);
+                if (from > m_text_buffer.size()) {
+                    break;
+                }
+            }
+        }
+        if (matches.empty()) {
+            m_message = "Not found";
+            return;
+        }
+
+        m_undo_history.close_group();
+        size_t from = cursor_offset();
+        auto primary = std::find_if(matches.begin(), matches.end(),
+                                    [&](TextRange const &match) { return match.m_offset >= from; });
+        size_t primary_idx = primary == matches.end() ? 0 : primary - matches.begin();
+        // the matches don't overlap, so their starts and ends together are still in order
+        std::vector<size_t> offsets;
+        offsets.reserve(2 * matches.size());
+        for (TextRange const &match : matches) {
+            offsets.push_back(match.m_offset);
+            offsets.push_back(match.m_offset + match.m_length);
+        }
+        std::vector<CursorPoint> points = m_text_buffer.points_at(offsets);
+        m_extra_cursors.clear();
+        m_extra_cursors.reserve(matches.size() - 1);
+        for (size_t idx = 0; idx < matches.size(); ++idx) {
+            CursorPoint const &end = points[2 * idx + 1];
+            Cursor cursor{end.row(), end.col(), end.col()};
+            cursor.trailing_point() = points[2 * idx];
+            if (idx == primary_idx) {
+                m_cursor = cursor;
+            } else {
+                m_extra_cursors.push_back(cursor);
+            }
+        }
+        m_message = "Selected " + std::to_string(matches.size()) + " matches";
+    }
+
+    // Goes back to just the primary cursor
+    void clear_extra_cursors() {
+        m_extra_cursors.clear();
+    }
+
+    std::vector<Cursor> const &get_extra_cursors() const {
+        return m_extra_cursors;
+    }
+
+    std::optional<LiteralMatcher> const &get_search() const {
+        return m_search;
+    }
+
+    std::shared_ptr<Regex> const &get_regex_search() const {
+        return m_regex_search;
+    }
+
+    // Passes the edits made since the last call, and the num_rows rows from first_row that
+    // are about to be shown, on to the highlighting worker
+    void request_highlighting(size_t first_row, size_t num_rows) {
+        take_line_changes();
+        if (m_highlight_worker != nullptr) {
+            m_highlight_worker->update(m_text_buffer, m_line_changes, first_row, num_rows);
+        }
+        m_line_changes.clear();
+    }
+
+    Language highlight_language() const {
+        return m_highlight_worker == nullptr ? Language::NONE : m_highlight_worker->language();
+    }
+
+    // The lexer state row starts in, if the highlighting worker has got that far
+    std::optional<LexState> highlight_start_state(size_t row) const {
+        if (m_highlight_worker == nullptr) {
+            return std::nullopt;
+        }
+        return m_highlight_worker->start_state(row);
+    }
+
+    // Word wrap
+
+    void toggle_word_wrap() {
+        take_line_changes();
+        m_word_wrap = !m_word_wrap;
+        if (m_word_wrap) {
+            m_wrap_layout.reset(m_text_buffer.num_lines());
+        }
+    }
+
+    bool word_wrap() const {
+        return m_word_wrap;
+    }
+
+    // Starts or stops following text appended to the file, e.g. a log still being written;
+    // starting goes to the end. Moving off the end pauses it until the cursor is back.
+    void toggle_follow() {
+        m_follow = !m_follow;
+        if (m_follow) {
+            move_cursor_to_offset(m_text_buffer.size());
+        }
+    }
+
+    bool following() const {
+        return m_follow;
+    }
+
+    // Rows are wrapped to width columns; after a resize they are wrapped again as they're
+    // looked at, so only what is on screen gets redone straight away
+    void set_wrap_width(size_t width) {
+        m_wrap_layout.set_width(width);
+    }
+
+    // Wraps whichever of the count rows from first_row haven't been since they changed
+    void measure_rows(size_t first_row, size_t count) {
+        take_line_changes();
+        size_t end_row = std::min(first_row + count, m_text_buffer.num_lines());
+        while (first_row < end_row && m_wrap_layout.measured(first_row)) {
+            first_row++;
+        }
+        if (first_row == end_row) {
+            return;
+        }
+        Text text = m_text_buffer.get_lines(first_row, end_row - first_row);
+        size_t width = m_wrap_layout.width();
+        for (size_t line_idx = 0; line_idx < text.num_lines(); ++line_idx) {
+            size_t row = first_row + line_idx;
+            if (!m_wrap_layout.measured(row)) {
+                std::vector<size_t> starts = WrapLayout::segment_starts(text.get_line_at(line_idx), width);
+                m_wrap_layout.set_line_count(row, starts.size());
+            }
+        }
+    }
+
+    // The visual line point is on; rows above it that haven't been wrapped count as one line
+    size_t visual_line_of(CursorPoint const &point) {
+        measure_rows(point.row(), 1);
+        size_t segment = WrapLayout::segment_of(segment_starts(point.row()), point.col());
+        return m_wrap_layout.first_line_of(point.row()) + segment;
+    }
+
+    // The visual line position is on, after edits may have moved or shortened its row
+    size_t visual_line_of(VisualPosition position) {
+        size_t row = std::min(position.m_row, m_text_buffer.num_lines() - 1);
+        measure_rows(row, 1);
+        size_t segment = std::min(position.m_segment, m_wrap_layout.lines_in(row) - 1);
+        return m_wrap_layout.first_line_of(row) + segment;
+    }
+
+    VisualPosition visual_position_at(size_t line) {
+        take_line_changes();
+        return m_wrap_layout.position_of_line(line);
+    }
+
+    // Columns
+
+    // Where row's characters are and which columns they're drawn at. The reference is good
+    // until the next call or edit.
+    LineColumns const &line_columns(size_t row) {
+        take_line_changes();
+        if (LineColumns const *columns = m_line_columns.find(row)) {
+            return *columns;
+        }
+        m_text_buffer.get_line_as_string(row, m_row_text);
+        return m_line_columns.insert(row, m_row_text);
+    }
+
+    // The same, for when the caller already has row's contents in line
+    LineColumns const &line_columns(size_t row, std::string_view line) {
+        take_line_changes();
+        if (LineColumns const *columns = m_line_columns.find(row)) {
+            return *columns;
+        }
+        return m_line_columns.insert(row, line);
+    }
+
+    // The screen column point is drawn at
+    size_t column_of(CursorPoint const &point) {
+        return line_columns(point.row()).column_of(point.col());
     }
 
     // const view api
-    Text get_text() const {
-        return m_text_buffer.get_text();
+    Text get_lines(size_t first_row, size_t count) const {
+        return m_text_buffer.get_lines(first_row, count);
+    }
+
+    // The same, into a Text that is kept around to be filled again
+    void get_lines(size_t first_row, size_t count, Text &text) const {
+        m_text_buffer.get_lines(first_row, count, text);
+    }
+
+    size_t num_lines() const {
+        return m_text_buffer.num_lines();
     }
 
     Cursor get_cursor() const {
         return m_cursor;
     }
+
+    // Byte offset of the cursor's active point
+    size_t cursor_offset() const {
+        return m_text_buffer.offset_of(m_cursor.active_point());
+    }
+
+    size_t size() const {
+        return m_text_buffer.size();
+    }
+
+    std::optional<Prompt> const &get_prompt() const {
+        return m_prompt;
+    }
+
+    std::string const &pathname() const {
+        return m_file_handle.pathname();
+    }
+
+    std::string const &get_message() const {
+        return m_message;
+    }
+
+    void clear_message() {
+        m_message.clear();
+    }
+
+    void toggle_trace_overlay() {
+        m_show_trace_overlay = !m_show_trace_overlay;
+    }
+
+    bool trace_overlay_shown() const {
+        return m_show_trace_overlay;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ELDITOR_X86_SIMD 1
+#endif
+
+// Finds every '\n' in a block of text in a single pass. On x86 this compares 16 (SSE2)
+// or 32 (AVX2) bytes at a time and walks the resulting bitmask, so the cost is one
+// vector compare per block plus one step per newline found. Everything else falls
+// back to memchr.
+class NewlineScanner {
+  public:
+    enum class Method {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    // The fastest method this CPU supports, checked once
+    static Method best_method() {
+        static Method const method = detect_method();
+        return method;
+    }
+
+    // Appends base + idx to newlines for every text[idx] == '\n'
+    static void find_newlines(std::string_view text, size_t base, std::vector<size_t> &newlines) {
+        find_newlines(text, base, newlines, best_method());
+    }
+
+    static void find_newlines(std::string_view text, size_t base, std::vector<size_t> &newlines, Method method) {
+        switch (method) {
+#ifdef ELDITOR_X86_SIMD
+        case Method::AVX2:
+            find_newlines_avx2(text.data(), text.size(), base, newlines);
+            return;
+        case Method::SSE2:
+            find_newlines_sse2(text.data(), text.size(), base, newlines);
+            return;
+#endif
+        default:
+            find_newlines_scalar(text.data(), text.size(), base, newlines);
+            return;
+        }
+    }
+
+    static std::vector<size_t> find_newlines(std::string_view text, size_t base) {
+        std::vector<size_t> newlines;
+        find_newlines(text, base, newlines);
+        return newlines;
+    }
+
+    static char const *method_name(Method method) {
+        switch (method) {
+        case Method::SCALAR:
+            return "scalar";
+        case Method::SSE2:
+            return "sse2";
+        case Method::AVX2:
+            return "avx2";
+        }
+        return "unknown";
+    }
+
+  private:
+    static Method detect_method() {
+#ifdef ELDITOR_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return Method::AVX2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return Method::SSE2;
+        }
+#endif
+        return Method::SCALAR;
+    }
+
+    static void find_newlines_scalar(char const *data, size_t size, size_t base, std::vector<size_t> &newlines) {
+        char const *pos = data;
+        char const *end = data + size;
+        while (pos < end) {
+            void const *found = memchr(pos, '\n', end - pos);
+            if (found == nullptr) {
+                return;
+            }
+            char const *newl = static_cast<char const *>(found);
+            newlines.push_back(base + (newl - data));
+            pos = newl + 1;
+        }
+    }
+
+#ifdef ELDITOR_X86_SIMD
+    // Writes offsets straight into a vector that is grown ahead of time, so that the inner
+    // loop doesn't pay for push_back's capacity check on every newline
+    class OutputCursor {
+        std::vector<size_t> &m_newlines;
+        size_t m_count;
+
+      public:
+        OutputCursor(std::vector<size_t> &newlines) : m_newlines(newlines), m_count(newlines.size()) {
+        }
+
+        ~OutputCursor() {
+            m_newlines.resize(m_count);
+        }
+
+        // makes room for one more block's worth of newlines
+        void reserve_block(size_t block_size) {
+            if (m_count + block_size > m_newlines.size()) {
+                m_newlines.resize(std::max(m_count + block_size, m_newlines.size() * 2));
+            }
+        }
+
+        // writes one offset per set bit of mask, lowest bit first
+        void write_mask(unsigned mask, size_t block_offset) {
+            size_t *out = m_newlines.data() + m_count;
+            m_count += __builtin_popcount(mask);
+            while (mask != 0) {
+                *out++ = block_offset + __builtin_ctz(mask);
+                mask &= mask - 1;
+            }
+        }
+    };
+
+    __attribute__((target("sse2"))) static void find_newlines_sse2(char const *data, size_t size, size_t base,
+                                                                   std::vector<size_t> &newlines) {
+        __m128i const needle = _mm_set1_epi8('\n');
+        size_t idx = 0;
+        {
+            OutputCursor output{newlines};
+            for (; idx + 16 <= size; idx += 16) {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + idx));
+                unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+                if (mask != 0) {
+                    output.reserve_block(16);
+                    output.write_mask(mask, base + idx);
+                }
+            }
+        }
+        find_newlines_scalar(data + idx, size - idx, base + idx, newlines);
+    }
+
+    __attribute__((target("avx2"))) static void find_newlines_avx2(char const *data, size_t size, size_t base,
+                                                                   std::vector<size_t> &newlines) {
+        __m256i const needle = _mm256_set1_epi8('\n');
+        size_t idx = 0;
+        {
+            OutputCursor output{newlines};
+            // two blocks per iteration; long stretches of text without a newline are common,
+            // so OR-ing the compares lets us skip both blocks with a single test
+            for (; idx + 64 <= size; idx += 64) {
+                __m256i eq_lo =
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx)), needle);
+                __m256i eq_hi =
+                    _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx + 32)), needle);
+                __m256i eq_any = _mm256_or_si256(eq_lo, eq_hi);
+                if (_mm256_testz_si256(eq_any, eq_any)) {
+                    continue;
+                }
+                output.reserve_block(64);
+                output.write_mask((unsigned)_mm256_movemask_epi8(eq_lo), base + idx);
+                output.write_mask((unsigned)_mm256_movemask_epi8(eq_hi), base + idx + 32);
+            }
+        }
+        find_newlines_scalar(data + idx, size - idx, base + idx, newlines);
+    }
+#endif
+};
@@ -0,0 +1,704 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AddBuffer.h"
+#include "NewlineScanner.h"
+#include "file.h"
+
+// Which of the two backing buffers a piece points into
+enum class BufferKind {
+    ORIGINAL,
+    ADD,
+};
+
+// A contiguous run of text living in one of the backing buffers
+struct Piece {
+    BufferKind m_buffer;
+    size_t m_start;
+    size_t m_length;
+    // number of '\n' inside [m_start, m_start + m_length)
+    size_t m_line_feeds;
+};
+
+// A stretch of the document, for edits made to many places at once
+struct TextRange {
+    size_t m_offset;
+    size_t m_length;
+};
+
+// Stores text as a sequence of pieces over an immutable original buffer and an
+// append-only add buffer. Neither buffer ever moves or changes bytes it already holds, so
+// views handed out stay readable (from any thread) for as long as the table lives. The
+// pieces are kept in a treap keyed implicitly by byte offset, and every node caches the
+// total length and newline count of its subtree, so locating an offset or a row and
+// splicing in an edit are O(log pieces).
+class PieceTable {
+    static constexpr size_t NIL = std::numeric_limits<size_t>::max();
+
+    struct Node {
+        Piece m_piece;
+        size_t m_left;
+        size_t m_right;
+        uint32_t m_priority;
+        size_t m_subtree_length;
+        size_t m_subtree_line_feeds;
+    };
+
+    // the file we were opened on, used in place and never modified
+    MappedFile m_original;
+    // how much of m_original has been indexed and made part of the document
+    size_t m_original_loaded;
+    // text that edits have introduced, only ever appended to
+    AddBuffer m_add;
+    // offsets of every '\n' in each buffer, kept sorted so we can count newlines
+    // inside any slice of a buffer with a binary search
+    std::vector<size_t> m_original_newlines;
+    std::vector<size_t> m_add_newlines;
+
+    // node pool; freed slots get recycled through m_free_nodes
+    std::vector<Node> m_nodes;
+    std::vector<size_t> m_free_nodes;
+    size_t m_root;
+    uint32_t m_rng_state;
+
+  public:
+    PieceTable() : m_original_loaded(0), m_root(NIL), m_rng_state(0x9e3779b9u) {
+    }
+
+    // Text that didn't come from a file has nothing to map, so it simply becomes the first edit
+    PieceTable(std::string text) : PieceTable() {
+        insert(0, text);
+    }
+
+    // With defer_indexing the mapping is taken over but none of it is part of the document
+    // yet; it becomes visible chunk by chunk through append_original
+    PieceTable(MappedFile original, bool defer_indexing = false)
+        : m_original(std::move(original)), m_original_loaded(0), m_root(NIL), m_rng_state(0x9e3779b9u) {
+        if (defer_indexing) {
+            return;
+        }
+        // indexing the newlines is the one pass we make over the whole file; once it's done
+        // the pages are handed back so only what gets displayed or edited stays resident
+        m_original.advise_sequential();
+        std::vector<size_t> newlines = NewlineScanner::find_newlines(m_original.view(), 0);
+        m_original.release_pages();
+        append_original(m_original.size(), newlines);
+    }
+
+    friend void swap(PieceTable &a, PieceTable &b) {
+        using std::swap;
+        swap(a.m_original, b.m_original);
+        std::swap(a.m_original_loaded, b.m_original_loaded);
+        std::swap(a.m_add, b.m_add);
+        std::swap(a.m_original_newlines, b.m_original_newlines);
+        std::swap(a.m_add_newlines, b.m_add_newlines);
+        std::swap(a.m_nodes, b.m_nodes);
+        std::swap(a.m_free_nodes, b.m_free_nodes);
+        std::swap(a.m_root, b.m_root);
+        std::swap(a.m_rng_state, b.m_rng_state);
+    }
+
+    // the moved-from table is left empty rather than pointing into a pool it no longer owns
+    PieceTable(PieceTable &&other) : PieceTable() {
+        swap(*this, other);
+    }
+
+    PieceTable &operator=(PieceTable &&other) {
+        PieceTable temp{std::move(other)};
+        swap(*this, temp);
+        return *this;
+    }
+
+    // Total number of bytes in the document
+    size_t size() const {
+        return subtree_length(m_root);
+    }
+
+    // Number of lines; an empty document still has one (empty) line
+    size_t num_lines() const {
+        return subtree_line_feeds(m_root) + 1;
+    }
+
+    // Inserts text so that it starts at offset
+    void insert(size_t offset, std::string_view text) {
+        assert(offset <= size());
+        if (text.empty()) {
+            return;
+        }
+
+        size_t add_start = m_add.append(text);
+        size_t newlines_before = m_add_newlines.size();
+        NewlineScanner::find_newlines(text, add_start, m_add_newlines);
+        size_t inserted_line_feeds = m_add_newlines.size() - newlines_before;
+
+        auto [left, right] = split(m_root, offset);
+
+        // typing produces runs of inserts that sit right next to each other in the add
+        // buffer; grow the previous piece instead of creating a node per keystroke
+        if (left != NIL) {
+            Piece const &last = m_nodes[rightmost(left)].m_piece;
+            if (last.m_buffer == BufferKind::ADD && last.m_start + last.m_length == add_start) {
+                extend_rightmost(left, text.size(), inserted_line_feeds);
+                m_root = merge(left, right);
+                return;
+            }
+        }
+
+        size_t node = make_node(Piece{BufferKind::ADD, add_start, text.size(), inserted_line_feeds});
+        m_root = merge(merge(left, node), right);
+    }
+
+    // Appends the next length bytes of the original buffer to the end of the document.
+    // newlines holds the offsets of every '\n' in that range. Edits must not have been made
+    // since the previous call, so the end of the document is still the end of what's loaded.
+    void append_original(size_t length, std::vector<size_t> const &newlines) {
+        assert(m_original_loaded + length <= m_original.size());
+        if (length == 0) {
+            return;
+        }
+        size_t start = m_original_loaded;
+        m_original_newlines.insert(m_original_newlines.end(), newlines.begin(), newlines.end());
+        m_original_loaded += length;
+
+        if (m_root != NIL) {
+            Piece const &last = m_nodes[rightmost(m_root)].m_piece;
+            if (last.m_buffer == BufferKind::ORIGINAL && last.m_start + last.m_length == start) {
+                extend_rightmost(m_root, length, newlines.size());
+                return;
+            }
+        }
+        m_root = merge(m_root, make_node(Piece{BufferKind::ORIGINAL, start, length, newlines.size()}));
+    }
+
+    // Whether all of the original buffer is part of the document
+    bool original_fully_loaded() const {
+        return m_original_loaded == m_original.size();
+    }
+
+    // The mapping behind the original buffer, including any part of it that isn't loaded yet.
+    // The mapped memory stays put when the table is moved.
+    MappedFile const &original_mapping() const {
+        return m_original;
+    }
+
+    // Removes length bytes starting at offset
+    void remove(size_t offset, size_t length) {
+        assert(offset + length <= size());
+        if (length == 0) {
+            return;
+        }
+        auto [left, rest] = split(m_root, offset);
+        auto [middle, right] = split(rest, length);
+        free_subtree(middle);
+        m_root = merge(left, right);
+    }
+
+    // Replaces the match_length bytes at each of offsets (sorted and not overlapping) with
+    // replacement. Rather than splicing in every match, which would split and merge the
+    // tree once per match, the new sequence of pieces is laid out in one pass and the tree
+    // is rebuilt from it in linear time. Every match points at the same copy of replacement.
+    void replace_all(std::vector<size_t> const &offsets, size_t match_length, std::string_view replacement) {
+        if (offsets.empty()) {
+            return;
+        }
+        assert(match_length > 0 && offsets.back() + match_length <= size());
+        std::optional<Piece> replacement_piece = add_piece(replacement);
+        replace_ranges(
+            offsets.size(), [&](size_t idx) { return TextRange{offsets[idx], match_length}; },
+            [&](size_t) -> std::optional<Piece> const & { return replacement_piece; });
+    }
+
+    // The same for ranges of any length, sorted and not overlapping. Empty ranges are plain
+    // inserts, which is what typing at many cursors at once comes down to.
+    void replace_ranges(std::vector<TextRange> const &ranges, std::string_view replacement) {
+        if (ranges.empty()) {
+            return;
+        }
+        assert(ranges.back().m_offset + ranges.back().m_length <= size());
+        std::optional<Piece> replacement_piece = add_piece(replacement);
+        replace_ranges(
+            ranges.size(), [&](size_t idx) { return ranges[idx]; },
+            [&](size_t) -> std::optional<Piece> const & { return replacement_piece; });
+    }
+
+    // The same with a replacement of its own for each range, which is what putting back
+    // the text an edit at every cursor replaced takes
+    void replace_ranges(std::vector<TextRange> const &ranges,
+                        std::vector<std::string_view> const &replacements) {
+        assert(ranges.size() == replacements.size());
+        if (ranges.empty()) {
+            return;
+        }
+        assert(ranges.back().m_offset + ranges.back().m_length <= size());
+        std::vector<std::optional<Piece>> replacement_pieces;
+        replacement_pieces.reserve(replacements.size());
+        for (std::string_view replacement : replacements) {
+            replacement_pieces.push_back(add_piece(replacement));
+        }
+        replace_ranges(
+            ranges.size(), [&](size_t idx) { return ranges[idx]; },
+            [&](size_t idx) -> std::optional<Piece> const & { return replacement_pieces[idx]; });
+    }
+
+    // Returns the offset at which row starts
+    size_t line_start(size_t row) const {
+        assert(row < num_lines());
+        if (row == 0) {
+            return 0;
+        }
+        // the row starts one past the row-th newline
+        return offset_of_newline(row) + 1;
+    }
+
+    // Returns the length of row, excluding its newline
+    size_t line_length(size_t row) const {
+        assert(row < num_lines());
+        size_t start = line_start(row);
+        size_t end = (row + 1 < num_lines()) ? offset_of_newline(row + 1) : size();
+        return end - start;
+    }
+
+    // Returns the row that offset falls on
+    size_t row_of(size_t offset) const {
+        assert(offset <= size());
+        size_t node = m_root;
+        size_t line_feeds = 0;
+        while (node != NIL) {
+            Node const &n = m_nodes[node];
+            size_t left_length = subtree_length(n.m_left);
+            if (offset <= left_length) {
+                node = n.m_left;
+            } else if (offset <= left_length + n.m_piece.m_length) {
+                size_t in_piece = offset - left_length;
+                line_feeds += subtree_line_feeds(n.m_left) +
+                              first_newline_index(n.m_piece.m_buffer, n.m_piece.m_start + in_piece) -
+                              first_newline_index(n.m_piece.m_buffer, n.m_piece.m_start);
+                break;
+            } else {
+                offset -= left_length + n.m_piece.m_length;
+                line_feeds += subtree_line_feeds(n.m_left) + n.m_piece.m_line_feeds;
+                node = n.m_right;
+            }
+        }
+        return line_feeds;
+    }
+
+    // The offset each of rows (sorted) starts at, found with one walk over the pieces
+    // rather than a search from the root per row
+    std::vector<size_t> line_starts(std::vector<size_t> const &rows) const {
+        assert(std::is_sorted(rows.begin(), rows.end()));
+        assert(rows.empty() || rows.back() < num_lines());
+        std::vector<size_t> starts;
+        starts.reserve(rows.size());
+        size_t next = 0;
+        for (; next < rows.size() && rows[next] == 0; ++next) {
+            starts.push_back(0);
+        }
+        size_t piece_begin = 0;
+        size_t line_feeds_before = 0;
+        auto visit = [&](Piece const &piece) {
+            // row r starts just past the r-th newline
+            if (next < rows.size() && rows[next] <= line_feeds_before + piece.m_line_feeds) {
+                std::vector<size_t> const &newlines = newlines_of(piece.m_buffer);
+                size_t first_idx = first_newline_index(piece.m_buffer, piece.m_start);
+                for (; next < rows.size() && rows[next] <= line_feeds_before + piece.m_line_feeds; ++next) {
+                    size_t newline = newlines[first_idx + (rows[next] - line_feeds_before - 1)];
+                    starts.push_back(piece_begin + (newline - piece.m_start) + 1);
+                }
+            }
+            piece_begin += piece.m_length;
+            line_feeds_before += piece.m_line_feeds;
+        };
+        for_each_piece(m_root, visit);
+        return starts;
+    }
+
+    // The row each of offsets (sorted) falls on, in one walk over the pieces
+    std::vector<size_t> rows_of(std::vector<size_t> const &offsets) const {
+        assert(std::is_sorted(offsets.begin(), offsets.end()));
+        assert(offsets.empty() || offsets.back() <= size());
+        std::vector<size_t> rows;
+        rows.reserve(offsets.size());
+        size_t next = 0;
+        size_t piece_begin = 0;
+        size_t line_feeds_before = 0;
+        auto visit = [&](Piece const &piece) {
+            size_t piece_end = piece_begin + piece.m_length;
+            if (next < offsets.size() && offsets[next] < piece_end) {
+                size_t first_idx = first_newline_index(piece.m_buffer, piece.m_start);
+                for (; next < offsets.size() && offsets[next] < piece_end; ++next) {
+                    size_t start = piece.m_start + (offsets[next] - piece_begin);
+                    size_t line_feeds_within = first_newline_index(piece.m_buffer, start) - first_idx;
+                    rows.push_back(line_feeds_before + line_feeds_within);
+                }
+            }
+            piece_begin = piece_end;
+            line_feeds_before += piece.m_line_feeds;
+        };
+        for_each_piece(m_root, visit);
+        // offsets at the very end of the document
+        rows.resize(offsets.size(), line_feeds_before);
+        return rows;
+    }
+
+    // Calls fn with every contiguous chunk of text in [offset, offset + length), in order
+    template <typename F>
+    void for_each_chunk(size_t offset, size_t length, F &&fn) const {
+        assert(offset + length <= size());
+        if (length == 0) {
+            return;
+        }
+        visit_chunks(m_root, offset, offset + length, 0, fn);
+    }
+
+    // Calls fn with the text of every piece, in order, and how many '\n' it holds
+    template <typename F>
+    void for_each_piece_text(F &&fn) const {
+        auto emit = [&](Piece const &piece) {
+            fn(buffer_text(piece.m_buffer, piece.m_start, piece.m_length), piece.m_line_feeds);
+        };
+        for_each_piece(m_root, emit);
+    }
+
+    // Copies out [offset, offset + length)
+    std::string substr(size_t offset, size_t length) const {
+        std::string result;
+        substr(offset, length, result);
+        return result;
+    }
+
+    // The same, written over result so that its storage gets reused
+    void substr(size_t offset, size_t length, std::string &result) const {
+        result.clear();
+        result.reserve(length);
+        for_each_chunk(offset, length, [&](std::string_view chunk) { result.append(chunk); });
+    }
+
+    // Copies out the line at row, without its newline
+    std::string line_at(size_t row) const {
+        return substr(line_start(row), line_length(row));
+    }
+
+    // The same, written over line
+    void line_at(size_t row, std::string &line) const {
+        substr(line_start(row), line_length(row), line);
+    }
+
+    std::string to_string() const {
+        return substr(0, size());
+    }
+
+  private:
+    // Copies text into the add buffer, or nullopt if there's nothing to copy
+    std::optional<Piece> add_piece(std::string_view text) {
+        if (text.empty()) {
+            return std::nullopt;
+        }
+        size_t add_start = m_add.append(text);
+        NewlineScanner::find_newlines(text, add_start, m_add_newlines);
+        return make_piece(BufferKind::ADD, add_start, text.size());
+    }
+
+    // Lays out the pieces with the count ranges that range_at(idx) hands back replaced by
+    // piece_at(idx), and rebuilds the tree from them
+    template <typename RangeAt, typename PieceAt>
+    void replace_ranges(size_t count, RangeAt &&range_at, PieceAt &&piece_at) {
+        std::vector<Piece> pieces;
+        pieces.reserve(m_nodes.size() + 2 * count + 1);
+        // pieces that turn out to be contiguous in their buffer, as happens when a removal
+        // or an earlier batch leaves two halves of one piece side by side, are joined up
+        auto push_piece = [&](Piece const &piece) {
+            if (!pieces.empty()) {
+                Piece &last = pieces.back();
+                if (last.m_buffer == piece.m_buffer && last.m_start + last.m_length == piece.m_start) {
+                    last.m_length += piece.m_length;
+                    last.m_line_feeds += piece.m_line_feeds;
+                    return;
+                }
+            }
+            pieces.push_back(piece);
+        };
+        size_t next_range = 0;
+        // end of the range being skipped over, which can run across several pieces
+        size_t skip_until = 0;
+        size_t piece_begin = 0;
+        auto lay_out_piece = [&](Piece const &piece) {
+            size_t piece_end = piece_begin + piece.m_length;
+            size_t pos = std::max(piece_begin, skip_until);
+            while (pos < piece_end) {
+                std::optional<TextRange> range;
+                if (next_range < count && range_at(next_range).m_offset < piece_end) {
+                    range = range_at(next_range);
+                }
+                size_t keep_until = range.has_value() ? range->m_offset : piece_end;
+                if (keep_until > pos) {
+                    size_t start = piece.m_start + (pos - piece_begin);
+                    push_piece(make_piece(piece.m_buffer, start, keep_until - pos));
+                }
+                if (!range.has_value()) {
+                    break;
+                }
+                if (std::optional<Piece> const &replacement_piece = piece_at(next_range)) {
+                    push_piece(*replacement_piece);
+                }
+                skip_until = range->m_offset + range->m_length;
+                next_range++;
+                pos = skip_until;
+            }
+            piece_begin = piece_end;
+        };
+        for_each_piece(m_root, lay_out_piece);
+        // inserts at the very end of the document come after every piece
+        for (; next_range < count; ++next_range) {
+            assert(range_at(next_range).m_offset == piece_begin);
+            if (std::optional<Piece> const &replacement_piece = piece_at(next_range)) {
+                push_piece(*replacement_piece);
+            }
+        }
+
+        m_nodes.clear();
+        m_free_nodes.clear();
+        m_root = build_tree(pieces);
+    }
+
+    // The text of [start, start + length) in the given buffer
+    std::string_view buffer_text(BufferKind kind, size_t start, size_t length) const {
+        if (kind == BufferKind::ORIGINAL) {
+            return m_original.view().substr(start, length);
+        }
+        return m_add.view(start, length);
+    }
+
+    std::vector<size_t> const &newlines_of(BufferKind kind) const {
+        return kind == BufferKind::ORIGINAL ? m_original_newlines : m_add_newlines;
+    }
+
+    // index into newlines_of(kind) of the first newline at or after buffer offset start
+    size_t first_newline_index(BufferKind kind, size_t start) const {
+        std::vector<size_t> const &newlines = newlines_of(kind);
+        return std::lower_bound(newlines.begin(), newlines.end(), start) - newlines.begin();
+    }
+
+    Piece make_piece(BufferKind kind, size_t start, size_t length) const {
+        size_t line_feeds = first_newline_index(kind, start + length) - first_newline_index(kind, start);
+        return Piece{kind, start, length, line_feeds};
+    }
+
+    size_t make_node(Piece piece) {
+        // xorshift32; we only need the priorities to look random
+        m_rng_state ^= m_rng_state << 13;
+        m_rng_state ^= m_rng_state >> 17;
+        m_rng_state ^= m_rng_state << 5;
+
+        Node node{piece, NIL, NIL, m_rng_state, piece.m_length, piece.m_line_feeds};
+        if (!m_free_nodes.empty()) {
+            size_t idx = m_free_nodes.back();
+            m_free_nodes.pop_back();
+            m_nodes[idx] = node;
+            return idx;
+        }
+        m_nodes.push_back(node);
+        return m_nodes.size() - 1;
+    }
+
+    void free_subtree(size_t node) {
+        if (node == NIL) {
+            return;
+        }
+        free_subtree(m_nodes[node].m_left);
+        free_subtree(m_nodes[node].m_right);
+        m_free_nodes.push_back(node);
+    }
+
+    size_t subtree_length(size_t node) const {
+        return node == NIL ? 0 : m_nodes[node].m_subtree_length;
+    }
+
+    size_t subtree_line_feeds(size_t node) const {
+        return node == NIL ? 0 : m_nodes[node].m_subtree_line_feeds;
+    }
+
+    void update(size_t node) {
+        Node &n = m_nodes[node];
+        n.m_subtree_length = subtree_length(n.m_left) + n.m_piece.m_length + subtree_length(n.m_right);
+        n.m_subtree_line_feeds =
+            subtree_line_feeds(n.m_left) + n.m_piece.m_line_feeds + subtree_line_feeds(n.m_right);
+    }
+
+    size_t merge(size_t left, size_t right) {
+        if (left == NIL) {
+            return right;
+        }
+        if (right == NIL) {
+            return left;
+        }
+        if (m_nodes[left].m_priority > m_nodes[right].m_priority) {
+            size_t merged = merge(m_nodes[left].m_right, right);
+            m_nodes[left].m_right = merged;
+            update(left);
+            return left;
+        } else {
+            size_t merged = merge(left, m_nodes[right].m_left);
+            m_nodes[right].m_left = merged;
+            update(right);
+            return right;
+        }
+    }
+
+    // Splits the tree so that the first tree holds exactly offset bytes; a piece that
+    // straddles offset gets cut in two
+    std::pair<size_t, size_t> split(size_t node, size_t offset) {
+        if (node == NIL) {
+            return {NIL, NIL};
+        }
+        size_t left_length = subtree_length(m_nodes[node].m_left);
+        size_t piece_length = m_nodes[node].m_piece.m_length;
+
+        if (offset <= left_length) {
+            auto [a, b] = split(m_nodes[node].m_left, offset);
+            m_nodes[node].m_left = b;
+            update(node);
+            return {a, node};
+        }
+        if (offset >= left_length + piece_length) {
+            auto [a, b] = split(m_nodes[node].m_right, offset - left_length - piece_length);
+            m_nodes[node].m_right = a;
+            update(node);
+            return {node, b};
+        }
+
+        // the cut lands inside this node's piece
+        size_t cut = offset - left_length;
+        Piece piece = m_nodes[node].m_piece;
+        m_nodes[node].m_piece = make_piece(piece.m_buffer, piece.m_start, cut);
+        size_t tail = make_node(make_piece(piece.m_buffer, piece.m_start + cut, piece.m_length - cut));
+
+        size_t right = m_nodes[node].m_right;
+        m_nodes[node].m_right = NIL;
+        update(node);
+        return {node, merge(tail, right)};
+    }
+
+    // Calls fn on every piece in document order
+    template <typename F>
+    void for_each_piece(size_t node, F &fn) const {
+        if (node == NIL) {
+            return;
+        }
+        for_each_piece(m_nodes[node].m_left, fn);
+        fn(m_nodes[node].m_piece);
+        for_each_piece(m_nodes[node].m_right, fn);
+    }
+
+    // Builds a treap holding pieces in order. Nodes are added left to right, and each new
+    // node takes over as the right child of the last node on the right spine with a higher
+    // priority, adopting what it displaces as its left child, so every node is pushed
+    // and popped once.
+    size_t build_tree(std::vector<Piece> const &pieces) {
+        std::vector<size_t> right_spine;
+        for (Piece const &piece : pieces) {
+            size_t node = make_node(piece);
+            size_t displaced = NIL;
+            uint32_t priority = m_nodes[node].m_priority;
+            while (!right_spine.empty() && m_nodes[right_spine.back()].m_priority < priority) {
+                displaced = right_spine.back();
+                right_spine.pop_back();
+            }
+            m_nodes[node].m_left = displaced;
+            if (!right_spine.empty()) {
+                m_nodes[right_spine.back()].m_right = node;
+            }
+            right_spine.push_back(node);
+        }
+        if (right_spine.empty()) {
+            return NIL;
+        }
+        size_t root = right_spine.front();
+        update_subtree(root);
+        return root;
+    }
+
+    // Recomputes the cached totals of every node below and including node
+    void update_subtree(size_t node) {
+        if (node == NIL) {
+            return;
+        }
+        update_subtree(m_nodes[node].m_left);
+        update_subtree(m_nodes[node].m_right);
+        update(node);
+    }
+
+    size_t rightmost(size_t node) const {
+        assert(node != NIL);
+        while (m_nodes[node].m_right != NIL) {
+            node = m_nodes[node].m_right;
+        }
+        return node;
+    }
+
+    void extend_rightmost(size_t node, size_t length, size_t line_feeds) {
+        if (m_nodes[node].m_right != NIL) {
+            extend_rightmost(m_nodes[node].m_right, length, line_feeds);
+        } else {
+            m_nodes[node].m_piece.m_length += length;
+            m_nodes[node].m_piece.m_line_feeds += line_feeds;
+        }
+        update(node);
+    }
+
+    // Document offset of the nth newline (1-indexed)
+    size_t offset_of_newline(size_t nth) const {
+        assert(nth >= 1 && nth <= subtree_line_feeds(m_root));
+        size_t node = m_root;
+        size_t base = 0;
+        while (node != NIL) {
+            Node const &n = m_nodes[node];
+            size_t left_line_feeds = subtree_line_feeds(n.m_left);
+            if (nth <= left_line_feeds) {
+                node = n.m_left;
+            } else if (nth <= left_line_feeds + n.m_piece.m_line_feeds) {
+                size_t idx = first_newline_index(n.m_piece.m_buffer, n.m_piece.m_start) + (nth - left_line_feeds - 1);
+                size_t in_piece = newlines_of(n.m_piece.m_buffer)[idx] - n.m_piece.m_start;
+                return base + subtree_length(n.m_left) + in_piece;
+            } else {
+                nth -= left_line_feeds + n.m_piece.m_line_feeds;
+                base += subtree_length(n.m_left) + n.m_piece.m_length;
+                node = n.m_right;
+            }
+        }
+        assert(false);
+        return size();
+    }
+
+    // Emits the parts of node's subtree that overlap [begin, end); base is the
+    // document offset at which node's subtree starts
+    template <typename F>
+    void visit_chunks(size_t node, size_t begin, size_t end, size_t base, F &fn) const {
+        if (node == NIL || begin >= end) {
+            return;
+        }
+        Node const &n = m_nodes[node];
+        size_t piece_begin = base + subtree_length(n.m_left);
+        size_t piece_end = piece_begin + n.m_piece.m_length;
+
+        if (begin < piece_begin) {
+            visit_chunks(n.m_left, begin, end, base, fn);
+        }
+        size_t from = std::max(begin, piece_begin);
+        size_t to = std::min(end, piece_end);
+        if (from < to) {
+            fn(buffer_text(n.m_piece.m_buffer, n.m_piece.m_start + (from - piece_begin), to - from));
+        }
+        if (end > piece_end) {
+            visit_chunks(n.m_right, begin, end, piece_end, fn);
+        }
+    }
+};
@@ -0,0 +1,829 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Where a regex matched within the text it was given
+struct RegexMatch {
+    size_t m_offset;
+    size_t m_length;
+};
+
+// A regular expression searched for one line at a time. Supports literals, ., [classes],
+// \d \w \s (and \D \W \S), groups, |, * + ? {m,n}, and ^ $ for the start and end of a line.
+//
+// The pattern is parsed into a tree that is compiled into two Thompson NFAs, one that reads
+// forwards and one that reads backwards. Neither is simulated directly: each is turned into
+// a DFA one state at a time, as the text being searched reaches states that don't exist yet,
+// and the states are kept for the next search. Every byte is looked at a fixed number of
+// times whatever the pattern, so nothing makes a search blow up the way backtracking
+// matchers like std::regex can.
+//
+// Matches are leftmost-longest, never run across lines and are never empty; patterns that
+// could match empty text are rejected. The DFAs grow inside const searches, so one Regex
+// must not be searched from two threads at once.
+class Regex {
+  public:
+    // A state of the search DFA; see scan
+    using ScanState = uint32_t;
+
+  private:
+    static constexpr size_t UNBOUNDED = SIZE_MAX;
+    // the most a {m,n} may ask for, and the most instructions a pattern may compile to
+    static constexpr size_t MAX_REPEAT = 1000;
+    static constexpr size_t MAX_PROGRAM_SIZE = 1 << 16;
+    // a DFA that grows past this many states (about 1 KiB each) is thrown away and rebuilt
+    // from whatever state it is in, so a pathological pattern can't eat all the memory
+    static constexpr size_t MAX_DFA_STATES = 2048;
+
+    using ByteSet = std::bitset<256>;
+
+    enum class NodeKind {
+        BYTES,
+        EMPTY,
+        CONCAT,
+        ALTERNATE,
+        REPEAT,
+        LINE_BEGIN,
+        LINE_END,
+    };
+
+    // The parsed pattern, as a tree of nodes that refer to their children by index
+    struct Node {
+        NodeKind m_kind;
+        ByteSet m_bytes;
+        std::vector<size_t> m_children;
+        size_t m_min;
+        size_t m_max;
+    };
+
+    class Parser {
+        std::string_view m_pattern;
+        bool m_fold_case;
+        size_t m_pos;
+        std::string m_error;
+
+      public:
+        std::vector<Node> m_nodes;
+
+        Parser(std::string_view pattern, bool fold_case)
+            : m_pattern(pattern), m_fold_case(fold_case), m_pos(0) {
+        }
+
+        // The index of the root node, or nullopt with error set
+        std::optional<size_t> parse(std::string &error) {
+            size_t root = parse_alternation();
+            if (m_error.empty() && m_pos < m_pattern.size()) {
+                // only a ) that wasn't opened can stop the top level early
+                m_error = "Unmatched )";
+            }
+            if (!m_error.empty()) {
+                error = m_error;
+                return std::nullopt;
+            }
+            return root;
+        }
+
+      private:
+        size_t add_node(NodeKind kind, ByteSet bytes = {}, std::vector<size_t> children = {}, size_t min = 0,
+                        size_t max = 0) {
+            m_nodes.push_back(Node{kind, bytes, std::move(children), min, max});
+            return m_nodes.size() - 1;
+        }
+
+        bool at_end() const {
+            return m_pos >= m_pattern.size();
+        }
+
+        void add_byte(ByteSet &bytes, unsigned char c) const {
+            bytes.set(c);
+            if (m_fold_case && std::isalpha(c)) {
+                bytes.set((unsigned char)std::tolower(c));
+                bytes.set((unsigned char)std::toupper(c));
+            }
+        }
+
+        size_t parse_alternation() {
+            std::vector<size_t> alternatives{parse_concat()};
+            while (m_error.empty() && !at_end() && m_pattern[m_pos] == '|') {
+                m_pos++;
+                alternatives.push_back(parse_concat());
+            }
+            if (alternatives.size() == 1) {
+                return alternatives[0];
+            }
+            return add_node(NodeKind::ALTERNATE, {}, std::move(alternatives));
+        }
+
+        size_t parse_concat() {
+            std::vector<size_t> parts;
+            while (m_error.empty() && !at_end() && m_pattern[m_pos] != '|' && m_pattern[m_pos] != ')') {
+                char c = m_pattern[m_pos];
+                if (c == '*' || c == '+' || c == '?') {
+                    m_error = std::string{"Nothing to repeat before "} + c;
+                    break;
+                }
+                size_t atom = parse_atom();
+                parts.push_back(parse_quantifiers(atom));
+            }
+            if (parts.empty()) {
+                return add_node(NodeKind::EMPTY);
+            }
+            if (parts.size() == 1) {
+                return parts[0];
+            }
+            return add_node(NodeKind::CONCAT, {}, std::move(parts));
+        }
+
+        size_t parse_quantifiers(size_t atom) {
+            while (m_error.empty() && !at_end()) {
+                char c = m_pattern[m_pos];
+                size_t min = 0;
+                size_t max = UNBOUNDED;
+                if (c == '*') {
+                    m_pos++;
+                } else if (c == '+') {
+                    min = 1;
+                    m_pos++;
+                } else if (c == '?') {
+                    max = 1;
+                    m_pos++;
+                } else if (c != '{' || !parse_counts(min, max)) {
+                    // a { that doesn't start a count is just a {
+                    break;
+                }
+                atom = add_node(NodeKind::REPEAT, {}, {atom}, min, max);
+            }
+            return atom;
+        }
+
+        // Reads {m}, {m,} or {m,n}, leaving m_pos alone if what follows isn't one
+        bool parse_counts(size_t &min, size_t &max) {
+            size_t pos = m_pos + 1;
+            auto read_number = [&](size_t &number) {
+                size_t begin = pos;
+                number = 0;
+                while (pos < m_pattern.size() && std::isdigit((unsigned char)m_pattern[pos])) {
+                    number = std::min(number * 10 + (m_pattern[pos] - '0'), MAX_REPEAT + 1);
+                    pos++;
+                }
+                return pos > begin;
+            };
+            if (!read_number(min)) {
+                return false;
+            }
+            max = min;
+            if (pos < m_pattern.size() && m_pattern[pos] == ',') {
+                pos++;
+                if (!read_number(max)) {
+                    max = UNBOUNDED;
+                }
+            }
+            if (pos >= m_pattern.size() || m_pattern[pos] != '}') {
+                return false;
+            }
+            m_pos = pos + 1;
+            if (min > MAX_REPEAT || (max != UNBOUNDED && max > MAX_REPEAT)) {
+                m_error = "Repeat count over " + std::to_string(MAX_REPEAT);
+            } else if (max < min) {
+                m_error = "Repeat count {m,n} has n < m";
+            }
+            return true;
+        }
+
+        size_t parse_atom() {
+            char c = m_pattern[m_pos++];
+            switch (c) {
+            case '(': {
+                if (m_pattern.substr(m_pos, 2) == "?:") {
+                    m_pos += 2;
+                }
+                size_t group = parse_alternation();
+                if (m_error.empty() && (at_end() || m_pattern[m_pos] != ')')) {
+                    m_error = "Missing )";
+                }
+                m_pos++;
+                return group;
+            }
+            case '[':
+                return add_node(NodeKind::BYTES, parse_class());
+            case '.': {
+                ByteSet bytes;
+                bytes.set();
+                bytes.reset('\n');
+                return add_node(NodeKind::BYTES, bytes);
+            }
+            case '^':
+                return add_node(NodeKind::LINE_BEGIN);
+            case '$':
+                return add_node(NodeKind::LINE_END);
+            case '\\':
+                return add_node(NodeKind::BYTES, parse_escape());
+            default: {
+                ByteSet bytes;
+                add_byte(bytes, (unsigned char)c);
+                return add_node(NodeKind::BYTES, bytes);
+            }
+            }
+        }
+
+        // Reads what follows a \, both outside and inside a class
+        ByteSet parse_escape() {
+            ByteSet bytes;
+            if (at_end()) {
+                m_error = "Pattern ends with a \\";
+                return bytes;
+            }
+            unsigned char c = (unsigned char)m_pattern[m_pos++];
+            switch (c) {
+            case 'd':
+            case 'D':
+                for (unsigned char digit = '0'; digit <= '9'; ++digit) {
+                    bytes.set(digit);
+                }
+                break;
+            case 'w':
+            case 'W':
+                for (size_t byte = 0; byte < 256; ++byte) {
+                    bytes[byte] = std::isalnum((int)byte) || byte == '_';
+                }
+                break;
+            case 's':
+            case 'S':
+                for (unsigned char space : {' ', '\t', '\r', '\f', '\v'}) {
+                    bytes.set(space);
+                }
+                break;
+            case 't':
+                bytes.set('\t');
+                break;
+            case 'n':
+                bytes.set('\n');
+                break;
+            case 'r':
+                bytes.set('\r');
+                break;
+            default:
+                if (std::isalnum(c)) {
+                    m_error = std::string{"Unknown escape \\"} + (char)c;
+                } else {
+                    add_byte(bytes, c);
+                }
+                return bytes;
+            }
+            if (std::isupper(c)) {
+                bytes.flip();
+                bytes.reset('\n');
+            }
+            return bytes;
+        }
+
+        // Reads a class after its [, up to and including the ]
+        ByteSet parse_class() {
+            ByteSet bytes;
+            bool negated = !at_end() && m_pattern[m_pos] == '^';
+            if (negated) {
+                m_pos++;
+            }
+            // a ] straight after the [ (or [^) is part of the class
+            bool first = true;
+            while (m_error.empty() && !at_end() && (first || m_pattern[m_pos] != ']')) {
+                first = false;
+                unsigned char low = (unsigned char)m_pattern[m_pos++];
+                if (low == '\\') {
+                    ByteSet escaped = parse_escape();
+                    bytes |= escaped;
+                    if (escaped.count() != 1) {
+                        continue;
+                    }
+                    // a single escaped byte can still start a range
+                    for (size_t byte = 0; byte < 256; ++byte) {
+                        if (escaped[byte]) {
+                            low = (unsigned char)byte;
+                        }
+                    }
+                }
+                bool is_range =
+                    m_pos + 1 < m_pattern.size() && m_pattern[m_pos] == '-' && m_pattern[m_pos + 1] != ']';
+                if (!is_range) {
+                    add_byte(bytes, low);
+                    continue;
+                }
+                unsigned char high = (unsigned char)m_pattern[m_pos + 1];
+                m_pos += 2;
+                if (high < low) {
+                    m_error = std::string{"Bad range "} + (char)low + "-" + (char)high;
+                    break;
+                }
+                for (size_t byte = low; byte <= high; ++byte) {
+                    add_byte(bytes, (unsigned char)byte);
+                }
+            }
+            if (m_error.empty() && at_end()) {
+                m_error = "Missing ]";
+            }
+            m_pos++;
+            if (negated) {
+                bytes.flip();
+                bytes.reset('\n');
+            }
+            return bytes;
+        }
+    };
+
+    enum class Op {
+        // consumes one byte in m_bytes, then goes to m_next
+        BYTES,
+        // goes to both m_next and m_alt
+        SPLIT,
+        // only go on to m_next at the start / end of the line, in the direction of reading
+        LINE_BEGIN,
+        LINE_END,
+        MATCH,
+    };
+
+    struct Inst {
+        Op m_op;
+        uint32_t m_next;
+        uint32_t m_alt;
+        ByteSet m_bytes;
+    };
+
+    struct Program {
+        std::vector<Inst> m_insts;
+        uint32_t m_start;
+    };
+
+    // Compiles the tree into a program, reading either forwards or backwards. Each node's
+    // code is emitted knowing where to go once it has matched, so no jumps need patching.
+    class Compiler {
+        std::vector<Node> const &m_nodes;
+        bool m_reversed;
+        Program &m_program;
+
+      public:
+        bool m_too_large;
+
+        Compiler(std::vector<Node> const &nodes, bool reversed, Program &program)
+            : m_nodes(nodes), m_reversed(reversed), m_program(program), m_too_large(false) {
+        }
+
+        void compile(size_t root) {
+            uint32_t match = add_inst(Op::MATCH, 0);
+            m_program.m_start = emit(root, match);
+        }
+
+      private:
+        uint32_t add_inst(Op op, uint32_t next, uint32_t alt = 0, ByteSet bytes = {}) {
+            if (m_program.m_insts.size() >= MAX_PROGRAM_SIZE) {
+                m_too_large = true;
+                return next;
+            }
+            m_program.m_insts.push_back(Inst{op, next, alt, bytes});
+            return (uint32_t)m_program.m_insts.size() - 1;
+        }
+
+        // Emits the code for nodes[idx] and returns where it starts
+        uint32_t emit(size_t idx, uint32_t next) {
+            if (m_too_large) {
+                return next;
+            }
+            Node const &node = m_nodes[idx];
+            switch (node.m_kind) {
+            case NodeKind::BYTES:
+                return add_inst(Op::BYTES, next, 0, node.m_bytes);
+            case NodeKind::EMPTY:
+                return next;
+            // read backwards, the start of a line is where reading ends
+            case NodeKind::LINE_BEGIN:
+                return add_inst(m_reversed ? Op::LINE_END : Op::LINE_BEGIN, next);
+            case NodeKind::LINE_END:
+                return add_inst(m_reversed ? Op::LINE_BEGIN : Op::LINE_END, next);
+            case NodeKind::CONCAT:
+                if (m_reversed) {
+                    for (size_t child : node.m_children) {
+                        next = emit(child, next);
+                    }
+                } else {
+                    for (size_t child = node.m_children.size(); child > 0; --child) {
+                        next = emit(node.m_children[child - 1], next);
+                    }
+                }
+                return next;
+            case NodeKind::ALTERNATE: {
+                uint32_t entry = emit(node.m_children.back(), next);
+                for (size_t child = node.m_children.size() - 1; child > 0; --child) {
+                    entry = add_inst(Op::SPLIT, emit(node.m_children[child - 1], next), entry);
+                }
+                return entry;
+            }
+            case NodeKind::REPEAT:
+                return emit_repeat(node, next);
+            }
+            return next;
+        }
+
+        uint32_t emit_repeat(Node const &node, uint32_t next) {
+            size_t child = node.m_children[0];
+            uint32_t tail = next;
+            if (node.m_max == UNBOUNDED) {
+                // the loop goes back into the child, whose code is only known once emitted
+                uint32_t loop = add_inst(Op::SPLIT, next, next);
+                uint32_t body = emit(child, loop);
+                if (!m_too_large) {
+                    m_program.m_insts[loop].m_next = body;
+                }
+                tail = loop;
+            } else {
+                // each optional copy either matches and goes on to the next or skips the rest
+                for (size_t copy = node.m_min; copy < node.m_max; ++copy) {
+                    tail = add_inst(Op::SPLIT, emit(child, tail), next);
+                }
+            }
+            for (size_t copy = 0; copy < node.m_min; ++copy) {
+                tail = emit(child, tail);
+            }
+            return tail;
+        }
+    };
+
+    // A DFA over a program, built a state at a time as searches need them. A state is the
+    // set of instructions the NFA could be at; unanchored DFAs also start a new thread at
+    // every byte, so they find matches starting anywhere.
+    class Dfa {
+        static constexpr uint32_t UNKNOWN = UINT32_MAX;
+        // set on transitions into a matching state, so scanning needs one load per byte
+        static constexpr uint32_t MATCH_BIT = 1u << 31;
+
+        struct State {
+            // sorted; only instructions that wait on something: BYTES, LINE_END and MATCH
+            std::vector<uint32_t> m_pcs;
+            bool m_match;
+            // whether it matches if the line ends here
+            bool m_match_at_end;
+            bool m_dead;
+        };
+
+        Program const &m_program;
+        bool m_unanchored;
+        std::vector<State> m_states;
+        // 256 per state: the state each byte leads to, with MATCH_BIT, or UNKNOWN
+        std::vector<uint32_t> m_transitions;
+        std::map<std::vector<uint32_t>, uint32_t> m_ids;
+        // the start states for reading from the start of a line and from anywhere else
+        std::array<uint32_t, 2> m_starts;
+        // bumped whenever the states are thrown away
+        size_t m_generation_of_states;
+
+        // scratch space for closure
+        std::vector<uint32_t> m_seen;
+        uint32_t m_closure_generation;
+        std::vector<uint32_t> m_stack;
+
+      public:
+        Dfa(Program const &program, bool unanchored)
+            : m_program(program), m_unanchored(unanchored), m_starts{UNKNOWN, UNKNOWN},
+              m_generation_of_states(0), m_seen(program.m_insts.size(), 0), m_closure_generation(0) {
+        }
+
+        uint32_t start(bool at_line_begin) {
+            if (m_starts[at_line_begin] == UNKNOWN) {
+                std::vector<uint32_t> pcs;
+                closure({m_program.m_start}, at_line_begin, false, pcs);
+                uint32_t id = add_state(std::move(pcs));
+                m_starts[at_line_begin] = id;
+            }
+            return m_starts[at_line_begin];
+        }
+
+        // Ids passed in are only good until the next call that adds a state, so callers
+        // keep nothing but the state they are in
+        uint32_t step(uint32_t state, unsigned char c) {
+            uint32_t next = m_transitions[state * 256 + c];
+            return (next != UNKNOWN ? next : add_transition(state, c)) & ~MATCH_BIT;
+        }
+
+        // Steps through text until a state that matches, returning how much of text that
+        // took, or npos if none did
+        size_t run_until_match(uint32_t &state, std::string_view text) {
+            uint32_t const *transitions = m_transitions.data();
+            for (size_t idx = 0; idx < text.size(); ++idx) {
+                unsigned char c = (unsigned char)text[idx];
+                uint32_t next = transitions[state * 256 + c];
+                if (next == UNKNOWN) {
+                    next = add_transition(state, c);
+                    transitions = m_transitions.data();
+                }
+                state = next & ~MATCH_BIT;
+                if (next & MATCH_BIT) {
+                    return idx + 1;
+                }
+            }
+            return std::string_view::npos;
+        }
+
+        bool matches(uint32_t state, bool at_line_end) const {
+            return at_line_end ? m_states[state].m_match_at_end : m_states[state].m_match;
+        }
+
+        bool dead(uint32_t state) const {
+            return m_states[state].m_dead;
+        }
+
+      private:
+        // The transition from state on c, with MATCH_BIT
+        uint32_t add_transition(uint32_t state, unsigned char c) {
+            std::vector<uint32_t> roots;
+            for (uint32_t pc : m_states[state].m_pcs) {
+                Inst const &inst = m_program.m_insts[pc];
+                if (inst.m_op == Op::BYTES && inst.m_bytes[c]) {
+                    roots.push_back(inst.m_next);
+                }
+            }
+            if (m_unanchored) {
+                roots.push_back(m_program.m_start);
+            }
+            std::vector<uint32_t> pcs;
+            closure(roots, false, false, pcs);
+
+            size_t generation = m_generation_of_states;
+            uint32_t next = add_state(std::move(pcs));
+            if (m_states[next].m_match) {
+                next |= MATCH_BIT;
+            }
+            // if the states were just thrown away, state is gone and there's nothing to link
+            if (generation == m_generation_of_states) {
+                m_transitions[state * 256 + c] = next;
+            }
+            return next;
+        }
+
+        uint32_t add_state(std::vector<uint32_t> &&pcs) {
+            auto found = m_ids.find(pcs);
+            if (found != m_ids.end()) {
+                return found->second;
+            }
+            if (m_states.size() >= MAX_DFA_STATES) {
+                m_states.clear();
+                m_transitions.clear();
+                m_ids.clear();
+                m_starts = {UNKNOWN, UNKNOWN};
+                m_generation_of_states++;
+            }
+
+            State state{pcs, false, false, pcs.empty()};
+            std::vector<uint32_t> after_line_end;
+            for (uint32_t pc : pcs) {
+                Inst const &inst = m_program.m_insts[pc];
+                state.m_match = state.m_match || inst.m_op == Op::MATCH;
+                if (inst.m_op == Op::LINE_END) {
+                    after_line_end.push_back(inst.m_next);
+                }
+            }
+            std::vector<uint32_t> at_end_pcs;
+            closure(after_line_end, false, true, at_end_pcs);
+            auto is_match = [&](uint32_t pc) { return m_program.m_insts[pc].m_op == Op::MATCH; };
+            state.m_match_at_end =
+                state.m_match || std::any_of(at_end_pcs.begin(), at_end_pcs.end(), is_match);
+
+            uint32_t id = (uint32_t)m_states.size();
+            m_ids.emplace(std::move(pcs), id);
+            m_states.push_back(std::move(state));
+            m_transitions.resize(m_transitions.size() + 256, UNKNOWN);
+            return id;
+        }
+
+        // Every instruction reachable from roots without reading a byte
+        void closure(std::vector<uint32_t> const &roots, bool at_line_begin, bool at_line_end,
+                     std::vector<uint32_t> &pcs) {
+            if (++m_closure_generation == 0) {
+                std::fill(m_seen.begin(), m_seen.end(), 0);
+                m_closure_generation = 1;
+            }
+            m_stack.assign(roots.begin(), roots.end());
+            while (!m_stack.empty()) {
+                uint32_t pc = m_stack.back();
+                m_stack.pop_back();
+                if (m_seen[pc] == m_closure_generation) {
+                    continue;
+                }
+                m_seen[pc] = m_closure_generation;
+                Inst const &inst = m_program.m_insts[pc];
+                switch (inst.m_op) {
+                case Op::SPLIT:
+                    m_stack.push_back(inst.m_alt);
+                    m_stack.push_back(inst.m_next);
+                    break;
+                case Op::LINE_BEGIN:
+                    if (at_line_begin) {
+                        m_stack.push_back(inst.m_next);
+                    }
+                    break;
+                case Op::LINE_END:
+                    if (at_line_end) {
+                        m_stack.push_back(inst.m_next);
+                    } else {
+                        pcs.push_back(pc);
+                    }
+                    break;
+                case Op::BYTES:
+                case Op::MATCH:
+                    pcs.push_back(pc);
+                    break;
+                }
+            }
+            std::sort(pcs.begin(), pcs.end());
+        }
+    };
+
+    Program m_forward_program;
+    Program m_reverse_program;
+    // finds where the first match in a line ends, for scan
+    mutable Dfa m_search;
+    // read from the end of a line, finds where matches start
+    mutable Dfa m_starts;
+    // finds the longest match from a given start
+    mutable Dfa m_longest;
+
+    Regex(Program forward_program, Program reverse_program)
+        : m_forward_program(std::move(forward_program)), m_reverse_program(std::move(reverse_program)),
+          m_search(m_forward_program, true), m_starts(m_reverse_program, true),
+          m_longest(m_forward_program, false) {
+    }
+
+  public:
+    Regex(Regex const &) = delete;
+    Regex &operator=(Regex const &) = delete;
+
+    // Compiles pattern, folding ASCII case if fold_case is set. Returns nullptr and says
+    // why in error if the pattern can't be used.
+    static std::shared_ptr<Regex> compile(std::string_view pattern, bool fold_case, std::string &error) {
+        Parser parser{pattern, fold_case};
+        std::optional<size_t> root = parser.parse(error);
+        if (!root.has_value()) {
+            return nullptr;
+        }
+        Program forward_program;
+        Program reverse_program;
+        Compiler forward{parser.m_nodes, false, forward_program};
+        Compiler reverse{parser.m_nodes, true, reverse_program};
+        forward.compile(*root);
+        reverse.compile(*root);
+        if (forward.m_too_large || reverse.m_too_large) {
+            error = "Pattern is too large";
+            return nullptr;
+        }
+
+        std::shared_ptr<Regex> regex{new Regex(std::move(forward_program), std::move(reverse_program))};
+        Dfa &longest = regex->m_longest;
+        if (longest.matches(longest.start(true), true) || longest.matches(longest.start(false), true)) {
+            error = "Pattern matches empty text";
+            return nullptr;
+        }
+        return regex;
+    }
+
+    // The state to scan a line from, depending on whether scanning starts at its beginning
+    ScanState scan_start(bool at_line_begin) const {
+        return m_search.start(at_line_begin);
+    }
+
+    // Carries a scan on over text, which must not contain newlines. Returns true as soon as
+    // some match has ended, within text or, when at_line_end is set, right at its end. This
+    // only says that the line has a match; find then says where it is.
+    bool scan(ScanState &state, std::string_view text, bool at_line_end) const {
+        if (m_search.run_until_match(state, text) != std::string_view::npos) {
+            return true;
+        }
+        return at_line_end && m_search.matches(state, true);
+    }
+
+    // The leftmost-longest match in line that starts at or after from; line is a whole
+    // line without its newline
+    std::optional<RegexMatch> find(std::string_view line, size_t from = 0) const {
+        return find(std::span<std::string_view const>{&line, 1}, from);
+    }
+
+    // The same for a line given as the chunks it's made of, in order, so a long line
+    // doesn't have to be copied out to be searched
+    std::optional<RegexMatch> find(std::span<std::string_view const> chunks, size_t from = 0) const {
+        // reading backwards from the end of the line, the reverse DFA matches at each byte
+        // where a match starts
+        uint32_t state = m_starts.start(true);
+        std::optional<size_t> start;
+        size_t chunk_end = 0;
+        for (std::string_view chunk : chunks) {
+            chunk_end += chunk.size();
+        }
+        for (auto it = chunks.rbegin(); it != chunks.rend() && chunk_end > from; ++it) {
+            size_t chunk_begin = chunk_end - it->size();
+            for (size_t idx = chunk_end; idx > std::max(chunk_begin, from); --idx) {
+                state = m_starts.step(state, (unsigned char)(*it)[idx - 1 - chunk_begin]);
+                if (m_starts.matches(state, idx == 1)) {
+                    start = idx - 1;
+                }
+            }
+            chunk_end = chunk_begin;
+        }
+        if (!start.has_value()) {
+            return std::nullopt;
+        }
+        return RegexMatch{*start, longest_match_at(chunks, *start)};
+    }
+
+    // Calls on_match with each match in line, left to right and without overlaps, until it
+    // returns false
+    template <typename F>
+    void for_each_match(std::string_view line, F &&on_match) const {
+        std::vector<bool> starts(line.size(), false);
+        uint32_t state = m_starts.start(true);
+        for (size_t idx = line.size(); idx > 0; --idx) {
+            state = m_starts.step(state, (unsigned char)line[idx - 1]);
+            starts[idx - 1] = m_starts.matches(state, idx == 1);
+        }
+        for (size_t idx = 0; idx < line.size();) {
+            if (!starts[idx]) {
+                idx++;
+                continue;
+            }
+            size_t length = longest_match_at(std::span<std::string_view const>{&line, 1}, idx);
+            if (!on_match(RegexMatch{idx, length})) {
+                return;
+            }
+            idx += length;
+        }
+    }
+
+  private:
+    // The length of the longest match starting at start in the line made of chunks
+    size_t longest_match_at(std::span<std::string_view const> chunks, size_t start) const {
+        size_t line_size = 0;
+        for (std::string_view chunk : chunks) {
+            line_size += chunk.size();
+        }
+        uint32_t state = m_longest.start(start == 0);
+        size_t length = 0;
+        size_t chunk_begin = 0;
+        for (std::string_view chunk : chunks) {
+            size_t chunk_end = chunk_begin + chunk.size();
+            size_t first = std::max(start, chunk_begin);
+            for (size_t idx = first; idx < chunk_end && !m_longest.dead(state); ++idx) {
+                state = m_longest.step(state, (unsigned char)chunk[idx - chunk_begin]);
+                if (m_longest.matches(state, idx + 1 == line_size)) {
+                    length = idx + 1 - start;
+                }
+            }
+            chunk_begin = chunk_end;
+        }
+        assert(length > 0);
+        return length;
+    }
+};
+
+// The most recently used compiled patterns, so searching again for the same thing (say,
+// while the pattern is being typed, or with each find-next) reuses both the compiled
+// program and the DFA states earlier searches built
+class RegexCache {
+    static constexpr size_t CAPACITY = 8;
+
+    struct Entry {
+        std::string m_pattern;
+        bool m_fold_case;
+        std::shared_ptr<Regex> m_regex;
+    };
+
+    // most recently used first
+    std::vector<Entry> m_entries;
+
+  public:
+    std::shared_ptr<Regex> get(std::string_view pattern, bool fold_case, std::string &error) {
+        auto found = std::find_if(m_entries.begin(), m_entries.end(), [&](Entry const &entry) {
+            return entry.m_pattern == pattern && entry.m_fold_case == fold_case;
+        });
+        if (found != m_entries.end()) {
+            std::rotate(m_entries.begin(), found, found + 1);
+            return m_entries.front().m_regex;
+        }
+
+        std::shared_ptr<Regex> regex = Regex::compile(pattern, fold_case, error);
+        if (regex == nullptr) {
+            return nullptr;
+        }
+        if (m_entries.size() == CAPACITY) {
+            m_entries.pop_back();
+        }
+        m_entries.insert(m_entries.begin(), Entry{std::string{pattern}, fold_case, regex});
+        return regex;
+    }
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cassert>
+#include <ncurses.h>
+#include <string>
+#include <utility>
+
+#include "ViewModel.h"
+
+// A single row at the bottom of the screen that shows where the cursor is in the
+// file, or the prompt that is currently being typed into
+class StatusBar {
+    ViewModel const *m_view_model;
+    WINDOW *m_window_ptr;
+    // the screen row the bar is drawn on
+    int m_row;
+    int m_width;
+    std::string m_text;
+    // the text being put together for the next frame; it trades places with m_text when
+    // the two differ, so both keep their storage
+    std::string m_next_text;
+    // whether m_text differs from what is on the screen
+    bool m_dirty;
+
+  public:
+    StatusBar(ViewModel const *view_model, WINDOW *window_ptr, int row, int width)
+        : m_view_model(view_model), m_window_ptr(window_ptr), m_row(row), m_width(width), m_dirty(true) {
+    }
+
+    StatusBar(StatusBar const &) = delete;
+    StatusBar &operator=(StatusBar const &) = delete;
+    StatusBar(StatusBar &&) = delete;
+    StatusBar &operator=(StatusBar &&) = delete;
+
+    void resize(int row, int width) {
+        m_row = row;
+        m_width = width;
+        m_text.clear();
+        m_dirty = true;
+    }
+
+    void update_state() {
+        m_view_model->get_status_text(m_next_text);
+        if (m_next_text.size() > (size_t)m_width) {
+            m_next_text.resize(m_width);
+        }
+        if (m_next_text != m_text) {
+            std::swap(m_text, m_next_text);
+            m_dirty = true;
+        }
+    }
+
+    void render() {
+        if (!m_dirty) {
+            return;
+        }
+        wmove(m_window_ptr, m_row, 0);
+        wclrtoeol(m_window_ptr);
+        waddnstr(m_window_ptr, m_text.data(), m_text.size());
+        mvwchgat(m_window_ptr, m_row, 0, m_width, A_REVERSE, (short)COLOUR::NORMAL, NULL);
+        wrefresh(m_window_ptr);
+        m_dirty = false;
+    }
+};
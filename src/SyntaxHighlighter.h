@@ -0,0 +1,427 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include "Colours.h"
+#include "TextBuffer.h"
+
+enum class Language {
+    NONE,
+    CPP,
+    PYTHON,
+};
+
+// What the lexer carries from the end of one line into the next
+enum class LexState : uint8_t {
+    NORMAL,
+    // C++ /* ... */
+    BLOCK_COMMENT,
+    // Python ''' ... ''' and """ ... """
+    TRIPLE_SINGLE_STRING,
+    TRIPLE_DOUBLE_STRING,
+};
+
+// Splits single lines of C++ or Python into coloured tokens. Anything that can run past the
+// end of a line shows up in the LexState it returns, so a line can be lexed knowing only
+// the state the line before it ended in.
+class Lexer {
+    // sorted, for binary_search
+    static constexpr std::string_view CPP_KEYWORDS[] = {
+        "alignas",     "alignof",      "and",          "asm",        "break",     "case",
+        "catch",       "class",        "co_await",     "co_return",  "co_yield",  "concept",
+        "const",       "const_cast",   "consteval",    "constexpr",  "constinit", "continue",
+        "decltype",    "default",      "delete",       "do",         "dynamic_cast", "else",
+        "enum",        "explicit",     "export",       "extern",     "false",     "final",
+        "for",         "friend",       "goto",         "if",         "inline",    "mutable",
+        "namespace",   "new",          "noexcept",     "not",        "nullptr",   "operator",
+        "or",          "override",     "private",      "protected",  "public",    "register",
+        "reinterpret_cast", "requires", "return",      "sizeof",     "static",    "static_assert",
+        "static_cast", "struct",       "switch",       "template",   "this",      "thread_local",
+        "throw",       "true",         "try",          "typedef",    "typeid",    "typename",
+        "union",       "using",        "virtual",      "volatile",   "while",     "xor",
+    };
+    static constexpr std::string_view CPP_TYPES[] = {
+        "auto",      "bool",     "char",     "char16_t", "char32_t", "char8_t",  "double",
+        "float",     "int",      "int16_t",  "int32_t",  "int64_t",  "int8_t",   "long",
+        "ptrdiff_t", "short",    "signed",   "size_t",   "ssize_t",  "uint16_t", "uint32_t",
+        "uint64_t",  "uint8_t",  "unsigned", "void",     "wchar_t",
+    };
+    static constexpr std::string_view PYTHON_KEYWORDS[] = {
+        "False",  "None",    "True",  "and",      "as",     "assert", "async",  "await",
+        "break",  "case",    "class", "continue", "def",    "del",    "elif",   "else",
+        "except", "finally", "for",   "from",     "global", "if",     "import", "in",
+        "is",     "lambda",  "match", "nonlocal", "not",    "or",     "pass",   "raise",
+        "return", "try",     "while", "with",     "yield",
+    };
+    static constexpr std::string_view PYTHON_TYPES[] = {
+        "bool", "bytes", "dict", "float", "int", "list", "object", "self", "set", "str", "tuple",
+    };
+    static_assert(std::is_sorted(std::begin(CPP_KEYWORDS), std::end(CPP_KEYWORDS)));
+    static_assert(std::is_sorted(std::begin(CPP_TYPES), std::end(CPP_TYPES)));
+    static_assert(std::is_sorted(std::begin(PYTHON_KEYWORDS), std::end(PYTHON_KEYWORDS)));
+    static_assert(std::is_sorted(std::begin(PYTHON_TYPES), std::end(PYTHON_TYPES)));
+
+  public:
+    // Calls on_token(start, end, colour) for each coloured token in line, left to right, and
+    // returns the state at the end of the line
+    template <typename F>
+    static LexState lex_line(Language language, std::string_view line, LexState state, F &&on_token) {
+        switch (language) {
+        case Language::CPP:
+            return lex_cpp_line(line, state, on_token);
+        case Language::PYTHON:
+            return lex_python_line(line, state, on_token);
+        case Language::NONE:
+            break;
+        }
+        return LexState::NORMAL;
+    }
+
+  private:
+    static bool is_identifier_start(char c) {
+        return std::isalpha((unsigned char)c) || c == '_';
+    }
+
+    static bool is_identifier_char(char c) {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+
+    template <size_t N>
+    static bool is_one_of(std::string_view const (&words)[N], std::string_view word) {
+        return std::binary_search(std::begin(words), std::end(words), word);
+    }
+
+    static size_t skip_identifier(std::string_view line, size_t idx) {
+        while (idx < line.size() && is_identifier_char(line[idx])) {
+            idx++;
+        }
+        return idx;
+    }
+
+    // Numbers are loose: anything that starts with a digit and runs on through digits,
+    // letters, dots, digit separators and exponent signs
+    static size_t skip_number(std::string_view line, size_t idx) {
+        while (idx < line.size()) {
+            char c = line[idx];
+            bool exponent_sign = (c == '+' || c == '-') && idx > 0 &&
+                                 (line[idx - 1] == 'e' || line[idx - 1] == 'E' || line[idx - 1] == 'p' ||
+                                  line[idx - 1] == 'P');
+            if (!is_identifier_char(c) && c != '.' && c != '\'' && !exponent_sign) {
+                break;
+            }
+            idx++;
+        }
+        return idx;
+    }
+
+    // Index just past the quote that closes a string or character literal opened before
+    // idx, or the end of the line if it never closes
+    static size_t skip_quoted(std::string_view line, size_t idx, char quote) {
+        while (idx < line.size()) {
+            if (line[idx] == '\\') {
+                idx += 2;
+            } else if (line[idx++] == quote) {
+                return idx;
+            }
+        }
+        return line.size();
+    }
+
+    template <typename F>
+    static LexState lex_cpp_line(std::string_view line, LexState state, F &&on_token) {
+        size_t idx = 0;
+        if (state == LexState::BLOCK_COMMENT) {
+            size_t end = line.find("*/");
+            if (end == std::string_view::npos) {
+                on_token(0, line.size(), COLOUR::COMMENT);
+                return LexState::BLOCK_COMMENT;
+            }
+            idx = end + 2;
+            on_token(0, idx, COLOUR::COMMENT);
+        }
+
+        size_t first_char = line.find_first_not_of(" \t");
+        bool is_include = false;
+        while (idx < line.size()) {
+            char c = line[idx];
+            size_t start = idx;
+            if (c == '/' && idx + 1 < line.size() && line[idx + 1] == '/') {
+                on_token(idx, line.size(), COLOUR::COMMENT);
+                return LexState::NORMAL;
+            } else if (c == '/' && idx + 1 < line.size() && line[idx + 1] == '*') {
+                size_t end = line.find("*/", idx + 2);
+                if (end == std::string_view::npos) {
+                    on_token(idx, line.size(), COLOUR::COMMENT);
+                    return LexState::BLOCK_COMMENT;
+                }
+                idx = end + 2;
+                on_token(start, idx, COLOUR::COMMENT);
+            } else if (c == '#' && idx == first_char) {
+                // the directive's name can be set apart from the #
+                size_t name = line.find_first_not_of(" \t", idx + 1);
+                idx = name == std::string_view::npos ? line.size() : skip_identifier(line, name);
+                is_include = line.substr(start, idx - start).ends_with("include");
+                on_token(start, idx, COLOUR::PREPROCESSOR);
+            } else if (c == '<' && is_include) {
+                size_t end = line.find('>', idx);
+                idx = end == std::string_view::npos ? line.size() : end + 1;
+                on_token(start, idx, COLOUR::STRING);
+            } else if (c == '"' || c == '\'') {
+                idx = skip_quoted(line, idx + 1, c);
+                on_token(start, idx, COLOUR::STRING);
+            } else if (std::isdigit((unsigned char)c) ||
+                       (c == '.' && idx + 1 < line.size() && std::isdigit((unsigned char)line[idx + 1]))) {
+                idx = skip_number(line, idx);
+                on_token(start, idx, COLOUR::NUMBER);
+            } else if (is_identifier_start(c)) {
+                idx = skip_identifier(line, idx);
+                std::string_view word = line.substr(start, idx - start);
+                if (is_one_of(CPP_KEYWORDS, word)) {
+                    on_token(start, idx, COLOUR::KEYWORD);
+                } else if (is_one_of(CPP_TYPES, word)) {
+                    on_token(start, idx, COLOUR::TYPE);
+                }
+            } else {
+                idx++;
+            }
+        }
+        return LexState::NORMAL;
+    }
+
+    // Where a string that starts at idx opens, allowing for prefixes like r, b and f;
+    // npos if there's no string there
+    static size_t python_string_quote(std::string_view line, size_t idx) {
+        std::string_view prefixes = "rRbBfFuU";
+        size_t quote = idx;
+        while (quote < line.size() && quote - idx < 2 &&
+               prefixes.find(line[quote]) != std::string_view::npos) {
+            quote++;
+        }
+        if (quote < line.size() && (line[quote] == '"' || line[quote] == '\'')) {
+            return quote;
+        }
+        return std::string_view::npos;
+    }
+
+    template <typename F>
+    static LexState lex_python_line(std::string_view line, LexState state, F &&on_token) {
+        size_t idx = 0;
+        if (state == LexState::TRIPLE_SINGLE_STRING || state == LexState::TRIPLE_DOUBLE_STRING) {
+            std::string_view closing = state == LexState::TRIPLE_SINGLE_STRING ? "'''" : "\"\"\"";
+            size_t end = line.find(closing);
+            if (end == std::string_view::npos) {
+                on_token(0, line.size(), COLOUR::STRING);
+                return state;
+            }
+            idx = end + 3;
+            on_token(0, idx, COLOUR::STRING);
+        }
+
+        size_t first_char = line.find_first_not_of(" \t");
+        while (idx < line.size()) {
+            char c = line[idx];
+            size_t start = idx;
+            size_t quote = is_identifier_start(c) || c == '"' || c == '\'' ? python_string_quote(line, idx)
+                                                                           : std::string_view::npos;
+            if (c == '#') {
+                on_token(idx, line.size(), COLOUR::COMMENT);
+                return LexState::NORMAL;
+            } else if (quote != std::string_view::npos) {
+                std::string_view triple = line.substr(quote, 3);
+                if (triple == "'''" || triple == "\"\"\"") {
+                    size_t end = line.find(triple, quote + 3);
+                    if (end == std::string_view::npos) {
+                        on_token(start, line.size(), COLOUR::STRING);
+                        return triple == "'''" ? LexState::TRIPLE_SINGLE_STRING
+                                                : LexState::TRIPLE_DOUBLE_STRING;
+                    }
+                    idx = end + 3;
+                } else {
+                    idx = skip_quoted(line, quote + 1, line[quote]);
+                }
+                on_token(start, idx, COLOUR::STRING);
+            } else if (c == '@' && idx == first_char) {
+                idx++;
+                while (idx < line.size() && (is_identifier_char(line[idx]) || line[idx] == '.')) {
+                    idx++;
+                }
+                on_token(start, idx, COLOUR::PREPROCESSOR);
+            } else if (std::isdigit((unsigned char)c) ||
+                       (c == '.' && idx + 1 < line.size() && std::isdigit((unsigned char)line[idx + 1]))) {
+                idx = skip_number(line, idx);
+                on_token(start, idx, COLOUR::NUMBER);
+            } else if (is_identifier_start(c)) {
+                idx = skip_identifier(line, idx);
+                std::string_view word = line.substr(start, idx - start);
+                if (is_one_of(PYTHON_KEYWORDS, word)) {
+                    on_token(start, idx, COLOUR::KEYWORD);
+                } else if (is_one_of(PYTHON_TYPES, word)) {
+                    on_token(start, idx, COLOUR::TYPE);
+                }
+            } else {
+                idx++;
+            }
+        }
+        return LexState::NORMAL;
+    }
+};
+
+// Keeps the lexer state at the end of every row, so a row can be highlighted by lexing just
+// that row. An edit only makes the rows it touched stale, and re-lexing goes on past them
+// only until a row ends in the same state it did before the edit; past that point nothing
+// can have changed. Stale rows are only re-lexed once something needs to show a row at or
+// after them, so typing in a big file re-lexes a few rows rather than the file.
+class SyntaxHighlighter {
+  public:
+    static constexpr size_t NONE = SIZE_MAX;
+
+  private:
+    Language m_language;
+    // the state at the end of each row
+    std::vector<LexState> m_end_states;
+    // rows from here on have never been lexed, so their end states are just placeholders
+    size_t m_first_unlexed_row;
+    // the first lexed row whose end state may be wrong since an edit, or NONE
+    size_t m_first_stale_row;
+    // re-lexing has to go at least this far; stale rows after it were lexed properly, just
+    // maybe from a state their previous row no longer ends in
+    size_t m_last_dirty_row;
+
+  public:
+    SyntaxHighlighter()
+        : m_language(Language::NONE), m_first_unlexed_row(0), m_first_stale_row(NONE), m_last_dirty_row(0) {
+    }
+
+    // Guesses the language from a file's extension
+    static Language language_for(std::string_view pathname) {
+        size_t dot = pathname.rfind('.');
+        if (dot == std::string_view::npos || pathname.find('/', dot) != std::string_view::npos) {
+            return Language::NONE;
+        }
+        std::string_view extension = pathname.substr(dot + 1);
+        for (std::string_view cpp : {"c", "cc", "cpp", "cxx", "h", "hh", "hpp", "hxx", "inl"}) {
+            if (extension == cpp) {
+                return Language::CPP;
+            }
+        }
+        if (extension == "py" || extension == "pyi") {
+            return Language::PYTHON;
+        }
+        return Language::NONE;
+    }
+
+    Language language() const {
+        return m_language;
+    }
+
+    // Starts over for a buffer in language; no row has been lexed yet
+    void reset(Language language, size_t num_rows) {
+        m_language = language;
+        m_end_states.assign(language == Language::NONE ? 0 : num_rows, LexState::NORMAL);
+        m_first_unlexed_row = 0;
+        m_first_stale_row = NONE;
+        m_last_dirty_row = 0;
+    }
+
+    // Takes in an edit made to the buffer
+    void apply(LineChange const &change) {
+        if (m_language == Language::NONE) {
+            return;
+        }
+        size_t first = std::min(change.m_first_row, m_end_states.size());
+        size_t old_count = std::min(change.m_old_count, m_end_states.size() - first);
+        size_t new_count = std::max<size_t>(change.m_new_count, 1);
+        // rows that only moved keep their end states
+        if (new_count > old_count) {
+            m_end_states.insert(m_end_states.begin() + first, new_count - old_count, LexState::NORMAL);
+        } else {
+            auto erase_from = m_end_states.begin() + first;
+            m_end_states.erase(erase_from, erase_from + (old_count - new_count));
+        }
+
+        if (m_first_unlexed_row >= first + old_count) {
+            m_first_unlexed_row = m_first_unlexed_row - old_count + new_count;
+        } else if (m_first_unlexed_row > first) {
+            m_first_unlexed_row = first;
+        }
+        if (first >= m_first_unlexed_row) {
+            if (m_first_stale_row >= m_first_unlexed_row) {
+                m_first_stale_row = NONE;
+            }
+            m_last_dirty_row = std::min(m_last_dirty_row, m_first_unlexed_row);
+            return;
+        }
+
+        size_t last_edited = first + new_count - 1;
+        if (m_first_stale_row != NONE) {
+            // the first stale row has to be redone even if re-lexing from this edit settles
+            // before reaching it
+            size_t previous = std::max(m_last_dirty_row, m_first_stale_row);
+            if (previous >= first + old_count) {
+                previous = previous - old_count + new_count;
+            } else if (previous >= first) {
+                previous = last_edited;
+            }
+            last_edited = std::max(last_edited, previous);
+            m_first_stale_row = std::min(m_first_stale_row, first);
+        } else {
+            m_first_stale_row = first;
+        }
+        m_last_dirty_row = std::min(last_edited, m_first_unlexed_row - 1);
+    }
+
+    // The first row that has to be lexed before any row after it can be highlighted, or
+    // NONE if every row is up to date
+    size_t first_stale_row() const {
+        if (m_first_stale_row != NONE) {
+            return m_first_stale_row;
+        }
+        return m_first_unlexed_row < m_end_states.size() ? m_first_unlexed_row : NONE;
+    }
+
+    // The state row ends in, which must come before the first stale row
+    LexState end_state(size_t row) const {
+        assert(row < first_stale_row() && row < m_end_states.size());
+        return m_end_states[row];
+    }
+
+    // Lexes row, which must not come after the first stale row, and calls on_token with
+    // its tokens
+    template <typename F>
+    void highlight(size_t row, std::string_view line, F &&on_token) {
+        assert(row <= first_stale_row());
+        if (m_language == Language::NONE || row >= m_end_states.size()) {
+            return;
+        }
+        LexState state = row == 0 ? LexState::NORMAL : m_end_states[row - 1];
+        LexState end_state = Lexer::lex_line(m_language, line, state, on_token);
+        if (row == m_first_stale_row) {
+            settle(row, end_state);
+        } else if (row == m_first_unlexed_row) {
+            m_end_states[row] = end_state;
+            m_first_unlexed_row++;
+        }
+    }
+
+    // Lexes the first stale row, whose text is line, without highlighting it
+    void relex_first_stale_row(std::string_view line) {
+        assert(first_stale_row() != NONE);
+        highlight(first_stale_row(), line, [](size_t, size_t, COLOUR) {});
+    }
+
+  private:
+    // Records the end state of the first stale row and moves on past it, or stops once the
+    // edited rows are behind and the rows ahead would lex the same as before. Past the
+    // lexed rows there is nothing to compare with, so those are left to the frontier.
+    void settle(size_t row, LexState end_state) {
+        bool converged = row > m_last_dirty_row && m_end_states[row] == end_state;
+        m_end_states[row] = end_state;
+        m_first_stale_row = converged || row + 1 >= m_first_unlexed_row ? NONE : row + 1;
+    }
+};
@@ -26,72 +26,100 @@ struct TextTag {
         assert(m_end_pos >= m_start_pos);
         return m_end_pos - m_start_pos;
     }
+
+    bool operator==(TextTag const &other) const = default;
 };
 
+// A window of consecutive lines out of the buffer. Lines that sit inside a single
+// piece are views straight into the buffer's storage; only lines that straddle
+// pieces get copied, into m_joined_lines.
 struct Text {
-    std::string m_text;
+    size_t m_first_row;
+    std::vector<std::string_view> m_lines;
+    // sized up front so that the views into it never move; the strings are kept when the
+    // text is reset, so filling it again reuses their storage
+    std::vector<std::string> m_joined_lines;
+    size_t m_num_joined;
 
-    std::vector<size_t> m_line_lengths;
-    std::vector<size_t> m_line_pos;
+    Text() : m_first_row(0), m_num_joined(0) {
+    }
 
-    Text(std::string &&text, std::vector<size_t> &&line_lengths, std::vector<size_t> line_pos)
-        : m_text(std::move(text)), m_line_lengths(std::move(line_lengths)), m_line_pos(line_pos) {
+    Text(size_t first_row, size_t max_lines) : Text() {
+        reset(first_row, max_lines);
     }
 
     // remove the copy constructor and assignment operator
     // we want this to be a move only thing
     Text(Text const &) = delete;
     Text &operator=(Text const &) = delete;
+    Text(Text &&) = default;
+    Text &operator=(Text &&) = default;
     ~Text() {
     }
 
+    // Empties the window and moves it to first_row, keeping the storage it had
+    void reset(size_t first_row, size_t max_lines) {
+        m_first_row = first_row;
+        m_lines.clear();
+        m_lines.reserve(max_lines);
+        m_num_joined = 0;
+        if (m_joined_lines.size() < max_lines) {
+            m_joined_lines.resize(max_lines);
+        }
+    }
+
+    void add_line(std::string_view line) {
+        m_lines.push_back(line);
+    }
+
+    // An empty string to copy a line that straddles pieces into, before adding it with
+    // add_line
+    std::string &next_joined_line() {
+        assert(m_num_joined < m_joined_lines.size());
+        std::string &line = m_joined_lines[m_num_joined++];
+        line.clear();
+        return line;
+    }
+
+    // the buffer row of the first line in this window
+    size_t first_row() const {
+        return m_first_row;
+    }
+
+    // line_idx is relative to first_row()
     size_t line_length_at(size_t line_idx) const {
-        return m_line_lengths.at(line_idx);
+        return m_lines.at(line_idx).size();
     }
 
+    // line_idx is relative to first_row()
     std::string_view get_line_at(size_t line_idx) const {
-        size_t starting_idx = m_line_pos.at(line_idx);
-        return std::string_view{m_text.data() + starting_idx, m_line_lengths.at(line_idx)};
+        return m_lines.at(line_idx);
     }
 
     size_t num_lines() const {
-        return m_line_lengths.size();
-    }
-
-    size_t size() const {
-        return m_text.size();
+        return m_lines.size();
     }
 };
 
+// A line to draw and the tags to draw it with. The text is only a view, so whoever fills
+// the line in keeps the characters alive for as long as it's drawn from. Resetting the line
+// keeps the storage its tags had, so lines that are refilled every frame don't allocate.
 class TaggedText {
-    std::string m_text;
+    std::string_view m_text;
     std::vector<TextTag> m_tags;
 
   public:
-    TaggedText(std::string text = "") : m_text(text) {
-    }
-
-    TaggedText(std::string text, std::vector<TextTag> tags)
-        : m_text(std::move(text)), m_tags(std::move(tags)) {
+    TaggedText(std::string_view text = "") : m_text(text) {
     }
 
-    // you should be using this to get the resulting text
-    std::string_view get_text() {
-        return std::string_view{m_text};
+    // Makes this line show text, with no tags yet
+    void reset(std::string_view text) {
+        m_text = text;
+        m_tags.clear();
     }
 
-    void resize(size_t size) {
-        m_text.resize(size);
-    }
-
-    void remove_prefix(size_t size) {
-        if (size >= m_text.size()) {
-            std::string_view temp_view{m_text.begin() + size, m_text.end()};
-            m_text.clear();
-        } else {
-            std::string_view temp_view{m_text.begin() + size, m_text.end()};
-            m_text = std::string{temp_view};
-        }
+    std::string_view get_text() const {
+        return m_text;
     }
 
     TextTag &get_tag(size_t index) {
@@ -118,6 +146,9 @@ class TaggedText {
         return m_text.size();
     }
 
+    // two lines that compare equal put exactly the same thing on screen
+    bool operator==(TaggedText const &other) const = default;
+
     friend std::ostream &operator<<(std::ostream &os, TaggedText const &text) {
         os << text.m_text;
         return os;
@@ -1,32 +1,68 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include "Cursor.h"
+#include "LiteralMatcher.h"
+#include "PieceTable.h"
+#include "Regex.h"
 #include "Text.h"
+#include "TextSnapshot.h"
+#include "ThreadPool.h"
+
+// Rows [m_first_row, m_first_row + m_old_count) of the buffer were replaced by m_new_count
+// rows. A fresh buffer starts with one change that replaces everything.
+struct LineChange {
+    static constexpr size_t ALL_ROWS = SIZE_MAX;
+
+    size_t m_first_row;
+    size_t m_old_count;
+    size_t m_new_count;
+};
 
 // A class that holds the text for the text editor
 class TextBuffer {
-    std::vector<std::string> m_text_buffer;
+    // how much of the buffer find reads before checking whether it can stop
+    static constexpr size_t SEARCH_WINDOW_SIZE = 1 << 20;
+    static constexpr size_t FIRST_REGEX_WINDOW_SIZE = 1 << 12;
+    // the smallest piece of work find_all hands to a thread
+    static constexpr size_t MIN_SLICE_SIZE = 1 << 20;
+
+    PieceTable m_piece_table;
+    // every edit since take_line_changes was last called, oldest first
+    std::vector<LineChange> m_line_changes;
 
   public:
-    TextBuffer(std::string file_contents) {
-        // Don't think you need to call the move here (because it's a return value) right?
-        m_text_buffer = break_into_lines(file_contents);
+    TextBuffer(std::string contents) : m_piece_table(std::move(contents)) {
+        lines_changed(0, LineChange::ALL_ROWS, num_lines());
+    }
+
+    // The mapped file is used as the original text directly, edits are layered on top. With
+    // defer_loading the buffer starts out empty and grows as load_chunk is handed the file's
+    // contents in order.
+    TextBuffer(MappedFile file_contents, bool defer_loading = false)
+        : m_piece_table(std::move(file_contents), defer_loading) {
+        lines_changed(0, LineChange::ALL_ROWS, num_lines());
     }
 
     friend void swap(TextBuffer &a, TextBuffer &b) {
-        std::swap(a.m_text_buffer, b.m_text_buffer);
+        using std::swap;
+        swap(a.m_piece_table, b.m_piece_table);
+        swap(a.m_line_changes, b.m_line_changes);
     }
 
-    TextBuffer(TextBuffer &&other) {
-        m_text_buffer = std::move(other.m_text_buffer);
+    TextBuffer(TextBuffer &&other)
+        : m_piece_table(std::move(other.m_piece_table)), m_line_changes(std::move(other.m_line_changes)) {
     }
 
     TextBuffer &operator=(TextBuffer &&other) {
@@ -36,9 +72,9 @@ class TextBuffer {
         return *this;
     }
 
+    // An empty piece table still reports a single empty line
     TextBuffer() {
-        // Ensure the buffer has at least an empty line
-        m_text_buffer.emplace_back(std::string(""));
+        lines_changed(0, LineChange::ALL_ROWS, num_lines());
     }
 
     // Updates the cursor as it moves up
@@ -46,8 +82,7 @@ class TextBuffer {
         assert(within_bounds(cursor_point));
         if (cursor_point.row() > 0) {
             cursor_point.row()--;
-            cursor_point.col() =
-                std::min(cursor_point.original_col(), m_text_buffer.at(cursor_point.row()).size());
+            cursor_point.col() = std::min(cursor_point.original_col(), line_length(cursor_point.row()));
         } else {
             // else we must be on the top most row, in which case we move the cursor all the way left
             assert(cursor_point.row() == 0);
@@ -60,14 +95,13 @@ class TextBuffer {
     // Updates the cursor as it moves down
     void move_cursor_down(CursorPoint &cursor_point) {
         assert(within_bounds(cursor_point));
-        if (cursor_point.row() + 1 < m_text_buffer.size()) {
+        if (cursor_point.row() + 1 < num_lines()) {
             cursor_point.row()++;
-            cursor_point.col() =
-                std::min(m_text_buffer.at(cursor_point.row()).size(), cursor_point.original_col());
+            cursor_point.col() = std::min(line_length(cursor_point.row()), cursor_point.original_col());
         } else {
             // else we must be on the bottom most row, in which case we move the cursor all the way right
-            assert(cursor_point.row() + 1 == m_text_buffer.size());
-            cursor_point.col() = m_text_buffer.at(cursor_point.row()).size();
+            assert(cursor_point.row() + 1 == num_lines());
+            cursor_point.col() = line_length(cursor_point.row());
             cursor_point.reset_original_col();
         }
         assert(within_bounds(cursor_point));
@@ -82,7 +116,7 @@ class TextBuffer {
             assert(cursor_point.col() == 0);
             // we move it to the previous line if needed
             cursor_point.row()--;
-            cursor_point.col() = m_text_buffer.at(cursor_point.row()).size();
+            cursor_point.col() = line_length(cursor_point.row());
         }
         cursor_point.original_col() = cursor_point.col();
         assert(within_bounds(cursor_point));
@@ -91,10 +125,10 @@ class TextBuffer {
     // Updates the cursor as it moves right
     void move_cursor_right(CursorPoint &cursor_point) {
         assert(within_bounds(cursor_point));
-        if (cursor_point.col() + 1 <= m_text_buffer.at(cursor_point.row()).length()) {
+        size_t current_line_length = line_length(cursor_point.row());
+        if (cursor_point.col() + 1 <= current_line_length) {
             cursor_point.col()++;
-        } else if (cursor_point.col() == m_text_buffer.at(cursor_point.row()).length() &&
-                   cursor_point.row() + 1 < m_text_buffer.size()) {
+        } else if (cursor_point.col() == current_line_length && cursor_point.row() + 1 < num_lines()) {
             cursor_point.row()++;
             cursor_point.col() = 0;
         }
@@ -109,39 +143,16 @@ class TextBuffer {
         assert(!cursor.in_selection_mode());
         assert(within_bounds(cursor.active_point()));
 
-        std::vector<std::string> broken_lines = break_into_lines(to_insert);
-        assert(!broken_lines.empty());
-
-        if (broken_lines.size() == 1) {
-            // if there is only a single line then it should just hold the entirely of to_insert
-            assert(to_insert == broken_lines.at(0));
-            size_t to_insert_len = to_insert.size();
-            // push the entire line into to the current line
-            m_text_buffer.at(cursor.row()).insert(cursor.col(), std::move(to_insert));
-            // update the cursor
-            cursor.col() += to_insert_len;
+        m_piece_table.insert(offset_of(cursor.active_point()), to_insert);
+        lines_changed(cursor.row(), 1, 1 + std::count(to_insert.begin(), to_insert.end(), '\n'));
+
+        // the cursor ends up right after the inserted text
+        size_t last_newl_idx = to_insert.rfind('\n');
+        if (last_newl_idx == std::string::npos) {
+            cursor.col() += to_insert.size();
         } else {
-            // store the size the column needs to be for later
-            size_t final_column = broken_lines.back().size();
-
-            // get the second half of the line at row(), it needs to be appended to the last of broken_lines
-            std::string_view second_half_of_current_line{m_text_buffer.at(cursor.row()).cbegin() +
-                                                             cursor.col(),
-                                                         m_text_buffer.at(cursor.row()).cend()};
-            // broken_lines.back().insert(0, second_half_of_current_line);
-            broken_lines.back().append(second_half_of_current_line);
-
-            // truncate the current line at row()
-            m_text_buffer.at(cursor.row()).resize(cursor.col());
-
-            // append the first of the broken_lines
-            m_text_buffer.at(cursor.row()).append(std::move(broken_lines.at(0)));
-            // insert the rest of the broken_lines (excluding the first)
-            m_text_buffer.insert(m_text_buffer.cbegin() + cursor.row() + 1, broken_lines.begin() + 1,
-                                 broken_lines.end());
-
-            cursor.row() += broken_lines.size() - 1;
-            cursor.col() = final_column;
+            cursor.row() += std::count(to_insert.begin(), to_insert.end(), '\n');
+            cursor.col() = to_insert.size() - (last_newl_idx + 1);
         }
 
         // update the cursor
@@ -150,37 +161,108 @@ class TextBuffer {
         assert(within_bounds(cursor.active_point()));
     }
 
-    // Removes text at position specified by cursor
-    void remove_string_at(Cursor &cursor) {
+    // Removes text at position specified by cursor: the selection, or else the character
+    // before the cursor, which takes up char_length bytes if it's on the same row
+    void remove_string_at(Cursor &cursor, size_t char_length = 1) {
         assert(within_bounds(cursor.active_point()));
         assert(within_bounds(cursor.trailing_point()));
         if (cursor.in_selection_mode()) {
             remove_with_selection_mode(cursor);
         } else {
             assert(!cursor.in_selection_mode());
-            remove_without_selection_mode(cursor);
+            remove_without_selection_mode(cursor, char_length);
         }
         assert(within_bounds(cursor.active_point()));
         assert(within_bounds(cursor.trailing_point()));
     }
 
+    // Makes the next length bytes of the mapped file part of the buffer; newlines are the
+    // offsets of the '\n's in those bytes, counted from the start of the file
+    void load_chunk(size_t length, std::vector<size_t> const &newlines) {
+        size_t last_row = num_lines() - 1;
+        m_piece_table.append_original(length, newlines);
+        lines_changed(last_row, 1, num_lines() - last_row);
+    }
+
+    bool fully_loaded() const {
+        return m_piece_table.original_fully_loaded();
+    }
+
+    MappedFile const &file_mapping() const {
+        return m_piece_table.original_mapping();
+    }
+
+    // Inserts text at a byte offset, leaving cursors to the caller
+    void insert_at(size_t offset, std::string_view text) {
+        size_t row = m_piece_table.row_of(offset);
+        m_piece_table.insert(offset, text);
+        lines_changed(row, 1, 1 + std::count(text.begin(), text.end(), '\n'));
+    }
+
+    // Removes length bytes at a byte offset, leaving cursors to the caller
+    void remove_at(size_t offset, size_t length) {
+        size_t first_row = m_piece_table.row_of(offset);
+        size_t last_row = m_piece_table.row_of(offset + length);
+        m_piece_table.remove(offset, length);
+        lines_changed(first_row, last_row - first_row + 1, 1);
+    }
+
+    // Hands over the edits made since the last call, so whoever caches something per row
+    // can tell which rows to redo. They're appended to changes; both vectors keep their
+    // storage for next time.
+    void take_line_changes(std::vector<LineChange> &changes) {
+        changes.insert(changes.end(), m_line_changes.begin(), m_line_changes.end());
+        m_line_changes.clear();
+    }
+
   private:
-    void remove_without_selection_mode(Cursor &cursor) {
+    // how many bytes a and b start with in common; compared a block at a time since memcmp
+    // is much quicker than going byte by byte
+    static size_t same_prefix_length(std::string_view a, std::string_view b) {
+        constexpr size_t BLOCK = 4096;
+        size_t length = std::min(a.size(), b.size());
+        size_t pos = 0;
+        while (pos + BLOCK <= length && memcmp(a.data() + pos, b.data() + pos, BLOCK) == 0) {
+            pos += BLOCK;
+        }
+        while (pos < length && a[pos] == b[pos]) {
+            pos++;
+        }
+        return pos;
+    }
+
+    // how many bytes a and b end with in common
+    static size_t same_suffix_length(std::string_view a, std::string_view b) {
+        constexpr size_t BLOCK = 4096;
+        size_t length = std::min(a.size(), b.size());
+        char const *a_end = a.data() + a.size();
+        char const *b_end = b.data() + b.size();
+        size_t count = 0;
+        while (count + BLOCK <= length && memcmp(a_end - count - BLOCK, b_end - count - BLOCK, BLOCK) == 0) {
+            count += BLOCK;
+        }
+        while (count < length && a_end[-(ptrdiff_t)count - 1] == b_end[-(ptrdiff_t)count - 1]) {
+            count++;
+        }
+        return count;
+    }
+
+    void remove_without_selection_mode(Cursor &cursor, size_t char_length) {
         assert(!cursor.in_selection_mode());
         assert(within_bounds(cursor.active_point()));
 
         if (cursor.col() == 0 && cursor.row() > 0) {
-            // get the current string, append it to the previous string,
+            // removing the newline joins this row onto the previous one,
             // update the cursor's column in the meantime
-            cursor.col() = m_text_buffer.at(cursor.row() - 1).size();
-
-            std::string current_row = std::move(m_text_buffer.at(cursor.row()));
-            m_text_buffer.at(cursor.row() - 1).append(std::move(current_row));
-            m_text_buffer.erase(m_text_buffer.begin() + cursor.row());
+            lines_changed(cursor.row() - 1, 2, 1);
+            cursor.col() = line_length(cursor.row() - 1);
             cursor.row()--;
+            m_piece_table.remove(offset_of(cursor.active_point()), 1);
         } else if (cursor.col() > 0) {
-            m_text_buffer.at(cursor.row()).erase(cursor.col() - 1, 1);
-            cursor.col()--;
+            assert(char_length <= cursor.col());
+            lines_changed(cursor.row(), 1, 1);
+            cursor.col() -= char_length;
+            m_piece_table.remove(offset_of(cursor.active_point()), char_length);
         }
         cursor.reset_original_col();
         cursor.reset_trailing_point();
@@ -201,31 +283,11 @@ class TextBuffer {
         assert(left_point.row() < right_point.row() ||
                ((left_point.row() == right_point.row()) && left_point.col() < right_point.col()));
 
-        if (left_point.row() == right_point.row()) {
-            assert(left_point.col() < right_point.col());
-
-            // erase the portion of the string that's in between
-            auto line_it = m_text_buffer.at(left_point.row()).cbegin();
-            m_text_buffer.at(left_point.row()).erase(line_it + left_point.col(), line_it + right_point.col());
-
-        } else {
-            assert(left_point.row() < right_point.row());
-            assert(right_point.row() < m_text_buffer.size());
-
-            // truncate the highest row
-            m_text_buffer.at(left_point.row()).resize(left_point.col());
-
-            // get the tail end of the last line
-            std::string_view tail_end{m_text_buffer.at(right_point.row()).begin() + right_point.col(),
-                                      m_text_buffer.at(right_point.row()).end()};
-
-            // append the tail end to the highest row
-            m_text_buffer.at(left_point.row()).append(tail_end);
-
-            // remove all the lines in after this one (including the row that right_point is sitting on)
-            auto row_it = m_text_buffer.cbegin();
-            m_text_buffer.erase(row_it + left_point.row() + 1, row_it + right_point.row() + 1);
-        }
+        // the selection is one contiguous range of the document regardless of how many rows it spans
+        size_t left_offset = offset_of(left_point);
+        size_t right_offset = offset_of(right_point);
+        m_piece_table.remove(left_offset, right_offset - left_offset);
+        lines_changed(left_point.row(), right_point.row() - left_point.row() + 1, 1);
 
         // update the cursor by bringing it back to the left_point
         cursor.reset_to_point(left_point);
@@ -240,32 +302,45 @@ class TextBuffer {
 
     // Returns the entire contents of the text buffer as a single string
     std::string get_as_string() const {
-        assert(!m_text_buffer.empty());
-        std::string view_string{""};
-        for (std::string const &line : m_text_buffer) {
-            view_string += line;
-            view_string += "\n";
-        }
-        // remove the last newl
-        view_string.pop_back();
-        return view_string;
+        return m_piece_table.to_string();
+    }
+
+    // Views of the buffer's contents in order, one per piece; nothing is copied, so the
+    // views are only good until the next edit
+    std::vector<std::string_view> get_chunks() const {
+        std::vector<std::string_view> chunks;
+        m_piece_table.for_each_chunk(0, size(), [&](std::string_view chunk) { chunks.push_back(chunk); });
+        return chunks;
+    }
+
+    // The buffer's pieces as they are now, to be read on another thread while editing goes on
+    TextSnapshot get_snapshot() const {
+        std::vector<SnapshotChunk> chunks;
+        m_piece_table.for_each_piece_text([&](std::string_view text, size_t line_feeds) {
+            chunks.push_back(SnapshotChunk{text, line_feeds});
+        });
+        return TextSnapshot{std::move(chunks)};
+    }
+
+    // Copies out length bytes starting at offset
+    std::string substr(size_t offset, size_t length) const {
+        return m_piece_table.substr(offset, length);
     }
 
     // Returns the line indexed at line_idx as a single string
     std::string get_line_as_string(size_t line_idx) const {
-        return m_text_buffer.at(line_idx);
+        return m_piece_table.line_at(line_idx);
     }
 
-    // Returns the line indexed at line_idx as a single string_view
-    std::string_view get_line_as_string_view(size_t line_idx) const {
-        return m_text_buffer.at(line_idx);
+    // The same, written over line so that its storage gets reused
+    void get_line_as_string(size_t line_idx, std::string &line) const {
+        m_piece_table.line_at(line_idx, line);
     }
 
     // Returns the portion of the text specified by the cursor as a single string
     std::string get_string_selected_by(Cursor const &cursor) const {
         // check that the cursor is in selection mode so we should be returning a non-empty string
-        assert(!cursor.in_selection_mode());
-        std::string built_string{""};
+        assert(cursor.in_selection_mode());
 
         std::pair<CursorPoint const &, CursorPoint const &> c_point_pair = cursor.get_const_points_in_order();
         CursorPoint const &left_point = c_point_pair.first;
@@ -274,98 +349,366 @@ class TextBuffer {
         assert(left_point.row() < right_point.row() ||
                ((left_point.row() == right_point.row()) && left_point.col() < right_point.col()));
 
-        if (left_point.row() == right_point.row()) {
-            assert(left_point.col() < right_point.col());
-            std::string const &relevant_line = m_text_buffer.at(left_point.row());
-            built_string.append(relevant_line.substr(left_point.col(), right_point.col() - left_point.col()));
-        } else {
-            // append the tail end of the uppermost row
-            std::string const &relevant_line = m_text_buffer.at(left_point.row());
-            built_string.append(relevant_line.substr(left_point.col(), std::string::npos));
-            built_string.append("\n");
-            // append all the lines in between (and skip the first one)
-            for (size_t line_idx = left_point.row() + 1; line_idx < right_point.row(); ++line_idx) {
-                built_string.append(m_text_buffer.at(line_idx));
-                built_string.append("\n");
-            }
+        size_t left_offset = offset_of(left_point);
+        return m_piece_table.substr(left_offset, offset_of(right_point) - left_offset);
+    }
 
-            // append the head end of the lowest row
-            std::string_view truncated{m_text_buffer.at(right_point.row()).data(), right_point.col()};
-            built_string.append(truncated);
+    // Offset of the first match of matcher at or after from, including matches that run
+    // across pieces. The buffer is read a window at a time and the search stops at the
+    // first window with a match, so a hit near from comes back at once even in a huge file.
+    std::optional<size_t> find(LiteralMatcher const &matcher, size_t from) const {
+        std::optional<size_t> found;
+        for (size_t window = from; window < size() && !found.has_value(); window += SEARCH_WINDOW_SIZE) {
+            size_t window_end = std::min(window + SEARCH_WINDOW_SIZE, size());
+            for_each_match(matcher, window, window_end, [&](size_t offset) {
+                found = offset;
+                return false;
+            });
         }
-        return built_string;
+        return found;
     }
 
-    Text get_text() const {
-        std::string view_string{""};
-        std::vector<size_t> line_lengths;
-        std::vector<size_t> line_pos;
+    // The first match of regex that starts at or after from. The search DFA runs straight
+    // over the pieces a window at a time, like the literal find, except that the windows
+    // start small and double, as find-next tends to want a match close by. The line it
+    // finds a match in is then read again in place to pin down where exactly the match is.
+    std::optional<RegexMatch> find(Regex const &regex, size_t from) const {
+        size_t row = m_piece_table.row_of(from);
+        size_t line_start = m_piece_table.line_start(row);
+        Regex::ScanState state = regex.scan_start(from == line_start);
+        std::optional<size_t> found_row;
+        size_t window_size = FIRST_REGEX_WINDOW_SIZE;
+        for (size_t window = from; window < size() && !found_row.has_value(); window += window_size) {
+            window_size = std::min(2 * window_size, SEARCH_WINDOW_SIZE);
+            size_t window_length = std::min(window_size, size() - window);
+            m_piece_table.for_each_chunk(window, window_length, [&](std::string_view chunk) {
+                while (!found_row.has_value()) {
+                    size_t newl_idx = chunk.find('\n');
+                    bool at_line_end = newl_idx != std::string_view::npos;
+                    if (regex.scan(state, chunk.substr(0, newl_idx), at_line_end)) {
+                        found_row = row;
+                        return;
+                    }
+                    if (!at_line_end) {
+                        return;
+                    }
+                    row++;
+                    state = regex.scan_start(true);
+                    chunk.remove_prefix(newl_idx + 1);
+                }
+            });
+        }
+        // the last line has no newline to end it
+        if (!found_row.has_value() && regex.scan(state, "", true)) {
+            found_row = row;
+        }
+        if (!found_row.has_value()) {
+            return std::nullopt;
+        }
 
-        line_lengths.reserve(m_text_buffer.size());
-        line_pos.reserve(m_text_buffer.size());
+        line_start = m_piece_table.line_start(*found_row);
+        std::vector<std::string_view> line_chunks;
+        m_piece_table.for_each_chunk(line_start, m_piece_table.line_length(*found_row),
+                                     [&](std::string_view chunk) { line_chunks.push_back(chunk); });
+        std::optional<RegexMatch> match = regex.find(line_chunks, std::max(from, line_start) - line_start);
+        assert(match.has_value());
+        match->m_offset += line_start;
+        return match;
+    }
 
-        line_pos.push_back(0);
-        for (size_t idx = 0; idx < m_text_buffer.size(); idx++) {
-            view_string += m_text_buffer.at(idx);
-            view_string += "\n";
-            line_lengths.push_back(m_text_buffer.at(idx).size());
-            line_pos.push_back(view_string.size());
+    // Offsets of every match, leftmost first and without overlaps, the same ones repeated
+    // calls to find would give. The buffer is cut into slices that are scanned on pool;
+    // each slice reports every match that starts inside it, so matches that run into the
+    // next slice are still found, and overlaps are resolved once the slices are joined.
+    std::vector<size_t> find_all(LiteralMatcher const &matcher, ThreadPool &pool) const {
+        size_t slice_size = std::max(MIN_SLICE_SIZE, size() / (pool.size() * 4) + 1);
+        size_t num_slices = (size() + slice_size - 1) / slice_size;
+        std::vector<std::vector<size_t>> slice_matches(num_slices);
+        pool.parallel_for(num_slices, [&](size_t slice) {
+            size_t begin = slice * slice_size;
+            for_each_match(matcher, begin, std::min(begin + slice_size, size()), [&](size_t offset) {
+                slice_matches[slice].push_back(offset);
+                return true;
+            });
+        });
+
+        std::vector<size_t> matches;
+        size_t previous_end = 0;
+        for (std::vector<size_t> const &offsets : slice_matches) {
+            for (size_t offset : offsets) {
+                if (offset >= previous_end) {
+                    matches.push_back(offset);
+                    previous_end = offset + matcher.size();
+                }
+            }
         }
-        // remove the last "\n"
-        view_string.pop_back();
-        // remove the last line length
-        line_pos.pop_back();
+        return matches;
+    }
 
-        return Text{std::move(view_string), std::move(line_lengths), std::move(line_pos)};
+    // Replaces match_length bytes at each of offsets (from find_all) with replacement in
+    // a single rebuild of the buffer
+    void replace_all(std::vector<size_t> const &offsets, size_t match_length, std::string_view replacement) {
+        if (offsets.empty()) {
+            return;
+        }
+        size_t first_row = m_piece_table.row_of(offsets.front());
+        size_t old_count = m_piece_table.row_of(offsets.back() + match_length) - first_row + 1;
+        size_t old_num_lines = num_lines();
+        m_piece_table.replace_all(offsets, match_length, replacement);
+        lines_changed(first_row, old_count, old_count + num_lines() - old_num_lines);
     }
 
-  private:
-    std::vector<std::string_view> get_line_views(std::string const &str) {
-        assert(!str.empty());
-        std::string_view str_view{str};
-        std::vector<std::string_view> line_views;
-        do {
-            size_t newl_idx = str_view.find_first_of("\n");
-            if (newl_idx == std::string::npos) {
-                line_views.push_back(str_view);
-                break;
-            }
-            line_views.push_back(std::string_view{str_view.data(), newl_idx});
-            str_view.remove_prefix(newl_idx + 1);
-            if (str_view.empty()) {
-                // if it's empty right after removing, it ended on a newline
-                // so we need to append one more string
-                line_views.push_back("");
+    // How many bytes at the start of the buffer are the same as at the start of text
+    size_t common_prefix_with(std::string_view text) const {
+        size_t length = 0;
+        bool stopped = false;
+        m_piece_table.for_each_chunk(0, std::min(size(), text.size()), [&](std::string_view chunk) {
+            if (stopped) {
+                return;
             }
-        } while (!str_view.empty());
-        return line_views;
-    }
-
-    // to be fair since construction requires copying there might not be a
-    // real need to use moves here
-    std::vector<std::string> break_into_lines(std::string const &str) {
-        assert(!str.empty());
-        std::string_view str_view{str};
-        std::vector<std::string> lines;
-        while (!str_view.empty()) {
-            size_t newl_idx = str_view.find_first_of("\n");
-            if (newl_idx == std::string::npos) {
-                lines.push_back(std::string{str_view});
+            size_t same = same_prefix_length(chunk, text.substr(length));
+            length += same;
+            stopped = same < chunk.size();
+        });
+        return length;
+    }
+
+    // How many bytes at the end of the buffer are the same as at the end of text, without
+    // going into the first skip bytes of either
+    size_t common_suffix_with(std::string_view text, size_t skip) const {
+        size_t limit = std::min(size(), text.size()) - std::min({size(), text.size(), skip});
+        std::vector<std::string_view> chunks;
+        m_piece_table.for_each_chunk(size() - limit, limit,
+                                     [&](std::string_view chunk) { chunks.push_back(chunk); });
+        size_t length = 0;
+        for (auto it = chunks.rbegin(); it != chunks.rend(); ++it) {
+            size_t same = same_suffix_length(*it, text.substr(0, text.size() - length));
+            length += same;
+            if (same < it->size()) {
                 break;
             }
-            lines.push_back(std::string{std::string_view{str_view.data(), newl_idx}});
-            str_view.remove_prefix(newl_idx + 1);
-            if (str_view.empty()) {
-                // if it's empty right after removing, it ended on a newline
-                // so we need to append one more string
-                lines.push_back("");
+        }
+        return length;
+    }
+
+    // Replaces each of ranges (sorted and not overlapping) with replacement in a single
+    // rebuild of the buffer, leaving cursors to the caller
+    void replace_ranges(std::vector<TextRange> const &ranges, std::string_view replacement) {
+        if (ranges.empty()) {
+            return;
+        }
+        size_t first_row = m_piece_table.row_of(ranges.front().m_offset);
+        size_t last_row = m_piece_table.row_of(ranges.back().m_offset + ranges.back().m_length);
+        size_t old_count = last_row - first_row + 1;
+        size_t old_num_lines = num_lines();
+        m_piece_table.replace_ranges(ranges, replacement);
+        lines_changed(first_row, old_count, old_count + num_lines() - old_num_lines);
+    }
+
+    // The same with a replacement of its own for each range
+    void replace_ranges(std::vector<TextRange> const &ranges,
+                        std::vector<std::string_view> const &replacements) {
+        if (ranges.empty()) {
+            return;
+        }
+        size_t first_row = m_piece_table.row_of(ranges.front().m_offset);
+        size_t last_row = m_piece_table.row_of(ranges.back().m_offset + ranges.back().m_length);
+        size_t old_count = last_row - first_row + 1;
+        size_t old_num_lines = num_lines();
+        m_piece_table.replace_ranges(ranges, replacements);
+        lines_changed(first_row, old_count, old_count + num_lines() - old_num_lines);
+    }
+
+    // Returns up to count lines starting at first_row. Only the bytes of those lines are
+    // visited, so the cost depends on how much is asked for rather than on the file size.
+    Text get_lines(size_t first_row, size_t count) const {
+        Text text;
+        get_lines(first_row, count, text);
+        return text;
+    }
+
+    // The same, filling in text in place of whatever it held; a Text that's filled every
+    // frame reuses its storage instead of allocating it again
+    void get_lines(size_t first_row, size_t count, Text &text) const {
+        if (first_row >= num_lines() || count == 0) {
+            text.reset(first_row, 0);
+            return;
+        }
+        text.reset(first_row, std::min(count, num_lines() - first_row));
+        size_t last_row = std::min(first_row + count, num_lines()) - 1;
+        size_t begin = m_piece_table.line_start(first_row);
+        size_t end = m_piece_table.line_start(last_row) + line_length(last_row);
+
+        // the line currently being read; it only gets copied into joined if it turns out to
+        // run across a chunk boundary
+        std::string_view pending;
+        std::string *joined = nullptr;
+        bool has_pending = false;
+        size_t expected = last_row - first_row + 1;
+        m_piece_table.for_each_chunk(begin, end - begin, [&](std::string_view chunk) {
+            while (text.num_lines() < expected) {
+                size_t newl_idx = chunk.find('\n');
+                if (newl_idx == std::string_view::npos) {
+                    if (has_pending) {
+                        if (joined == nullptr) {
+                            joined = &text.next_joined_line();
+                            joined->assign(pending);
+                        }
+                        joined->append(chunk);
+                    } else {
+                        pending = chunk;
+                        has_pending = true;
+                    }
+                    return;
+                }
+
+                std::string_view line = chunk.substr(0, newl_idx);
+                if (has_pending) {
+                    if (joined == nullptr) {
+                        joined = &text.next_joined_line();
+                        joined->assign(pending);
+                    }
+                    joined->append(line);
+                    text.add_line(*joined);
+                    joined = nullptr;
+                    has_pending = false;
+                } else {
+                    text.add_line(line);
+                }
+                chunk.remove_prefix(newl_idx + 1);
             }
+        });
+
+        // the last line has no newline inside the range, so it is still pending (or empty)
+        if (text.num_lines() < expected && joined != nullptr) {
+            text.add_line(*joined);
+        } else if (text.num_lines() < expected && has_pending) {
+            text.add_line(pending);
+        }
+        // the newlines only disagree with the index when the file changed under our mapping
+        // (see MappingGuard); the rows still come out whole until it has been loaded again
+        while (text.num_lines() < expected) {
+            text.add_line("");
         }
-        return lines;
+    }
+
+    size_t num_lines() const {
+        return m_piece_table.num_lines();
+    }
+
+    size_t line_length(size_t line_idx) const {
+        return m_piece_table.line_length(line_idx);
+    }
+
+    // Total number of bytes in the buffer
+    size_t size() const {
+        return m_piece_table.size();
+    }
+
+    // Converts a (row, col) point into a byte offset into the buffer, in O(log n)
+    size_t offset_of(CursorPoint const &cursor_point) const {
+        assert(within_bounds(cursor_point));
+        return m_piece_table.line_start(cursor_point.row()) + cursor_point.col();
+    }
+
+    // Converts a byte offset into a (row, col) point, in O(log n)
+    CursorPoint point_at(size_t offset) const {
+        size_t row = m_piece_table.row_of(offset);
+        size_t col = offset - m_piece_table.line_start(row);
+        return CursorPoint{row, col, col};
+    }
+
+    // Converts points, in any order, into byte offsets with one walk over the buffer, for
+    // when there are too many for offset_of each
+    std::vector<size_t> offsets_of(std::vector<CursorPoint> const &points) const {
+        std::vector<size_t> rows;
+        rows.reserve(points.size());
+        for (CursorPoint const &point : points) {
+            rows.push_back(point.row());
+        }
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+        std::vector<size_t> starts = m_piece_table.line_starts(rows);
+
+        std::vector<size_t> offsets;
+        offsets.reserve(points.size());
+        for (CursorPoint const &point : points) {
+            assert(within_bounds(point));
+            size_t idx = std::lower_bound(rows.begin(), rows.end(), point.row()) - rows.begin();
+            offsets.push_back(starts[idx] + point.col());
+        }
+        return offsets;
+    }
+
+    // Converts sorted byte offsets into points with one walk over the buffer
+    std::vector<CursorPoint> points_at(std::vector<size_t> const &offsets) const {
+        std::vector<size_t> rows = m_piece_table.rows_of(offsets);
+        std::vector<size_t> starts = m_piece_table.line_starts(rows);
+        std::vector<CursorPoint> points;
+        points.reserve(offsets.size());
+        for (size_t idx = 0; idx < offsets.size(); ++idx) {
+            size_t col = offsets[idx] - starts[idx];
+            points.push_back(CursorPoint{rows[idx], col, col});
+        }
+        return points;
+    }
+
+  private:
+    void lines_changed(size_t first_row, size_t old_count, size_t new_count) {
+        m_line_changes.push_back(LineChange{first_row, old_count, new_count});
     }
 
     bool within_bounds(CursorPoint const &cursor_point) const {
-        return (cursor_point.row() >= 0 && cursor_point.row() < m_text_buffer.size()) &&
-               (cursor_point.col() >= 0 && cursor_point.col() <= m_text_buffer.at(cursor_point.row()).size());
+        return cursor_point.row() < num_lines() && cursor_point.col() <= line_length(cursor_point.row());
+    }
+
+    // Calls on_match with the offset of every match starting in [begin, end), overlapping
+    // ones included, in order, until it returns false. Reads up to size() - 1 bytes past
+    // end so matches that start inside the range but finish after it are seen whole.
+    template <typename F>
+    void for_each_match(LiteralMatcher const &matcher, size_t begin, size_t end, F &&on_match) const {
+        // a match can start in the last overlap bytes of one chunk and end in the next
+        size_t overlap = matcher.size() - 1;
+        size_t read_end = std::min(end + overlap, size());
+        // both reserved once and reused for every chunk boundary
+        std::string carry;
+        std::string joined;
+        carry.reserve(overlap);
+        joined.reserve(2 * overlap);
+        size_t chunk_offset = begin;
+        bool stopped = false;
+        auto report = [&](size_t offset) {
+            stopped = offset >= end || !on_match(offset);
+            return !stopped;
+        };
+        m_piece_table.for_each_chunk(begin, read_end - begin, [&](std::string_view chunk) {
+            if (stopped) {
+                return;
+            }
+            if (!carry.empty()) {
+                joined.assign(carry);
+                joined.append(chunk.substr(0, overlap));
+                for (size_t idx = matcher.find(joined); idx != std::string::npos && idx < carry.size();
+                     idx = matcher.find(joined, idx + 1)) {
+                    if (!report(chunk_offset - carry.size() + idx)) {
+                        return;
+                    }
+                }
+            }
+            for (size_t idx = matcher.find(chunk); idx != std::string_view::npos;
+                 idx = matcher.find(chunk, idx + 1)) {
+                if (!report(chunk_offset + idx)) {
+                    return;
+                }
+            }
+
+            if (chunk.size() >= overlap) {
+                carry.assign(chunk.substr(chunk.size() - overlap));
+            } else {
+                carry.append(chunk);
+                carry.erase(0, carry.size() - std::min(carry.size(), overlap));
+            }
+            chunk_offset += chunk.size();
+        });
     }
 };
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One piece of a snapshot, along with how many '\n' it holds
+struct SnapshotChunk {
+    std::string_view m_text;
+    size_t m_line_feeds;
+};
+
+// The contents of a TextBuffer as of one moment, for reading on another thread. Like the
+// chunks FileSaver writes out, these are views into storage that edits never move or
+// overwrite, so later edits don't disturb the snapshot; the buffer itself must outlive it.
+class TextSnapshot {
+    std::vector<SnapshotChunk> m_chunks;
+    // how many newlines come before each chunk
+    std::vector<size_t> m_line_feeds_before;
+    size_t m_num_lines;
+
+  public:
+    TextSnapshot() : m_num_lines(1) {
+    }
+
+    TextSnapshot(std::vector<SnapshotChunk> chunks) : m_chunks(std::move(chunks)), m_num_lines(1) {
+        m_line_feeds_before.reserve(m_chunks.size());
+        for (SnapshotChunk const &chunk : m_chunks) {
+            m_line_feeds_before.push_back(m_num_lines - 1);
+            m_num_lines += chunk.m_line_feeds;
+        }
+    }
+
+    size_t num_lines() const {
+        return m_num_lines;
+    }
+
+    // Calls fn(row, line) for first_row and every row after it, until fn returns false or
+    // the text runs out. Finding first_row is a binary search over the chunks plus a scan
+    // of the one it starts in; after that each line is read once. Lines that straddle
+    // chunks are copied, the rest are views into the chunks.
+    template <typename F>
+    void for_each_line(size_t first_row, F &&fn) const {
+        if (first_row >= m_num_lines) {
+            return;
+        }
+        size_t chunk_idx = 0;
+        size_t pos = 0;
+        if (first_row > 0) {
+            // the chunk holding the newline that ends the row before first_row
+            std::vector<size_t> const &before = m_line_feeds_before;
+            chunk_idx = std::upper_bound(before.begin(), before.end(), first_row - 1) - before.begin() - 1;
+            std::string_view text = m_chunks[chunk_idx].m_text;
+            for (size_t skip = first_row - m_line_feeds_before[chunk_idx]; skip > 0; --skip) {
+                pos = text.find('\n', pos) + 1;
+                assert(pos != 0);
+            }
+        }
+
+        std::string joined;
+        size_t row = first_row;
+        for (; chunk_idx < m_chunks.size(); ++chunk_idx, pos = 0) {
+            std::string_view text = m_chunks[chunk_idx].m_text;
+            size_t newline = text.find('\n', pos);
+            for (; newline != std::string_view::npos; newline = text.find('\n', pos)) {
+                std::string_view line = text.substr(pos, newline - pos);
+                if (!joined.empty()) {
+                    joined.append(line);
+                    line = joined;
+                }
+                if (!fn(row, line)) {
+                    return;
+                }
+                joined.clear();
+                row++;
+                pos = newline + 1;
+            }
+            joined.append(text.substr(pos));
+        }
+        // the last row has no newline after it
+        fn(row, std::string_view{joined});
+    }
+};
@@ -11,12 +11,28 @@
 #include "Model.h"
 #include "Text.h"
 #include "TextAttribute.h"
+#include "Tracer.h"
+#include "Utf8.h"
 #include "ViewModel.h"
 #include "WindowBorder.h"
 
+// What one row of the window shows. The frame's TaggedText only has a view of its text,
+// which doesn't outlive the frame, so the row keeps a copy; the copy's storage is reused
+// from one frame to the next.
+struct WindowRow {
+    std::string m_text;
+    std::vector<TextTag> m_tags;
+
+    bool shows(TaggedText const &line) const {
+        return m_text == line.get_text() && m_tags == line.get_tags();
+    }
+};
+
 struct TextWindow {
     WINDOW *m_window_ptr;
-    std::vector<TaggedText> m_lines;
+    std::vector<WindowRow> m_lines;
+    // rows whose contents differ from what is currently on the screen
+    std::vector<bool> m_dirty_rows;
     // left_boundary
     size_t m_left_boundary;
     // height of the screen
@@ -32,39 +48,92 @@ struct TextWindow {
     TextWindow(WINDOW *window_ptr, size_t num_rows, size_t num_cols, size_t left_boundary)
         : m_window_ptr(window_ptr), m_left_boundary(left_boundary), m_num_rows(num_rows),
           m_num_cols(num_cols) {
-        for (size_t row = 0; row < m_num_rows; row++) {
-            m_lines.push_back(std::string(""));
+        m_lines.resize(m_num_rows);
+        // nothing has been drawn yet, so the first render has to draw everything
+        m_dirty_rows.assign(m_num_rows, true);
+        // lets ncurses scroll the terminal itself when the rows have just moved up or down
+        idlok(m_window_ptr, TRUE);
+    }
+
+    // Moves what's on the screen up by lines rows, or down if it's negative, for a view that
+    // has scrolled by that much. The rows that stay on screen don't get drawn again, so
+    // following the end of a growing file only draws the rows that came into view.
+    void scroll_by(long lines) {
+        size_t count = lines < 0 ? -lines : lines;
+        if (count == 0 || count >= m_num_rows) {
+            return;
+        }
+        // only our rows move, not the status bar below them
+        wsetscrreg(m_window_ptr, 0, m_num_rows - 1);
+        scrollok(m_window_ptr, TRUE);
+        wscrl(m_window_ptr, lines);
+        // left on, writing to the bottom right corner would scroll the window too
+        scrollok(m_window_ptr, FALSE);
+        wsetscrreg(m_window_ptr, 0, getmaxy(m_window_ptr) - 1);
+
+        size_t first_blank = lines > 0 ? m_num_rows - count : 0;
+        if (lines > 0) {
+            std::rotate(m_lines.begin(), m_lines.begin() + count, m_lines.end());
+            std::rotate(m_dirty_rows.begin(), m_dirty_rows.begin() + count, m_dirty_rows.end());
+        } else {
+            std::rotate(m_lines.begin(), m_lines.end() - count, m_lines.end());
+            std::rotate(m_dirty_rows.begin(), m_dirty_rows.end() - count, m_dirty_rows.end());
+        }
+        // the rows that scrolled in are blank on the screen, whatever they held before
+        for (size_t row_idx = first_blank; row_idx < first_blank + count; ++row_idx) {
+            m_lines[row_idx].m_text.clear();
+            m_lines[row_idx].m_tags.clear();
+            m_dirty_rows[row_idx] = true;
         }
     }
 
-    void update(std::vector<TaggedText> &&new_contents) {
+    // Takes the next frame's rows, remembering which of them actually changed
+    void update(std::vector<TaggedText> const &new_contents) {
         assert(new_contents.size() == m_num_rows);
-        m_lines.clear();
-        m_lines = std::move(new_contents);
+        for (size_t row_idx = 0; row_idx < m_num_rows; row_idx++) {
+            WindowRow &row = m_lines.at(row_idx);
+            TaggedText const &line = new_contents.at(row_idx);
+            if (!row.shows(line)) {
+                row.m_text.assign(line.get_text());
+                row.m_tags.assign(line.get_tags().begin(), line.get_tags().end());
+                m_dirty_rows.at(row_idx) = true;
+            }
+        }
     }
 
+    // Redraws only the rows that changed since the last render
     void render() {
-        // should this be shifted into update?
-        // then render just calls the rendering stuff;
+        ScopedTrace trace{TraceStage::RENDER};
         assert(m_lines.size() == m_num_rows);
-        // clear the current screen
-        werase(m_window_ptr);
-
-        // get a "string_view" for each row and place it onto the screen
-        for (size_t row_idx = 0; row_idx < m_num_rows; row_idx++) {
-            mvwaddstr(m_window_ptr, row_idx, 0, m_lines.at(row_idx).get_text().data());
-        }
 
-        // place the attributes on the screen
         wstandend(m_window_ptr);
+        bool drew_anything = false;
         for (size_t row_idx = 0; row_idx < m_num_rows; row_idx++) {
-            for (TextTag const &tag : m_lines.at(row_idx).get_tags()) {
-                mvwchgat(m_window_ptr, row_idx, tag.m_start_pos, tag.length(), (attr_t)tag.m_attribute,
-                         (short)tag.m_colour, NULL);
+            if (!m_dirty_rows.at(row_idx)) {
+                continue;
             }
+            render_row(row_idx);
+            m_dirty_rows.at(row_idx) = false;
+            drew_anything = true;
         }
 
-        wrefresh(m_window_ptr);
+        if (drew_anything) {
+            wrefresh(m_window_ptr);
+        }
+    }
+
+    // Overwrites a single row in place, clearing whatever the old contents left behind
+    void render_row(size_t row_idx) {
+        std::string const &text = m_lines.at(row_idx).m_text;
+        wmove(m_window_ptr, row_idx, 0);
+        wclrtoeol(m_window_ptr);
+        waddnstr(m_window_ptr, text.data(), text.size());
+
+        // place the attributes on the row
+        for (TextTag const &tag : m_lines.at(row_idx).m_tags) {
+            mvwchgat(m_window_ptr, row_idx, tag.m_start_pos, tag.length(), (attr_t)tag.m_attribute,
+                     (short)tag.m_colour, NULL);
+        }
     }
 
     size_t height() const {
@@ -72,20 +141,30 @@ struct TextWindow {
     }
 
     size_t get_line_length_at(size_t index) const {
-        return m_lines.at(index).size();
+        return m_lines.at(index).m_text.size();
     }
 };
 
 // The driver class that drives the TextWindow class
 class TextWidget {
-    ViewModel const *m_view_model;
+    ViewModel *m_view_model;
     TextWindow m_text_window;
     WindowBorder m_text_window_border;
+    // the top of the view while word wrap is on. It's kept as a row and segment rather
+    // than a visual line, since rows above it can still get wrapped and push its line down.
+    VisualPosition m_wrapped_top;
+    // the next frame's rows, one per row of the window. They're views into the prepared
+    // rows or, for rows that can't be drawn as they are, into m_visible_text; like the
+    // segment starts they're refilled each frame so their storage gets reused.
+    std::vector<TaggedText> m_frame_lines;
+    std::vector<std::string> m_visible_text;
+    std::vector<size_t> m_segment_starts;
 
   public:
-    TextWidget(ViewModel const *view_model, WINDOW *main_window_ptr, int height, int width)
+    TextWidget(ViewModel *view_model, WINDOW *main_window_ptr, int height, int width)
         : m_view_model(view_model), m_text_window(main_window_ptr, height, width),
-          m_text_window_border(height, width) {
+          m_text_window_border(height, width), m_wrapped_top{0, 0}, m_frame_lines(height),
+          m_visible_text(height) {
     }
 
     ~TextWidget() {
@@ -99,64 +178,185 @@ class TextWidget {
         m_text_window.render();
     }
 
+    // Everything gets drawn again at the new size
+    void resize(int height, int width) {
+        m_text_window = TextWindow(m_text_window.m_window_ptr, height, width);
+        m_text_window_border.resize(height, width);
+        m_frame_lines.resize(height);
+        m_visible_text.resize(height);
+    }
+
     void update_state() {
+        ScopedTrace trace{TraceStage::UPDATE_STATE};
 
         // get the cursor
         Cursor cursor = m_view_model->get_cursor();
 
-        // update the window to "chase the cursor"
-        m_text_window_border.chase_point(cursor.row(), cursor.col());
-
-        // get the relevant strings within the rows of the current border
-        std::vector<TaggedText> lines_in_window;
-        lines_in_window.reserve(m_text_window_border.height());
-        for (size_t row_idx = m_text_window_border.starting_row();
-             row_idx < (size_t)m_text_window_border.ending_row() && row_idx < m_view_model->num_lines();
-             ++row_idx) {
-            lines_in_window.push_back(m_view_model->get_tagged_line_at(row_idx));
-        }
-        // pad it so that we have the correct amount
-        while (lines_in_window.size() < m_text_window.height()) {
-            lines_in_window.push_back(TaggedText{});
-        }
-
-        // cut out the text based on the box
-        auto cut_out_line = [](TaggedText &line_to_cut, WindowBorder const &window_border) {
-            // cut the line off the text if needed; implemented in an absolutely disgusting way
-            std::string_view line_view = line_to_cut.get_text();
-            if (line_view.size() >= (size_t)window_border.starting_row()) {
-                line_to_cut.remove_prefix(window_border.starting_col());
-                line_to_cut.resize(window_border.width());
+        if (m_view_model->word_wrap()) {
+            fill_wrapped_lines(cursor.active_point());
+            m_text_window.update(m_frame_lines);
+            return;
+        }
+
+        // update the window to "chase the cursor"; it scrolls sideways by screen columns,
+        // which lines with wide or multi-byte characters in them have fewer of than bytes
+        int old_first_row = m_text_window_border.starting_row();
+        int old_first_column = m_text_window_border.starting_col();
+        m_text_window_border.chase_point(cursor.row(), m_view_model->cursor_column());
+        if (m_text_window_border.starting_col() == old_first_column) {
+            m_text_window.scroll_by(m_text_window_border.starting_row() - old_first_row);
+        }
+
+        // only the rows within the current border need preparing
+        m_view_model->prepare_view_data(m_text_window_border.starting_row(), m_text_window_border.height());
+
+        // cut the columns within the current border out of each row
+        size_t first_column = m_text_window_border.starting_col();
+        size_t end_column = m_text_window_border.ending_col();
+        size_t window_row = 0;
+        for (; window_row < m_view_model->num_lines() && window_row < m_text_window.height(); ++window_row) {
+            TaggedText const &line = m_view_model->get_const_tagged_line_at(window_row);
+            LineColumns const &columns = m_view_model->get_line_columns_at(window_row);
+            slice_line(line, columns, first_column, end_column, end_column, window_row);
+        }
+        // blank out the rest so that we have the correct amount
+        for (; window_row < m_text_window.height(); ++window_row) {
+            m_frame_lines[window_row].reset("");
+        }
+
+        // move the altered text into the text window
+        m_text_window.update(m_frame_lines);
+    }
+
+  private:
+    // With word wrap on each row takes up as many screen rows as it needs, and the view
+    // scrolls down through those instead of sideways. Only the rows on screen, and the ones
+    // just above the cursor that decide where the top goes when following it down, are
+    // wrapped here; the rest of the file is left until it's looked at.
+    void fill_wrapped_lines(CursorPoint const &cursor_point) {
+        size_t height = m_text_window.height();
+        size_t width = m_text_window_border.width();
+        if (height == 0) {
+            return;
+        }
+        m_view_model->set_wrap_width(width);
+        m_view_model->measure_rows(m_wrapped_top.m_row, height);
+        m_view_model->measure_rows(cursor_point.row() - std::min(cursor_point.row(), height - 1), height);
+
+        // chase the cursor
+        size_t cursor_line = m_view_model->visual_line_of(cursor_point);
+        size_t old_top_line = m_view_model->visual_line_of(m_wrapped_top);
+        size_t top_line = old_top_line;
+        if (cursor_line < top_line) {
+            top_line = cursor_line;
+        } else if (cursor_line >= top_line + height) {
+            top_line = cursor_line + 1 - height;
+        }
+        m_text_window.scroll_by((long)top_line - (long)old_top_line);
+        m_wrapped_top = m_view_model->visual_position_at(top_line);
+
+        // every row takes at least one line, so this many rows always fill the screen
+        m_view_model->prepare_view_data(m_wrapped_top.m_row, height);
+        size_t window_row = 0;
+        for (size_t row_idx = 0; row_idx < m_view_model->num_lines() && window_row < height; ++row_idx) {
+            TaggedText const &line = m_view_model->get_const_tagged_line_at(row_idx);
+            LineColumns const &columns = m_view_model->get_line_columns_at(row_idx);
+            std::vector<size_t> &starts = m_segment_starts;
+            WrapLayout::segment_starts(line.get_text(), columns, width, starts);
+            size_t segment = row_idx == 0 ? m_wrapped_top.m_segment : 0;
+            for (; segment < starts.size() && window_row < height; ++segment, ++window_row) {
+                bool is_last = segment + 1 == starts.size();
+                size_t start = columns.column_of(starts[segment]);
+                size_t end = is_last ? columns.width() : columns.column_of(starts[segment + 1]);
+                // the cursor can sit just past the end of a row's last segment
+                slice_line(line, columns, start, end, is_last ? start + width : end, window_row);
+            }
+        }
+        for (; window_row < height; ++window_row) {
+            m_frame_lines[window_row].reset("");
+        }
+    }
+
+    // Makes window_row show screen columns [first_column, end_column) of line, with its tags
+    // moved from bytes to the columns they cover and cut down to match; they may carry on
+    // past the end of the text up to limit. ASCII rows are sliced as they are, since their
+    // bytes are columns, unless there are control characters to clean up in what's shown.
+    void slice_line(TaggedText const &line, LineColumns const &columns, size_t first_column,
+                    size_t end_column, size_t limit, size_t window_row) {
+        std::string_view text = line.get_text();
+        TaggedText &slice = m_frame_lines[window_row];
+        if (columns.is_ascii()) {
+            size_t start = std::min(first_column, text.size());
+            std::string_view shown = text.substr(start, end_column - start);
+            if (std::none_of(shown.begin(), shown.end(), is_control_byte)) {
+                slice.reset(shown);
             } else {
-                line_view = "";
+                std::string &visible = m_visible_text[window_row];
+                visible_ascii_text(shown, visible);
+                slice.reset(visible);
             }
+        } else {
+            std::string &visible = m_visible_text[window_row];
+            visible_text(text, columns, first_column, end_column, visible);
+            slice.reset(visible);
+        }
 
-            // now we need to cut the tags too
-            for (TextTag &tag : line_to_cut.get_tags()) {
-                if (tag.m_start_pos > (size_t)window_border.ending_col() ||
-                    tag.m_end_pos < (size_t)window_border.starting_col()) {
-                    // if the tag is either too far left or too far right; just 'delete' it
-                    tag.m_end_pos = tag.m_start_pos;
-                } else {
-                    assert(tag.m_start_pos <= (size_t)window_border.ending_col() &&
-                           tag.m_end_pos >= (size_t)window_border.starting_col());
+        for (TextTag const &tag : line.get_tags()) {
+            size_t tag_start = std::max(columns.column_of(tag.m_start_pos), first_column);
+            size_t tag_end = std::min(columns.end_column_of(tag.m_end_pos), limit);
+            if (tag_start < tag_end) {
+                slice.add_tag(TextTag{tag_start - first_column, tag_end - first_column, tag.m_colour, tag.m_attribute});
+            }
+        }
+    }
 
-                    // shrink them down so that they're within the range of the cut if necessary
-                    tag.m_start_pos = std::max(tag.m_start_pos, (size_t)window_border.starting_col());
-                    tag.m_end_pos = std::min(tag.m_end_pos, (size_t)window_border.ending_col());
+    // Left to ncurses, a tab would jump to the next tab stop and a control character would
+    // be drawn as ^X, two columns, so neither would stay in the one column it has
+    static bool is_control_byte(char c) {
+        return (unsigned char)c < 0x20 || c == 0x7f;
+    }
 
-                    // shift them left
-                    tag.m_start_pos -= window_border.starting_col();
-                    tag.m_end_pos -= window_border.starting_col();
-                }
+    // An ASCII row's text cleaned up the way visible_text does it, written over visible
+    static void visible_ascii_text(std::string_view text, std::string &visible) {
+        visible.clear();
+        for (char c : text) {
+            if (c == '\t') {
+                visible.push_back(' ');
+            } else if (is_control_byte(c)) {
+                visible.append("\xef\xbf\xbd");
+            } else {
+                visible.push_back(c);
             }
-        };
-
-        for (TaggedText &line : lines_in_window) {
-            cut_out_line(line, m_text_window_border);
         }
+    }
 
-        // move the altered text into the text window
-        m_text_window.update(std::move(lines_in_window));
+    // What to draw over columns [first_column, end_column) of a line that isn't all ASCII.
+    // Everything has to take up exactly the columns LineColumns says it does, so a wide
+    // character cut in half by the edge of the view is drawn as spaces, a tab as a single
+    // space, and bytes that aren't valid UTF-8 and other control characters as U+FFFD.
+    // The result is written over visible.
+    static void visible_text(std::string_view text, LineColumns const &columns, size_t first_column,
+                             size_t end_column, std::string &visible) {
+        visible.clear();
+        columns.for_each_char(first_column, end_column, [&](size_t start, size_t end, size_t column,
+                                                            size_t char_end_column) {
+            if (column < first_column || char_end_column > end_column) {
+                visible.append(std::min(char_end_column, end_column) - std::max(column, first_column), ' ');
+                return;
+            }
+            for (size_t pos = start; pos < end;) {
+                size_t length;
+                char32_t code_point = Utf8::decode(text, pos, length);
+                bool is_control = code_point < 0x20 || (code_point >= 0x7f && code_point < 0xa0);
+                if (code_point == '\t') {
+                    visible.push_back(' ');
+                } else if (is_control || (code_point == Utf8::REPLACEMENT && length == 1)) {
+                    visible.append("\xef\xbf\xbd");
+                } else {
+                    visible.append(text.substr(pos, length));
+                }
+                pos += length;
+            }
+        });
     }
-};
\ No newline at end of file
+};
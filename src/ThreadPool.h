@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for splitting one big job (e.g. scanning the whole buffer)
+// into slices. The threads sleep until parallel_for hands them work.
+class ThreadPool {
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_task_ready;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_stopping;
+
+  public:
+    ThreadPool(size_t num_threads = std::max(1u, std::thread::hardware_concurrency())) : m_stopping(false) {
+        for (size_t idx = 0; idx < num_threads; ++idx) {
+            m_workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stopping = true;
+        }
+        m_task_ready.notify_all();
+        for (std::thread &worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool &operator=(ThreadPool const &) = delete;
+    ThreadPool(ThreadPool &&) = delete;
+    ThreadPool &operator=(ThreadPool &&) = delete;
+
+    size_t size() const {
+        return m_workers.size();
+    }
+
+    // Runs fn(idx) for every idx in [0, count) across the workers and returns once they have
+    // all finished
+    template <typename F>
+    void parallel_for(size_t count, F &&fn) {
+        if (count == 0) {
+            return;
+        }
+        std::mutex done_mutex;
+        std::condition_variable all_done;
+        size_t remaining = count;
+        {
+            std::lock_guard lock{m_mutex};
+            for (size_t idx = 0; idx < count; ++idx) {
+                m_tasks.push_back([&, idx]() {
+                    fn(idx);
+                    std::lock_guard done_lock{done_mutex};
+                    if (--remaining == 0) {
+                        all_done.notify_one();
+                    }
+                });
+            }
+        }
+        m_task_ready.notify_all();
+
+        std::unique_lock done_lock{done_mutex};
+        all_done.wait(done_lock, [&]() { return remaining == 0; });
+    }
+
+  private:
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock{m_mutex};
+                m_task_ready.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+                if (m_tasks.empty()) {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
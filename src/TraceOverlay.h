@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <ncurses.h>
+#include <string>
+#include <vector>
+
+#include "ViewModel.h"
+
+// A small box in the top right corner showing where the previous frame's time went. It
+// lives in its own window on top of the text, so hiding it only needs the main window to
+// be pushed out to the screen again.
+class TraceOverlay {
+    static constexpr int WIDTH = 34;
+
+    ViewModel const *m_view_model;
+    WINDOW *m_main_window_ptr;
+    WINDOW *m_window_ptr;
+    std::vector<std::string> m_lines;
+    bool m_shown;
+    bool m_was_shown;
+
+  public:
+    TraceOverlay(ViewModel const *view_model, WINDOW *main_window_ptr, int height, int width)
+        : m_view_model(view_model), m_main_window_ptr(main_window_ptr), m_window_ptr(NULL), m_shown(false),
+          m_was_shown(false) {
+        resize(height, width);
+    }
+
+    ~TraceOverlay() {
+        if (m_window_ptr != NULL) {
+            delwin(m_window_ptr);
+        }
+    }
+
+    TraceOverlay(TraceOverlay const &) = delete;
+    TraceOverlay &operator=(TraceOverlay const &) = delete;
+    TraceOverlay(TraceOverlay &&) = delete;
+    TraceOverlay &operator=(TraceOverlay &&) = delete;
+
+    // Puts the box back in the top right corner of a screen of the new size
+    void resize(int height, int width) {
+        if (m_window_ptr != NULL) {
+            delwin(m_window_ptr);
+        }
+        int overlay_width = std::min(WIDTH, width);
+        int overlay_height = std::min((int)TraceStage::NUM_STAGES + 2, height);
+        m_window_ptr = newwin(overlay_height, overlay_width, 0, width - overlay_width);
+    }
+
+    void update_state() {
+        m_shown = m_view_model->trace_overlay_shown();
+        if (m_shown) {
+            m_view_model->get_trace_overlay_lines(m_lines);
+        }
+    }
+
+    void render() {
+        if (m_window_ptr == NULL) {
+            return;
+        }
+        if (m_shown) {
+            werase(m_window_ptr);
+            wattron(m_window_ptr, A_REVERSE);
+            int height = getmaxy(m_window_ptr);
+            for (int row = 0; row < height && row < (int)m_lines.size(); ++row) {
+                mvwaddnstr(m_window_ptr, row, 0, m_lines[row].data(), m_lines[row].size());
+            }
+            wattroff(m_window_ptr, A_REVERSE);
+            // the main window may have drawn over us since the last frame
+            touchwin(m_window_ptr);
+            wrefresh(m_window_ptr);
+        } else if (m_was_shown) {
+            touchwin(m_main_window_ptr);
+            wrefresh(m_main_window_ptr);
+        }
+        m_was_shown = m_shown;
+    }
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bumped by the operator new in allocation_counter.cpp, which the editor and the benchmarks
+// link; stays at 0 in programs that don't
+inline std::atomic<size_t> allocation_count{0};
+
+// The parts of a frame that get timed
+enum class TraceStage {
+    WAIT,
+    HANDLE_KEY,
+    PREPARE_VIEW_DATA,
+    UPDATE_STATE,
+    RENDER,
+    NUM_STAGES,
+};
+
+struct TraceEvent {
+    TraceStage m_stage;
+    uint64_t m_frame;
+    // nanoseconds since the tracer started
+    uint64_t m_start_ns;
+    uint64_t m_duration_ns;
+};
+
+// Where the time in one pass of the main loop went
+struct FrameSummary {
+    uint64_t m_frame;
+    std::array<uint64_t, (size_t)TraceStage::NUM_STAGES> m_stage_ns;
+    size_t m_allocations;
+};
+
+// Keeps the most recent trace events in a fixed ring that is never resized, so recording
+// an event is two clock reads and a store. Old events are overwritten once the ring wraps.
+// It's single threaded, like the frame it times: only the main thread records into it or
+// reads it, so nothing in it is locked or atomic. Debug builds check that it stays that way.
+class Tracer {
+    static constexpr size_t CAPACITY = 1 << 16;
+
+    using clock = std::chrono::steady_clock;
+    clock::time_point m_epoch;
+    std::vector<TraceEvent> m_events;
+    // total events ever recorded; the next one goes in m_events[m_next % CAPACITY]
+    uint64_t m_next;
+
+    uint64_t m_frame;
+    FrameSummary m_current_frame;
+    FrameSummary m_last_frame;
+    size_t m_frame_start_allocations;
+    // the thread that made the tracer, the only one that may write to it
+    std::thread::id m_owner;
+
+    Tracer()
+        : m_epoch(clock::now()), m_events(CAPACITY), m_next(0), m_frame(0), m_current_frame{},
+          m_last_frame{}, m_owner(std::this_thread::get_id()) {
+        m_frame_start_allocations = allocation_count;
+    }
+
+  public:
+    Tracer(Tracer const &) = delete;
+    Tracer &operator=(Tracer const &) = delete;
+
+    // The tracer the main loop and the view record into
+    static Tracer &global() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    static char const *stage_name(TraceStage stage) {
+        switch (stage) {
+        case TraceStage::WAIT:
+            return "wait";
+        case TraceStage::HANDLE_KEY:
+            return "handle_key";
+        case TraceStage::PREPARE_VIEW_DATA:
+            return "prepare_view_data";
+        case TraceStage::UPDATE_STATE:
+            return "update_state";
+        case TraceStage::RENDER:
+            return "render";
+        case TraceStage::NUM_STAGES:
+            break;
+        }
+        return "unknown";
+    }
+
+    uint64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_epoch).count();
+    }
+
+    // Finishes the current frame, making it the one last_frame reports
+    void begin_frame() {
+        assert(std::this_thread::get_id() == m_owner);
+        size_t allocations = allocation_count;
+        m_current_frame.m_frame = m_frame;
+        m_current_frame.m_allocations = allocations - m_frame_start_allocations;
+        m_last_frame = m_current_frame;
+
+        m_frame++;
+        m_current_frame = FrameSummary{};
+        m_frame_start_allocations = allocations;
+    }
+
+    void record(TraceStage stage, uint64_t start_ns, uint64_t end_ns) {
+        assert(std::this_thread::get_id() == m_owner);
+        m_events[m_next++ % CAPACITY] = TraceEvent{stage, m_frame, start_ns, end_ns - start_ns};
+        m_current_frame.m_stage_ns[(size_t)stage] += end_ns - start_ns;
+    }
+
+    FrameSummary const &last_frame() const {
+        return m_last_frame;
+    }
+
+    // Writes the events still in the ring out in the Chrome trace event format, which
+    // chrome://tracing and Perfetto can open
+    bool write_chrome_trace(std::string const &pathname) const {
+        FILE *file = fopen(pathname.c_str(), "w");
+        if (file == NULL) {
+            std::cerr << "Tracer: could not open " << pathname << " to write the trace to." << std::endl;
+            return false;
+        }
+        uint64_t end = m_next;
+        uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+        fprintf(file, "{\"traceEvents\":[");
+        for (uint64_t idx = begin; idx < end; ++idx) {
+            TraceEvent const &event = m_events[idx % CAPACITY];
+            fprintf(file,
+                    "%s\n{\"name\":\"%s\",\"cat\":\"elditor\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"frame\":%llu}}",
+                    idx == begin ? "" : ",", stage_name(event.m_stage), event.m_start_ns / 1e3,
+                    event.m_duration_ns / 1e3, (unsigned long long)event.m_frame);
+        }
+        fprintf(file, "\n]}\n");
+        return fclose(file) == 0;
+    }
+};
+
+// Records the time between its construction and destruction as one event
+class ScopedTrace {
+    TraceStage m_stage;
+    uint64_t m_start_ns;
+
+  public:
+    ScopedTrace(TraceStage stage) : m_stage(stage), m_start_ns(Tracer::global().now_ns()) {
+    }
+
+    ~ScopedTrace() {
+        Tracer &tracer = Tracer::global();
+        tracer.record(m_stage, m_start_ns, tracer.now_ns());
+    }
+
+    ScopedTrace(ScopedTrace const &) = delete;
+    ScopedTrace &operator=(ScopedTrace const &) = delete;
+};
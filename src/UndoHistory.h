@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cassert>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Cursor.h"
+
+enum class EditType {
+    INSERT,
+    REMOVE,
+};
+
+// One change to the buffer, stored as what changed rather than as a copy of the buffer
+struct EditRecord {
+    EditType m_type;
+    // where in the buffer the text was inserted or removed from
+    size_t m_offset;
+    std::string m_text;
+
+    size_t end_offset() const {
+        return m_offset + m_text.size();
+    }
+};
+
+// Records that get undone and redone together, along with where the cursor was
+// on either side of them
+struct EditGroup {
+    std::vector<EditRecord> m_edits;
+    Cursor m_cursor_before;
+    Cursor m_cursor_after;
+    // the extra cursors on either side, for edits made at every cursor at once
+    std::vector<Cursor> m_extra_cursors_before = {};
+    std::vector<Cursor> m_extra_cursors_after = {};
+    // set for an edit made at every cursor in one go. Its records go a range at a time, in
+    // order: the text the range held, if any, removed, then the text typed over it, if any,
+    // inserted, each at the offset the range had once the ranges before it were done. Undo
+    // and redo put all the ranges back in one go too.
+    bool m_at_all_cursors = false;
+
+    size_t memory_used() const {
+        size_t used = sizeof(EditGroup);
+        used += (m_extra_cursors_before.size() + m_extra_cursors_after.size()) * sizeof(Cursor);
+        for (EditRecord const &edit : m_edits) {
+            used += sizeof(EditRecord) + edit.m_text.size();
+        }
+        return used;
+    }
+};
+
+// Keeps the edits that can be undone and redone. Consecutive keystrokes that type or
+// delete one character next to the previous one are folded into the same group, and
+// the oldest groups are dropped once the history grows past its memory limit.
+class UndoHistory {
+    std::deque<EditGroup> m_undo_stack;
+    std::vector<EditGroup> m_redo_stack;
+    // whether the newest group on m_undo_stack may still absorb more keystrokes
+    bool m_newest_group_open;
+    size_t m_memory_limit;
+    size_t m_memory_used;
+
+  public:
+    // the editor's cap unless ELDITOR_UNDO_MEMORY_MB sets another
+    static constexpr size_t DEFAULT_MEMORY_LIMIT = 64 * 1024 * 1024;
+
+    UndoHistory(size_t memory_limit = DEFAULT_MEMORY_LIMIT)
+        : m_newest_group_open(false), m_memory_limit(memory_limit), m_memory_used(0) {
+    }
+
+    // Records an edit that was just applied to the buffer. A keystroke edit is folded
+    // into the previous group when it continues it.
+    void record(EditRecord edit, Cursor const &cursor_before, Cursor const &cursor_after, bool is_keystroke) {
+        clear_redo();
+
+        if (is_keystroke && continues_newest_group(edit)) {
+            EditGroup &group = m_undo_stack.back();
+            m_memory_used -= group.memory_used();
+            EditRecord &last = group.m_edits.back();
+            if (edit.m_type == EditType::INSERT) {
+                last.m_text.append(edit.m_text);
+            } else {
+                // backspacing walks leftwards, so the removed text grows at the front
+                last.m_text.insert(0, edit.m_text);
+                last.m_offset = edit.m_offset;
+            }
+            group.m_cursor_after = cursor_after;
+            m_memory_used += group.memory_used();
+        } else {
+            EditGroup group{{std::move(edit)}, cursor_before, cursor_after};
+            m_memory_used += group.memory_used();
+            m_undo_stack.push_back(std::move(group));
+        }
+
+        // newlines end a group so that undo steps back a line of typing at a time
+        EditRecord const &last = m_undo_stack.back().m_edits.back();
+        m_newest_group_open = is_keystroke && last.m_text.find('\n') == std::string::npos;
+
+        enforce_memory_limit();
+    }
+
+    // Adds an edit to the newest group as a separate step, e.g. the text typed over a
+    // selection that was just removed
+    void append_to_newest_group(EditRecord edit, Cursor const &cursor_after, bool is_keystroke) {
+        assert(!m_undo_stack.empty());
+        EditGroup &group = m_undo_stack.back();
+        m_memory_used -= group.memory_used();
+        group.m_edits.push_back(std::move(edit));
+        group.m_cursor_after = cursor_after;
+        m_memory_used += group.memory_used();
+        m_newest_group_open = is_keystroke && group.m_edits.back().m_text.find('\n') == std::string::npos;
+        enforce_memory_limit();
+    }
+
+    // Records a group of edits that were applied together, e.g. by a replace-all
+    void record_group(EditGroup group) {
+        clear_redo();
+        m_memory_used += group.memory_used();
+        m_undo_stack.push_back(std::move(group));
+        m_newest_group_open = false;
+        enforce_memory_limit();
+    }
+
+    // Stops the next keystroke from joining the newest group, e.g. after the cursor moves
+    void close_group() {
+        m_newest_group_open = false;
+    }
+
+    // Hands back the newest group for the caller to revert, or nullptr if there is none; it
+    // moves onto the redo stack, where the pointer stays good until the history next changes
+    EditGroup const *undo() {
+        if (m_undo_stack.empty()) {
+            return nullptr;
+        }
+        m_redo_stack.push_back(std::move(m_undo_stack.back()));
+        m_undo_stack.pop_back();
+        m_newest_group_open = false;
+        return &m_redo_stack.back();
+    }
+
+    // Hands back the most recently undone group for the caller to reapply, the same way
+    EditGroup const *redo() {
+        if (m_redo_stack.empty()) {
+            return nullptr;
+        }
+        m_undo_stack.push_back(std::move(m_redo_stack.back()));
+        m_redo_stack.pop_back();
+        m_newest_group_open = false;
+        return &m_undo_stack.back();
+    }
+
+    void set_memory_limit(size_t memory_limit) {
+        m_memory_limit = memory_limit;
+        enforce_memory_limit();
+    }
+
+    void clear() {
+        m_undo_stack.clear();
+        m_redo_stack.clear();
+        m_newest_group_open = false;
+        m_memory_used = 0;
+    }
+
+    size_t memory_used() const {
+        return m_memory_used;
+    }
+
+  private:
+    bool continues_newest_group(EditRecord const &edit) const {
+        if (!m_newest_group_open || m_undo_stack.empty()) {
+            return false;
+        }
+        EditRecord const &last = m_undo_stack.back().m_edits.back();
+        if (last.m_type != edit.m_type) {
+            return false;
+        }
+        if (edit.m_type == EditType::INSERT) {
+            return edit.m_offset == last.end_offset();
+        }
+        // a backspace removes the character right before the previous removal
+        return edit.end_offset() == last.m_offset;
+    }
+
+    void clear_redo() {
+        for (EditGroup const &group : m_redo_stack) {
+            m_memory_used -= group.memory_used();
+        }
+        m_redo_stack.clear();
+    }
+
+    // Drops the oldest groups until we fit; redo entries are the first to go
+    void enforce_memory_limit() {
+        if (m_memory_used > m_memory_limit) {
+            clear_redo();
+        }
+        while (m_memory_used > m_memory_limit && !m_undo_stack.empty()) {
+            m_memory_used -= m_undo_stack.front().memory_used();
+            m_undo_stack.pop_front();
+        }
+        if (m_undo_stack.empty()) {
+            m_newest_group_open = false;
+        }
+    }
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ELDITOR_X86_SIMD 1
+#endif
+
+// Decoding UTF-8 and working out how much of the screen it takes up. Text that is all ASCII
+// needs none of this, since every byte is then one column; is_ascii tells the two apart
+// 16 (SSE2) or 32 (AVX2) bytes at a time.
+class Utf8 {
+  public:
+    enum class Method {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    // what bytes that don't decode to anything are shown as
+    static constexpr char32_t REPLACEMENT = 0xfffd;
+    static constexpr char32_t ZERO_WIDTH_JOINER = 0x200d;
+
+    // The fastest method this CPU supports, checked once
+    static Method best_method() {
+        static Method const method = detect_method();
+        return method;
+    }
+
+    // Whether every byte of text is below 0x80
+    static bool is_ascii(std::string_view text) {
+        return is_ascii(text, best_method());
+    }
+
+    static bool is_ascii(std::string_view text, Method method) {
+        switch (method) {
+#ifdef ELDITOR_X86_SIMD
+        case Method::AVX2:
+            return is_ascii_avx2(text.data(), text.size());
+        case Method::SSE2:
+            return is_ascii_sse2(text.data(), text.size());
+#endif
+        default:
+            return is_ascii_scalar(text.data(), text.size());
+        }
+    }
+
+    // Decodes the code point starting at text[pos] and sets length to how many bytes it
+    // takes up. Bytes that aren't valid UTF-8 (stray continuation bytes, overlong forms,
+    // surrogates, sequences cut short) decode as REPLACEMENT one byte at a time.
+    static char32_t decode(std::string_view text, size_t pos, size_t &length) {
+        unsigned char lead = text[pos];
+        length = 1;
+        if (lead < 0x80) {
+            return lead;
+        }
+        size_t expected;
+        char32_t code_point;
+        char32_t min_code_point;
+        if ((lead & 0xe0) == 0xc0) {
+            expected = 2;
+            code_point = lead & 0x1f;
+            min_code_point = 0x80;
+        } else if ((lead & 0xf0) == 0xe0) {
+            expected = 3;
+            code_point = lead & 0x0f;
+            min_code_point = 0x800;
+        } else if ((lead & 0xf8) == 0xf0) {
+            expected = 4;
+            code_point = lead & 0x07;
+            min_code_point = 0x10000;
+        } else {
+            return REPLACEMENT;
+        }
+        if (text.size() - pos < expected) {
+            return REPLACEMENT;
+        }
+        for (size_t idx = 1; idx < expected; ++idx) {
+            unsigned char byte = text[pos + idx];
+            if ((byte & 0xc0) != 0x80) {
+                return REPLACEMENT;
+            }
+            code_point = (code_point << 6) | (byte & 0x3f);
+        }
+        bool is_surrogate = code_point >= 0xd800 && code_point <= 0xdfff;
+        if (code_point < min_code_point || code_point > 0x10ffff || is_surrogate) {
+            return REPLACEMENT;
+        }
+        length = expected;
+        return code_point;
+    }
+
+    // How many columns code_point takes up: 0 for combining marks and other characters
+    // that are drawn over the one before, 2 for East Asian wide and fullwidth characters
+    // (CJK, Hangul, kana, most emoji), 1 for everything else
+    static size_t width(char32_t code_point) {
+        if (code_point < 0x300) {
+            return 1;
+        }
+        if (in_ranges(ZERO_WIDTH, code_point)) {
+            return 0;
+        }
+        if (code_point >= 0x1100 && in_ranges(WIDE, code_point)) {
+            return 2;
+        }
+        return 1;
+    }
+
+    // Whether code_point always belongs with the one before it, e.g. a combining accent, a
+    // variation selector or an emoji skin tone
+    static bool extends_previous(char32_t code_point) {
+        return width(code_point) == 0 || (code_point >= 0x1f3fb && code_point <= 0x1f3ff);
+    }
+
+    static bool is_regional_indicator(char32_t code_point) {
+        return code_point >= 0x1f1e6 && code_point <= 0x1f1ff;
+    }
+
+    static char const *method_name(Method method) {
+        switch (method) {
+        case Method::SCALAR:
+            return "scalar";
+        case Method::SSE2:
+            return "sse2";
+        case Method::AVX2:
+            return "avx2";
+        }
+        return "unknown";
+    }
+
+  private:
+    struct Range {
+        char32_t m_first;
+        char32_t m_last;
+    };
+
+    // sorted, inclusive; Mn, Me and Cf characters from the scripts people are likely to
+    // edit, plus the Hangul medial vowels and final consonants that join onto a syllable
+    static constexpr Range ZERO_WIDTH[] = {
+        {0x0300, 0x036f},   {0x0483, 0x0489},   {0x0591, 0x05bd},   {0x05bf, 0x05bf},   {0x05c1, 0x05c2},
+        {0x05c4, 0x05c5},   {0x05c7, 0x05c7},   {0x0610, 0x061a},   {0x061c, 0x061c},   {0x064b, 0x065f},
+        {0x0670, 0x0670},   {0x06d6, 0x06dc},   {0x06df, 0x06e4},   {0x06e7, 0x06e8},   {0x06ea, 0x06ed},
+        {0x0711, 0x0711},   {0x0730, 0x074a},   {0x07a6, 0x07b0},   {0x07eb, 0x07f3},   {0x0816, 0x082d},
+        {0x0859, 0x085b},   {0x08d3, 0x0902},   {0x093a, 0x093a},   {0x093c, 0x093c},   {0x0941, 0x0948},
+        {0x094d, 0x094d},   {0x0951, 0x0957},   {0x0962, 0x0963},   {0x0981, 0x0981},   {0x09bc, 0x09bc},
+        {0x09c1, 0x09c4},   {0x09cd, 0x09cd},   {0x09e2, 0x09e3},   {0x0a01, 0x0a02},   {0x0a3c, 0x0a51},
+        {0x0a70, 0x0a71},   {0x0a81, 0x0a82},   {0x0abc, 0x0abc},   {0x0ac1, 0x0acd},   {0x0b01, 0x0b01},
+        {0x0b3c, 0x0b3c},   {0x0bcd, 0x0bcd},   {0x0c3e, 0x0c56},   {0x0e31, 0x0e31},   {0x0e34, 0x0e3a},
+        {0x0e47, 0x0e4e},   {0x0eb1, 0x0eb1},   {0x0eb4, 0x0ebc},   {0x0ec8, 0x0ecd},   {0x0f71, 0x0f84},
+        {0x1160, 0x11ff},   {0x1ab0, 0x1aff},   {0x1dc0, 0x1dff},   {0x200b, 0x200f},   {0x202a, 0x202e},
+        {0x2060, 0x2064},   {0x20d0, 0x20ff},   {0x302a, 0x302d},   {0x3099, 0x309a},   {0xfe00, 0xfe0f},
+        {0xfe20, 0xfe2f},   {0xfeff, 0xfeff},   {0x1d167, 0x1d169}, {0x1d173, 0x1d182}, {0xe0001, 0xe0001},
+        {0xe0020, 0xe007f}, {0xe0100, 0xe01ef},
+    };
+
+    // sorted, inclusive; the W and F ranges of Unicode's EastAsianWidth.txt
+    static constexpr Range WIDE[] = {
+        {0x1100, 0x115f},   {0x231a, 0x231b},   {0x2329, 0x232a},   {0x23e9, 0x23ec},   {0x23f0, 0x23f0},
+        {0x23f3, 0x23f3},   {0x25fd, 0x25fe},   {0x2614, 0x2615},   {0x2648, 0x2653},   {0x267f, 0x267f},
+        {0x2693, 0x2693},   {0x26a1, 0x26a1},   {0x26aa, 0x26ab},   {0x26bd, 0x26be},   {0x26c4, 0x26c5},
+        {0x26ce, 0x26ce},   {0x26d4, 0x26d4},   {0x26ea, 0x26ea},   {0x26f2, 0x26f3},   {0x26f5, 0x26f5},
+        {0x26fa, 0x26fa},   {0x26fd, 0x26fd},   {0x2705, 0x2705},   {0x270a, 0x270b},   {0x2728, 0x2728},
+        {0x274c, 0x274c},   {0x274e, 0x274e},   {0x2753, 0x2755},   {0x2757, 0x2757},   {0x2795, 0x2797},
+        {0x27b0, 0x27b0},   {0x27bf, 0x27bf},   {0x2b1b, 0x2b1c},   {0x2b50, 0x2b50},   {0x2b55, 0x2b55},
+        {0x2e80, 0x3029},   {0x302e, 0x303e},   {0x3041, 0x3098},   {0x309b, 0x33ff},   {0x3400, 0x4dbf},
+        {0x4e00, 0xa4cf},   {0xa960, 0xa97f},   {0xac00, 0xd7a3},   {0xf900, 0xfaff},   {0xfe10, 0xfe19},
+        {0xfe30, 0xfe6f},   {0xff00, 0xff60},   {0xffe0, 0xffe6},   {0x16fe0, 0x16fe4}, {0x17000, 0x18cff},
+        {0x1b000, 0x1b2ff}, {0x1f004, 0x1f004}, {0x1f0cf, 0x1f0cf}, {0x1f18e, 0x1f18e}, {0x1f191, 0x1f19a},
+        {0x1f200, 0x1f251}, {0x1f260, 0x1f265}, {0x1f300, 0x1f320}, {0x1f32d, 0x1f335}, {0x1f337, 0x1f37c},
+        {0x1f37e, 0x1f393}, {0x1f3a0, 0x1f3ca}, {0x1f3cf, 0x1f3d3}, {0x1f3e0, 0x1f3f0}, {0x1f3f4, 0x1f3f4},
+        {0x1f3f8, 0x1f43e}, {0x1f440, 0x1f440}, {0x1f442, 0x1f4fc}, {0x1f4ff, 0x1f53d}, {0x1f54b, 0x1f54e},
+        {0x1f550, 0x1f567}, {0x1f57a, 0x1f57a}, {0x1f595, 0x1f596}, {0x1f5a4, 0x1f5a4}, {0x1f5fb, 0x1f64f},
+        {0x1f680, 0x1f6c5}, {0x1f6cc, 0x1f6cc}, {0x1f6d0, 0x1f6d2}, {0x1f6d5, 0x1f6d7}, {0x1f6dc, 0x1f6df},
+        {0x1f6eb, 0x1f6ec}, {0x1f6f4, 0x1f6fc}, {0x1f7e0, 0x1f7eb}, {0x1f7f0, 0x1f7f0}, {0x1f90c, 0x1f93a},
+        {0x1f93c, 0x1f945}, {0x1f947, 0x1f9ff}, {0x1fa70, 0x1faff}, {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+    };
+
+    template <size_t N>
+    static bool in_ranges(Range const (&ranges)[N], char32_t code_point) {
+        auto it = std::upper_bound(std::begin(ranges), std::end(ranges), code_point,
+                                   [](char32_t value, Range const &range) { return value < range.m_first; });
+        return it != std::begin(ranges) && code_point <= std::prev(it)->m_last;
+    }
+
+    static Method detect_method() {
+#ifdef ELDITOR_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return Method::AVX2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return Method::SSE2;
+        }
+#endif
+        return Method::SCALAR;
+    }
+
+    // eight bytes at a time, testing all their top bits with one mask
+    static bool is_ascii_scalar(char const *data, size_t size) {
+        size_t idx = 0;
+        uint64_t high_bits = 0;
+        for (; idx + 8 <= size; idx += 8) {
+            uint64_t word;
+            memcpy(&word, data + idx, 8);
+            high_bits |= word;
+        }
+        for (; idx < size; ++idx) {
+            high_bits |= (unsigned char)data[idx];
+        }
+        return (high_bits & 0x8080808080808080ull) == 0;
+    }
+
+#ifdef ELDITOR_X86_SIMD
+    // movemask collects the top bit of every byte, which is all there is to check
+    __attribute__((target("sse2"))) static bool is_ascii_sse2(char const *data, size_t size) {
+        size_t idx = 0;
+        for (; idx + 64 <= size; idx += 64) {
+            __m128i block = _mm_or_si128(
+                _mm_or_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(data + idx)),
+                             _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + idx + 16))),
+                _mm_or_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(data + idx + 32)),
+                             _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + idx + 48))));
+            if (_mm_movemask_epi8(block) != 0) {
+                return false;
+            }
+        }
+        for (; idx + 16 <= size; idx += 16) {
+            if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(data + idx))) != 0) {
+                return false;
+            }
+        }
+        return is_ascii_scalar(data + idx, size - idx);
+    }
+
+    __attribute__((target("avx2"))) static bool is_ascii_avx2(char const *data, size_t size) {
+        size_t idx = 0;
+        for (; idx + 128 <= size; idx += 128) {
+            __m256i block = _mm256_or_si256(
+                _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx)),
+                                _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx + 32))),
+                _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx + 64)),
+                                _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx + 96))));
+            if (_mm256_movemask_epi8(block) != 0) {
+                return false;
+            }
+        }
+        for (; idx + 32 <= size; idx += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + idx));
+            if (_mm256_movemask_epi8(block) != 0) {
+                return false;
+            }
+        }
+        return is_ascii_sse2(data + idx, size - idx);
+    }
+#endif
+};
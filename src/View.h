@@ -1,13 +1,16 @@
 #pragma once
 #include <cassert>
+#include <clocale>
 #include <curses.h>
 #include <ncurses.h>
 #include <utility>
 
 #include "Colours.h"
 #include "Model.h"
+#include "StatusBar.h"
 #include "Text.h"
 #include "TextWidget.h"
+#include "TraceOverlay.h"
 #include "ViewModel.h"
 
 // Serves as the driver for the entire view. For now let's keep it at a simple
@@ -15,11 +18,28 @@
 //  rendered drives the entire rendering logic
 class View {
     // ViewModel const *m_view_model;
+    WINDOW *m_window_ptr;
+    int m_height;
+    int m_width;
     TextWidget m_text_widget;
+    StatusBar m_status_bar;
+    TraceOverlay m_trace_overlay;
 
   private:
-    View(ViewModel const *view_model, WINDOW *main_window_ptr, int height, int width)
-        : m_text_widget(view_model, main_window_ptr, height, width) {
+    // the bottom row of the screen is given to the status bar
+    View(ViewModel *view_model, WINDOW *main_window_ptr, int height, int width)
+        : m_window_ptr(main_window_ptr), m_height(height), m_width(width),
+          m_text_widget(view_model, main_window_ptr, height - 1, width),
+          m_status_bar(view_model, main_window_ptr, height - 1, width),
+          m_trace_overlay(view_model, main_window_ptr, height - 1, width) {
+    }
+
+    void resize(int height, int width) {
+        m_height = height;
+        m_width = width;
+        m_text_widget.resize(height - 1, width);
+        m_status_bar.resize(height - 1, width);
+        m_trace_overlay.resize(height - 1, width);
     }
 
   public:
@@ -34,30 +54,58 @@ class View {
     static void init_view_colours() {
         init_pair((short)COLOUR::NORMAL, COLOR_WHITE, -1);
         init_pair((short)COLOUR::CURSOR, COLOR_BLACK, COLOR_WHITE);
+        init_pair((short)COLOUR::MATCH, COLOR_BLACK, COLOR_YELLOW);
+        init_pair((short)COLOUR::KEYWORD, COLOR_MAGENTA, -1);
+        init_pair((short)COLOUR::TYPE, COLOR_CYAN, -1);
+        init_pair((short)COLOUR::STRING, COLOR_GREEN, -1);
+        init_pair((short)COLOUR::NUMBER, COLOR_RED, -1);
+        init_pair((short)COLOUR::COMMENT, COLOR_BLUE, -1);
+        init_pair((short)COLOUR::PREPROCESSOR, COLOR_YELLOW, -1);
     }
 
     static View initialize(ViewModel *model) {
+        // ncurses only draws multi-byte UTF-8 as such if the locale says to
+        setlocale(LC_ALL, "");
         initscr();
         start_color();
         use_default_colors();
+        init_view_colours();
         noecho();
         raw();
         curs_set(0);
         keypad(stdscr, TRUE);
 
-        // Get the screen height and width
+        return View::on_window(model, stdscr);
+    }
+
+    // A view that fills an existing window, which can belong to any terminal set up with
+    // newterm (even one writing to /dev/null)
+    static View on_window(ViewModel *model, WINDOW *window_ptr) {
+        // Get the window height and width
         int height, width;
-        getmaxyx(stdscr, height, width);
-        // Construct the view with the main screen, and passing in height and width
-        return View(model, stdscr, height, width);
+        getmaxyx(window_ptr, height, width);
+        // Construct the view with the window, and passing in height and width
+        return View(model, window_ptr, height, width);
     }
 
     // Calls render on the relevant view elements
     void render() {
         m_text_widget.render();
+        m_status_bar.render();
+        m_trace_overlay.render();
     }
 
     void update_state() {
+        // ncurses resizes the window when the terminal changes size; the key it sends to
+        // say so is dropped, but it still wakes the main loop up for another frame
+        int height, width;
+        getmaxyx(m_window_ptr, height, width);
+        if (height != m_height || width != m_width) {
+            resize(height, width);
+        }
+
         m_text_widget.update_state();
+        m_status_bar.update_state();
+        m_trace_overlay.update_state();
     }
 };
@@ -1,14 +1,27 @@
 #pragma once
 
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
 #include "Model.h"
+#include "SyntaxHighlighter.h"
+#include "Tracer.h"
 
 class ViewModel {
     Model *const m_model;
-    // keep track of relevant data for the view class
+    // keep track of relevant data for the view class; only the rows the view asked for
+    // are kept, starting at m_first_row. All of these are refilled each frame rather than
+    // built again, so they hold on to their storage and a frame needn't allocate.
+    size_t m_first_row;
+    // the prepared rows' text, which m_tagged_text's lines are views into
+    Text m_text;
     std::vector<TaggedText> m_tagged_text;
+    // where the characters of each prepared row are drawn; the tags are still in bytes
+    std::vector<LineColumns> m_line_columns;
 
   public:
-    ViewModel(Model *const model) : m_model(model) {
+    ViewModel(Model *const model) : m_model(model), m_first_row(0) {
     }
     ~ViewModel(){};
     ViewModel(ViewModel const &) = delete;
@@ -17,8 +30,10 @@ class ViewModel {
     ViewModel &operator=(ViewModel const &) = delete;
     ViewModel &operator=(ViewModel &&) = delete;
 
-    void prepare_view_data() {
-        update_tagged_text();
+    // Prepares the num_rows rows starting at first_row, which is all the view can show
+    void prepare_view_data(size_t first_row, size_t num_rows) {
+        ScopedTrace trace{TraceStage::PREPARE_VIEW_DATA};
+        update_tagged_text(first_row, num_rows);
     }
 
     // Getters for the view
@@ -30,45 +45,237 @@ class ViewModel {
         return m_tagged_text;
     }
 
-    std::vector<TaggedText> get_tagged_text() const {
-        return m_tagged_text;
-    }
-
     TaggedText const &get_const_tagged_line_at(size_t index) const {
         return m_tagged_text.at(index);
     }
 
-    TaggedText get_tagged_line_at(size_t index) const {
-        return m_tagged_text.at(index);
+    LineColumns const &get_line_columns_at(size_t index) const {
+        return m_line_columns.at(index);
+    }
+
+    // The screen column the cursor's active point is drawn at, before any scrolling
+    size_t cursor_column() const {
+        return m_model->column_of(m_model->get_cursor().active_point());
+    }
+
+    // The buffer row that get_tagged_line_at(0) corresponds to
+    size_t first_row() const {
+        return m_first_row;
     }
 
+    // Number of prepared rows, which can be fewer than asked for near the end of the buffer
     size_t num_lines() const {
         return m_tagged_text.size();
     }
 
+    // The text for the status bar: the open prompt if there is one, otherwise the cursor's
+    // position in the file. It's written over status_text, whose storage the bar reuses.
+    void get_status_text(std::string &status_text) const {
+        status_text.clear();
+        std::optional<Prompt> const &prompt = m_model->get_prompt();
+        if (prompt.has_value()) {
+            status_text.append(prompt->m_label);
+            status_text.append(prompt->m_input);
+            return;
+        }
+
+        Cursor cursor = m_model->get_cursor();
+        std::string const &pathname = m_model->pathname();
+        status_text.append(pathname.empty() ? std::string_view{"[No Name]"} : std::string_view{pathname});
+        status_text.append("  Ln ");
+        append_number(status_text, cursor.row() + 1);
+        status_text.append("/");
+        append_number(status_text, m_model->num_lines());
+        status_text.append(", Col ");
+        append_number(status_text, cursor_column() + 1);
+
+        size_t size = m_model->size();
+        size_t percent = size == 0 ? 100 : m_model->cursor_offset() * 100 / size;
+        status_text.append("  ");
+        append_number(status_text, percent);
+        status_text.append("%");
+
+        if (m_model->is_loading()) {
+            status_text.append("  Loading ");
+            append_number(status_text, m_model->load_percent());
+            status_text.append("%");
+        }
+        if (m_model->is_saving()) {
+            status_text.append("  Saving...");
+        }
+        if (m_model->following()) {
+            status_text.append("  Following");
+        }
+        if (!m_model->get_message().empty()) {
+            status_text.append("  ");
+            status_text.append(m_model->get_message());
+        }
+    }
+
+    // Word wrap, for the text widget to lay rows out with
+
+    bool word_wrap() const {
+        return m_model->word_wrap();
+    }
+
+    void set_wrap_width(size_t width) {
+        m_model->set_wrap_width(width);
+    }
+
+    void measure_rows(size_t first_row, size_t count) {
+        m_model->measure_rows(first_row, count);
+    }
+
+    size_t visual_line_of(CursorPoint const &point) {
+        return m_model->visual_line_of(point);
+    }
+
+    size_t visual_line_of(VisualPosition position) {
+        return m_model->visual_line_of(position);
+    }
+
+    VisualPosition visual_position_at(size_t line) {
+        return m_model->visual_position_at(line);
+    }
+
+    bool trace_overlay_shown() const {
+        return m_model->trace_overlay_shown();
+    }
+
+    // One line per traced stage of the previous frame, then how many allocations it made.
+    // The lines are written over the ones already in lines, to reuse their storage.
+    void get_trace_overlay_lines(std::vector<std::string> &lines) const {
+        FrameSummary const &frame = Tracer::global().last_frame();
+        lines.resize((size_t)TraceStage::NUM_STAGES + 2);
+        char line[64];
+        snprintf(line, sizeof(line), "frame %llu", (unsigned long long)frame.m_frame);
+        lines[0].assign(line);
+        for (size_t stage = 0; stage < (size_t)TraceStage::NUM_STAGES; ++stage) {
+            snprintf(line, sizeof(line), "%-18s %9.1f us", Tracer::stage_name((TraceStage)stage),
+                     frame.m_stage_ns[stage] / 1e3);
+            lines[stage + 1].assign(line);
+        }
+        snprintf(line, sizeof(line), "allocations %zu", frame.m_allocations);
+        lines.back().assign(line);
+    }
+
   private:
-    // Gets text from the model and prepares it with tags etc
-    void update_tagged_text() {
+    // to_string without the temporary string
+    static void append_number(std::string &text, size_t number) {
+        char digits[24];
+        auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), number);
+        text.append(digits, end);
+    }
+
+    // Gets the visible text from the model and prepares it with tags etc
+    void update_tagged_text(size_t first_row, size_t num_rows) {
         // get the text from the model
-        Text text = m_model->get_text();
+        m_model->get_lines(first_row, num_rows, m_text);
+        Text const &text = m_text;
 
         // prepare the tagged_text
-        m_tagged_text.clear();
-        m_tagged_text.reserve(text.num_lines());
+        m_first_row = first_row;
+        m_tagged_text.resize(text.num_lines());
+        m_line_columns.resize(text.num_lines());
         for (size_t line_idx = 0; line_idx < text.num_lines(); ++line_idx) {
-            m_tagged_text.push_back(std::string{text.get_line_at(line_idx)});
+            std::string_view line = text.get_line_at(line_idx);
+            m_tagged_text[line_idx].reset(line);
+            m_line_columns[line_idx] = m_model->line_columns(first_row + line_idx, line);
         }
 
+        // later tags are drawn over earlier ones: syntax, then matches, then the cursor
+        add_syntax_tags(text);
+        add_search_tags(text);
+
         // tag the respective lines with the cursor tags
-        add_cursor_tag();
+        add_cursor_tags();
     }
 
-    void add_cursor_tag() {
-        // assert that by the time this is called, tagged_text should at least not be empty
-        assert(!m_tagged_text.empty());
+    // Colours the prepared rows by syntax. The worker does the lexing that depends on the
+    // rest of the file; here we only lex the prepared rows, from the state the first of them
+    // starts in according to the worker's latest result. Rows it can't tell us about yet
+    // stay plain until it catches up.
+    void add_syntax_tags(Text const &text) {
+        m_model->request_highlighting(text.first_row(), text.num_lines());
+        Language language = m_model->highlight_language();
+        if (language == Language::NONE) {
+            return;
+        }
+
+        std::optional<LexState> state;
+        for (size_t line_idx = 0; line_idx < text.num_lines(); ++line_idx) {
+            if (!state.has_value()) {
+                state = m_model->highlight_start_state(text.first_row() + line_idx);
+                if (!state.has_value()) {
+                    continue;
+                }
+            }
+            state = Lexer::lex_line(language, text.get_line_at(line_idx), *state,
+                                    [&](size_t start, size_t end, COLOUR colour) {
+                                        TextTag tag{start, end, colour, ATTRIBUTE::NORMAL};
+                                        m_tagged_text.at(line_idx).add_tag(tag);
+                                    });
+        }
+    }
+
+    // Highlights matches of the current search, looking only at the prepared rows
+    void add_search_tags(Text const &text) {
+        std::shared_ptr<Regex> const &regex = m_model->get_regex_search();
+        if (regex != nullptr) {
+            for (size_t line_idx = 0; line_idx < text.num_lines(); ++line_idx) {
+                regex->for_each_match(text.get_line_at(line_idx), [&](RegexMatch match) {
+                    size_t end = match.m_offset + match.m_length;
+                    TextTag tag{match.m_offset, end, COLOUR::MATCH, ATTRIBUTE::NORMAL};
+                    m_tagged_text.at(line_idx).add_tag(tag);
+                    return true;
+                });
+            }
+            return;
+        }
 
+        std::optional<LiteralMatcher> const &search = m_model->get_search();
+        if (!search.has_value()) {
+            return;
+        }
+        for (size_t line_idx = 0; line_idx < text.num_lines(); ++line_idx) {
+            std::string_view line = text.get_line_at(line_idx);
+            size_t idx = search->find(line);
+            while (idx != std::string_view::npos) {
+                TextTag tag{idx, idx + search->size(), COLOUR::MATCH, ATTRIBUTE::NORMAL};
+                m_tagged_text.at(line_idx).add_tag(tag);
+                idx = search->find(line, idx + search->size());
+            }
+        }
+    }
+
+    // Tags the prepared row that sits at buffer row, if it is one of the prepared rows
+    void tag_row(size_t row, TextTag text_tag) {
+        if (row >= m_first_row && row - m_first_row < m_tagged_text.size()) {
+            m_tagged_text.at(row - m_first_row).add_tag(std::move(text_tag));
+        }
+    }
+
+    size_t prepared_row_size(size_t row) const {
+        return m_tagged_text.at(row - m_first_row).size();
+    }
+
+    // Tags every cursor, and the selections they have, on the prepared rows
+    void add_cursor_tags() {
+        size_t last_prepared_row = m_first_row + m_tagged_text.size();
+        // the extra cursors are in order, and so are the ends of their selections, so the
+        // first one to reach the prepared rows is found by bisection and the walk stops at
+        // the first one past them
+        std::vector<Cursor> const &extra_cursors = m_model->get_extra_cursors();
+        auto before_view = [&](Cursor const &cursor) { return cursor.get_right_point().row() < m_first_row; };
+        auto it = std::partition_point(extra_cursors.begin(), extra_cursors.end(), before_view);
+        for (; it != extra_cursors.end() && it->get_left_point().row() < last_prepared_row; ++it) {
+            add_cursor_tag(*it);
+        }
+        add_cursor_tag(m_model->get_cursor());
+    }
+
+    void add_cursor_tag(Cursor const &cursor) {
         // create the cursor_tags
-        Cursor cursor = m_model->get_cursor();
         if (cursor.in_selection_mode()) {
             // if the cursor is in selection mode we have to tag multiple lines
             std::pair<CursorPoint, CursorPoint> point_pair = cursor.get_const_points_in_order();
@@ -77,28 +284,28 @@ class ViewModel {
             if (left_point.row() == right_point.row()) {
                 // single row logic
                 assert(left_point.col() < right_point.col());
-                TextTag text_tag{left_point.col(), right_point.col(), COLOUR::NORMAL, ATTRIBUTE::UNDERLINE};
-                m_tagged_text.at(left_point.row()).add_tag(std::move(text_tag));
+                tag_row(left_point.row(),
+                        {left_point.col(), right_point.col(), COLOUR::NORMAL, ATTRIBUTE::UNDERLINE});
             } else {
-                // multi row logic
+                // multi row logic; only the rows that were prepared need tagging
                 assert(left_point.row() < right_point.row());
-                size_t end_pos = m_tagged_text.at(left_point.row()).size();
+                size_t last_prepared_row = m_first_row + m_tagged_text.size();
                 // tag for the first row
-                m_tagged_text.at(left_point.row())
-                    .add_tag({left_point.col(), end_pos, COLOUR::NORMAL, ATTRIBUTE::UNDERLINE});
+                if (left_point.row() >= m_first_row && left_point.row() < last_prepared_row) {
+                    tag_row(left_point.row(), {left_point.col(), prepared_row_size(left_point.row()),
+                                               COLOUR::NORMAL, ATTRIBUTE::UNDERLINE});
+                }
                 // tag for the middle rows
-                for (size_t idx = left_point.row() + 1; idx < right_point.row(); ++idx) {
-                    end_pos = m_tagged_text.at(idx).size();
-                    m_tagged_text.at(idx).add_tag({0, end_pos, COLOUR::NORMAL, ATTRIBUTE::UNDERLINE});
+                for (size_t idx = std::max(left_point.row() + 1, m_first_row);
+                     idx < right_point.row() && idx < last_prepared_row; ++idx) {
+                    tag_row(idx, {0, prepared_row_size(idx), COLOUR::NORMAL, ATTRIBUTE::UNDERLINE});
                 }
                 // tag for the final row
-                m_tagged_text.at(right_point.row())
-                    .add_tag({0, right_point.col(), COLOUR::NORMAL, ATTRIBUTE::UNDERLINE});
+                tag_row(right_point.row(), {0, right_point.col(), COLOUR::NORMAL, ATTRIBUTE::UNDERLINE});
             }
         } else {
             assert(!cursor.in_selection_mode());
-            TextTag text_tag(cursor.col(), cursor.col() + 1, COLOUR::NORMAL, ATTRIBUTE::HIGHLIGHT);
-            m_tagged_text.at(cursor.row()).add_tag(std::move(text_tag));
+            tag_row(cursor.row(), {cursor.col(), cursor.col() + 1, COLOUR::NORMAL, ATTRIBUTE::HIGHLIGHT});
         }
     }
 };
\ No newline at end of file
@@ -37,6 +37,11 @@ class WindowBorder {
         return m_width;
     }
 
+    void resize(int height, int width) {
+        m_height = height;
+        m_width = width;
+    }
+
     void move_right(int delta) {
         m_starting_row += delta;
     }
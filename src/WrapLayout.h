@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "FenwickTree.h"
+#include "LineColumns.h"
+#include "TextBuffer.h"
+
+// A line on screen when rows are wrapped: the buffer row it shows part of, and which of
+// that row's segments it is
+struct VisualPosition {
+    size_t m_row;
+    size_t m_segment;
+};
+
+// Maps buffer rows to the visual lines they take up when they are wrapped to a width. How
+// many lines a row needs is worked out lazily, when something asks about the row, and is
+// kept until the row is edited or the width changes; rows that haven't been measured count
+// as one line. The rows are grouped in blocks, and Fenwick trees over the blocks' row and
+// line totals find the block holding a row or a visual line in O(log n), leaving at most a
+// block's worth of rows to step through.
+class WrapLayout {
+    static constexpr size_t BLOCK_ROWS = 256;
+
+    struct Block {
+        size_t m_num_rows;
+        size_t m_num_lines;
+        // lines per row, 0 for rows that haven't been measured; stays empty until a row in
+        // the block is, so a huge file only pays for the rows that have been looked at
+        std::vector<uint32_t> m_line_counts;
+    };
+
+    size_t m_width;
+    std::vector<Block> m_blocks;
+    FenwickTree m_block_rows;
+    FenwickTree m_block_lines;
+
+  public:
+    WrapLayout() : m_width(0) {
+        reset(1);
+    }
+
+    // Where each segment of line starts when it's wrapped to width columns. Rows break after
+    // the last space that fits, or mid-word if a word doesn't fit at all, but never inside a
+    // character. A row that fills its last line exactly gets an empty one after it, for the
+    // cursor to sit on.
+    static std::vector<size_t> segment_starts(std::string_view line, size_t width) {
+        return segment_starts(line, LineColumns{line}, width);
+    }
+
+    // The same, for a line whose columns have already been worked out
+    static std::vector<size_t> segment_starts(std::string_view line, LineColumns const &columns,
+                                              size_t width) {
+        std::vector<size_t> starts;
+        segment_starts(line, columns, width, starts);
+        return starts;
+    }
+
+    // The same again, written over starts so that its storage gets reused
+    static void segment_starts(std::string_view line, LineColumns const &columns, size_t width,
+                               std::vector<size_t> &starts) {
+        starts.assign(1, 0);
+        if (width == 0) {
+            return;
+        }
+        size_t start = 0;
+        while (columns.width() - columns.column_of(start) >= width) {
+            // the first character that doesn't fit; a wide one that doesn't fit on a line of
+            // its own goes on one anyway
+            size_t end = columns.byte_at_column(columns.column_of(start) + width);
+            if (end == start) {
+                end = columns.next(start);
+            }
+            size_t space = line.rfind(' ', end - 1);
+            start = space != std::string_view::npos && space >= start ? space + 1 : end;
+            starts.push_back(start);
+        }
+    }
+
+    // The segment that col falls in
+    static size_t segment_of(std::vector<size_t> const &starts, size_t col) {
+        return std::upper_bound(starts.begin(), starts.end(), col) - starts.begin() - 1;
+    }
+
+    // Starts over with num_rows rows, none of them measured
+    void reset(size_t num_rows) {
+        m_blocks.clear();
+        for (size_t row = 0; row < num_rows; row += BLOCK_ROWS) {
+            size_t block_rows = std::min(BLOCK_ROWS, num_rows - row);
+            m_blocks.push_back(Block{block_rows, block_rows, {}});
+        }
+        rebuild_index();
+    }
+
+    size_t width() const {
+        return m_width;
+    }
+
+    // Every row has to be measured again at a new width; that happens as they're looked at
+    void set_width(size_t width) {
+        if (width == m_width) {
+            return;
+        }
+        m_width = width;
+        for (Block &block : m_blocks) {
+            block.m_num_lines = block.m_num_rows;
+            std::vector<uint32_t>().swap(block.m_line_counts);
+        }
+        rebuild_index();
+    }
+
+    // Takes in an edit made to the buffer; the rows it replaced are measured again later
+    void apply(LineChange const &change) {
+        if (change.m_old_count == LineChange::ALL_ROWS) {
+            reset(change.m_new_count);
+            return;
+        }
+        size_t first = std::min(change.m_first_row, num_rows());
+        size_t old_count = std::min(change.m_old_count, num_rows() - first);
+        size_t new_count = std::max<size_t>(change.m_new_count, 1);
+        if (old_count == new_count) {
+            // typing within rows doesn't move any, so the blocks stay as they are
+            for (size_t row = first; row < first + old_count; ++row) {
+                set_line_count(row, 0);
+            }
+            return;
+        }
+        replace_rows(first, old_count, new_count);
+        rebuild_index();
+    }
+
+    size_t num_rows() const {
+        return m_block_rows.total();
+    }
+
+    size_t num_visual_lines() const {
+        return m_block_lines.total();
+    }
+
+    bool measured(size_t row) const {
+        auto [block_idx, idx] = locate(row);
+        Block const &block = m_blocks[block_idx];
+        return !block.m_line_counts.empty() && block.m_line_counts[idx] != 0;
+    }
+
+    // Records how many lines row takes up at the current width, or with 0 that it needs
+    // measuring again
+    void set_line_count(size_t row, size_t count) {
+        auto [block_idx, idx] = locate(row);
+        Block &block = m_blocks[block_idx];
+        if (block.m_line_counts.empty()) {
+            block.m_line_counts.assign(block.m_num_rows, 0);
+        }
+        size_t old_lines = lines_of(block, idx);
+        block.m_line_counts[idx] = (uint32_t)count;
+        size_t new_lines = lines_of(block, idx);
+        block.m_num_lines = block.m_num_lines - old_lines + new_lines;
+        m_block_lines.update(block_idx, old_lines, new_lines);
+    }
+
+    // The visual line that row starts on
+    size_t first_line_of(size_t row) const {
+        auto [block_idx, idx] = locate(row);
+        Block const &block = m_blocks[block_idx];
+        size_t line = m_block_lines.prefix_sum(block_idx);
+        for (size_t before = 0; before < idx; ++before) {
+            line += lines_of(block, before);
+        }
+        return line;
+    }
+
+    // How many visual lines row takes up
+    size_t lines_in(size_t row) const {
+        auto [block_idx, idx] = locate(row);
+        return lines_of(m_blocks[block_idx], idx);
+    }
+
+    // The row and segment shown on visual line, clamped to the last line
+    VisualPosition position_of_line(size_t line) const {
+        line = std::min(line, num_visual_lines() - 1);
+        size_t block_idx = m_block_lines.count_within(line);
+        Block const &block = m_blocks[block_idx];
+        size_t row = m_block_rows.prefix_sum(block_idx);
+        line -= m_block_lines.prefix_sum(block_idx);
+        for (size_t idx = 0;; ++idx) {
+            assert(idx < block.m_num_rows);
+            size_t lines = lines_of(block, idx);
+            if (line < lines) {
+                return VisualPosition{row + idx, line};
+            }
+            line -= lines;
+        }
+    }
+
+  private:
+    static size_t lines_of(Block const &block, size_t idx) {
+        return block.m_line_counts.empty() || block.m_line_counts[idx] == 0 ? 1 : block.m_line_counts[idx];
+    }
+
+    // The block holding row, and where in it the row is
+    std::pair<size_t, size_t> locate(size_t row) const {
+        assert(row < num_rows());
+        size_t block_idx = m_block_rows.count_within(row);
+        return {block_idx, row - m_block_rows.prefix_sum(block_idx)};
+    }
+
+    // Swaps old_count rows from first for new_count unmeasured ones. Blocks that empty out
+    // are dropped and a block that grows too big is split; the index is left to the caller.
+    void replace_rows(size_t first, size_t old_count, size_t new_count) {
+        size_t insert_block_idx = m_blocks.size() - 1;
+        size_t insert_idx = m_blocks.back().m_num_rows;
+        if (first < num_rows()) {
+            std::tie(insert_block_idx, insert_idx) = locate(first);
+        }
+
+        size_t block_idx = insert_block_idx;
+        size_t idx = insert_idx;
+        for (size_t remaining = old_count; remaining > 0; idx = 0) {
+            Block &block = m_blocks[block_idx];
+            size_t count = std::min(remaining, block.m_num_rows - idx);
+            for (size_t row = idx; row < idx + count; ++row) {
+                block.m_num_lines -= lines_of(block, row);
+            }
+            if (!block.m_line_counts.empty()) {
+                auto begin = block.m_line_counts.begin() + idx;
+                block.m_line_counts.erase(begin, begin + count);
+            }
+            block.m_num_rows -= count;
+            remaining -= count;
+            if (block.m_num_rows > 0 || m_blocks.size() == 1) {
+                block_idx++;
+            } else {
+                m_blocks.erase(m_blocks.begin() + block_idx);
+                if (block_idx == insert_block_idx) {
+                    // the new rows go at the start of whatever came after
+                    insert_idx = 0;
+                }
+            }
+        }
+        if (insert_block_idx == m_blocks.size()) {
+            insert_block_idx--;
+            insert_idx = m_blocks.back().m_num_rows;
+        }
+
+        Block &block = m_blocks[insert_block_idx];
+        block.m_num_rows += new_count;
+        block.m_num_lines += new_count;
+        if (!block.m_line_counts.empty()) {
+            block.m_line_counts.insert(block.m_line_counts.begin() + insert_idx, new_count, 0);
+        }
+        split_block(insert_block_idx);
+    }
+
+    // Cuts the block at block_idx into ordinary sized ones if it has grown past twice that
+    void split_block(size_t block_idx) {
+        Block &block = m_blocks[block_idx];
+        if (block.m_num_rows <= 2 * BLOCK_ROWS) {
+            return;
+        }
+        std::vector<Block> pieces;
+        for (size_t start = 0; start < block.m_num_rows; start += BLOCK_ROWS) {
+            size_t rows = std::min(BLOCK_ROWS, block.m_num_rows - start);
+            Block piece{rows, rows, {}};
+            if (!block.m_line_counts.empty()) {
+                auto begin = block.m_line_counts.begin() + start;
+                piece.m_line_counts.assign(begin, begin + rows);
+                piece.m_num_lines = 0;
+                for (size_t idx = 0; idx < rows; ++idx) {
+                    piece.m_num_lines += lines_of(piece, idx);
+                }
+            }
+            pieces.push_back(std::move(piece));
+        }
+        m_blocks.erase(m_blocks.begin() + block_idx);
+        m_blocks.insert(m_blocks.begin() + block_idx, std::make_move_iterator(pieces.begin()),
+                        std::make_move_iterator(pieces.end()));
+    }
+
+    void rebuild_index() {
+        std::vector<size_t> rows;
+        std::vector<size_t> lines;
+        rows.reserve(m_blocks.size());
+        lines.reserve(m_blocks.size());
+        for (Block const &block : m_blocks) {
+            rows.push_back(block.m_num_rows);
+            lines.push_back(block.m_num_lines);
+        }
+        m_block_rows.assign(rows);
+        m_block_lines.assign(lines);
+    }
+};
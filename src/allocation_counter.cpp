@@ -0,0 +1,24 @@
+#include <cstdlib>
+#include <new>
+
+#include "Tracer.h"
+
+// Counts every allocation the editor makes so the trace overlay can show how many each
+// frame costs. The array and sized forms all end up here or in the matching delete.
+
+void *operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
@@ -1,11 +1,15 @@
 #include <cctype>
+#include <cstdlib>
 #include <ncurses.h>
 
 #include "Model.h"
 #include "TextBuffer.h"
+#include "InputReader.h"
+#include "Tracer.h"
 #include "View.h"
 #include "file.h"
 #include "key_codes.h"
+#include "key_handling.h"
 
 extern "C" {
 void initialise() {
@@ -18,60 +22,17 @@ void initialise() {
 }
 }
 
-void handle_key(Model &model, Key key) {
-    if (key.is_insertable()) {
-        model.insert_string(std::string(1, key.get_char()));
-        return;
-    }
-
-    // if (key.is_modified()) {
-    //   return;
-    // }
-
-    if (key.is_type(KeyType::ENTER) && !key.is_modified()) {
-        model.insert_string(std::string("\n"));
-    }
-
-    if (key.is_type(KeyType::BACKSPACE) && !key.is_modified()) {
-        model.remove_char();
-    }
-
-    if (key.is_type(KeyType::ARROW)) {
-        // std::cerr << "key modifier:[" << key.modifier() << "]" << std::endl;
-        if (!key.is_modified()) {
-            if (key.has_keycode(UP)) {
-                model.move_cursor_up();
-            }
-            if (key.has_keycode(DOWN)) {
-                model.move_cursor_down();
-            }
-            if (key.has_keycode(LEFT)) {
-                model.move_cursor_left();
-            }
-            if (key.has_keycode(RIGHT)) {
-                model.move_cursor_right();
-            }
-        } else if (key.is_modified_by(KeyModifier::SHIFT)) {
-            if (key.has_keycode(SHIFT_UP)) {
-                model.shift_cursor_up();
-            }
-            if (key.has_keycode(SHIFT_DOWN)) {
-                model.shift_cursor_down();
-            }
-            if (key.has_keycode(SHIFT_LEFT)) {
-                model.shift_cursor_left();
-            }
-            if (key.has_keycode(SHIFT_RIGHT)) {
-                model.shift_cursor_right();
-            }
-        }
-    }
-}
+// how often the screen is refreshed while a file is still loading or saving
+constexpr int BACKGROUND_POLL_INTERVAL_MS = 50;
 
 int main(int argc, char **argv) {
 
     // construct model and give view a "handle" to model
     Model model = Model::initialize();
+    // ELDITOR_UNDO_MEMORY_MB caps how much the undo history holds on to
+    if (char const *undo_memory_mb = getenv("ELDITOR_UNDO_MEMORY_MB")) {
+        model.set_undo_memory_limit(std::strtoull(undo_memory_mb, nullptr, 10) << 20);
+    }
     if (argc > 1) {
         // if there is a filename (and ignore the subsequent arguments)
         model.open_file(std::string(argv[1]));
@@ -81,36 +42,64 @@ int main(int argc, char **argv) {
     View view = View::initialize(&view_model);
 
     // main event loop
+    InputReader input_reader{stdscr};
+    Tracer &tracer = Tracer::global();
     while (true) {
-        // update view model
-        view_model.prepare_view_data();
+        tracer.begin_frame();
 
-        // get view to update its state
+        // take in whatever part of the file has been read, and any save that finished, since
+        // the last frame
+        model.poll_background_work();
+
+        // get view to update its state; it prepares the view model for the rows it shows
         view.update_state();
         view.render();
 
-        // make this nonblocking
-        int input_char = wgetch(stdscr);
-        std::optional<Key> opt_key = keycode_to_key(input_char);
-
-        // we might choose to ignore the currently obtained keypress
-        if (!opt_key.has_value()) {
+        // while a file is loading or saving we wake up regularly to show how it's going;
+        // otherwise we just wait for the next key, or for the file to change on disk.
+        // Everything typed or pasted meanwhile is handled before the next frame. Being woken
+        // for some other file in the same directory doesn't get a frame.
+        std::vector<InputEvent> events;
+        {
+            ScopedTrace trace{TraceStage::WAIT};
+            do {
+                int timeout_ms = model.has_background_work() ? BACKGROUND_POLL_INTERVAL_MS : -1;
+                events = input_reader.read(timeout_ms, model.file_watch_fd());
+            } while (events.empty() && input_reader.woke_for_fd() && !model.take_file_changes());
+        }
+        if (events.empty()) {
             continue;
         }
+        model.clear_message();
+
+        ScopedTrace trace{TraceStage::HANDLE_KEY};
+        bool quit = false;
+        for (InputEvent &event : events) {
+            if (!event.m_key.has_value()) {
+                handle_text(model, std::move(event.m_text), event.m_is_paste);
+                continue;
+            }
 
-        // example of capturing something; we should shift this logic somewhere else
-        // eventually i think
-        Key key = opt_key.value();
-        if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'Q') {
-            break;
-        }
+            // example of capturing something; we should shift this logic somewhere else
+            // eventually i think
+            Key key = event.m_key.value();
+            if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) &&
+                key.get_char() == 'Q') {
+                quit = true;
+                break;
+            }
 
-        if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'S') {
-            model.save_to_file();
-        }
+            if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) &&
+                key.get_char() == 'S') {
+                model.save_to_file();
+            }
 
-        // handling the key normally
-        handle_key(model, key);
+            // handling the key normally
+            handle_key(model, key);
+        }
+        if (quit) {
+            break;
+        }
 
         // the logic here should be to obtain the string in full
         // then tag the string with the correct colours,
@@ -120,5 +109,10 @@ int main(int argc, char **argv) {
     endwin(); // here's how you finish up ncurses mode
     // delwin(stdscr);
 
+    // ELDITOR_TRACE=trace.json keeps the last frames' timings for chrome://tracing
+    if (char const *trace_pathname = getenv("ELDITOR_TRACE")) {
+        tracer.write_chrome_trace(trace_pathname);
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -1,16 +1,275 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <iostream>
+#include <optional>
+#include <signal.h>
 #include <stdexcept>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <string_view>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
+
+// Keeps a file being cut short under one of our mappings from killing us. Reading a mapped
+// page that is past the file's new end raises SIGBUS, on whichever thread did the read; for
+// a page in one of the mappings added here, the handler maps a page of zeroes over it so
+// the read carries on, and notes that it happened so the file can be loaded again.
+class MappingGuard {
+    static constexpr size_t MAX_MAPPINGS = 64;
+
+    // a free slot has m_begin 0; m_end is set after m_begin is taken and cleared before
+    // it's given back, so the handler never sees a range that isn't there
+    struct Range {
+        std::atomic<uintptr_t> m_begin;
+        std::atomic<uintptr_t> m_end;
+    };
+
+    static inline Range s_ranges[MAX_MAPPINGS];
+    static inline std::atomic<bool> s_cut_short{false};
+    static inline std::atomic<bool> s_installed{false};
+    static inline size_t s_page_size;
+    static inline struct sigaction s_previous;
+
+  public:
+    // Guards [data, data + size); past MAX_MAPPINGS mappings are left unguarded
+    static void add(void const *data, size_t size) {
+        install();
+        uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+        for (Range &range : s_ranges) {
+            uintptr_t expected = 0;
+            if (range.m_begin.compare_exchange_strong(expected, begin)) {
+                range.m_end.store(begin + size);
+                return;
+            }
+        }
+    }
+
+    static void remove(void const *data) {
+        uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+        for (Range &range : s_ranges) {
+            if (range.m_begin.load() == begin) {
+                range.m_end.store(0);
+                range.m_begin.store(0);
+                return;
+            }
+        }
+    }
+
+    // Whether any guarded mapping has been read past the end of its file since last asked
+    static bool take_cut_short() {
+        return s_cut_short.exchange(false);
+    }
+
+  private:
+    static void install() {
+        if (s_installed.exchange(true)) {
+            return;
+        }
+        s_page_size = sysconf(_SC_PAGESIZE);
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = handle;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGBUS, &action, &s_previous);
+    }
+
+    static void handle(int signal, siginfo_t *info, void *context) {
+        uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+        for (Range &range : s_ranges) {
+            uintptr_t begin = range.m_begin.load();
+            uintptr_t end = range.m_end.load();
+            if (begin == 0 || addr < begin || addr >= end) {
+                continue;
+            }
+            void *page = reinterpret_cast<void *>(addr & ~(uintptr_t)(s_page_size - 1));
+            // POSIX doesn't list mmap as async-signal-safe. On Linux it's a bare system call
+            // that takes no locks in user space, which is all this relies on; this handler
+            // is Linux only.
+            void *zeroes =
+                mmap(page, s_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            if (zeroes != MAP_FAILED) {
+                s_cut_short.store(true);
+                return;
+            }
+            break;
+        }
+        // not one of ours: whatever handled it before we were installed still does, and we
+        // stay installed for the next truncation
+        if ((s_previous.sa_flags & SA_SIGINFO) != 0 && s_previous.sa_sigaction != nullptr) {
+            s_previous.sa_sigaction(signal, info, context);
+        } else if ((s_previous.sa_flags & SA_SIGINFO) == 0 && s_previous.sa_handler != SIG_DFL &&
+                   s_previous.sa_handler != SIG_IGN) {
+            s_previous.sa_handler(signal);
+        } else {
+            // the default is to die, which the read does once it faults again without us;
+            // a SIGBUS from a fault can't be ignored either
+            struct sigaction default_action;
+            memset(&default_action, 0, sizeof(default_action));
+            default_action.sa_handler = SIG_DFL;
+            sigemptyset(&default_action.sa_mask);
+            sigaction(SIGBUS, &default_action, nullptr);
+        }
+    }
+};
+
+// A read-only private mapping of a file's contents. Pages are only faulted in as
+// they are touched, so holding onto one of these costs no more memory than what
+// has actually been read. Another process can still change the file under it: pages we
+// haven't read yet show a rewrite, and a truncation is caught by MappingGuard.
+class MappedFile {
+    char const *m_data;
+    size_t m_size;
+
+  public:
+    MappedFile() : m_data(nullptr), m_size(0) {
+    }
+
+    MappedFile(int fd, size_t size) : m_data(nullptr), m_size(size) {
+        // mmap refuses zero length mappings, an empty file simply maps to nothing
+        if (m_size == 0) {
+            return;
+        }
+        void *addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            int errsv = errno;
+            std::cerr << "MappedFile Constructor: Error mapping file. " << strerror(errsv) << std::endl;
+            exit(1);
+        }
+        m_data = static_cast<char const *>(addr);
+        MappingGuard::add(m_data, m_size);
+    }
+
+    ~MappedFile() {
+        if (m_data != nullptr) {
+            MappingGuard::remove(m_data);
+            munmap(const_cast<char *>(m_data), m_size);
+        }
+    }
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    friend void swap(MappedFile &a, MappedFile &b) {
+        std::swap(a.m_data, b.m_data);
+        std::swap(a.m_size, b.m_size);
+    }
+
+    MappedFile(MappedFile &&other) : m_data(other.m_data), m_size(other.m_size) {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    MappedFile &operator=(MappedFile &&other) {
+        MappedFile temp{std::move(other)};
+        using std::swap;
+        swap(*this, temp);
+        return *this;
+    }
+
+    // Tells the kernel we are done with the pages for now; they are dropped from our
+    // resident set and faulted back in from the page cache if we touch them again
+    void release_pages() const {
+        release_pages(0, m_size);
+    }
+
+    // Same as above for just [offset, offset + length); only whole pages inside the range are released
+    void release_pages(size_t offset, size_t length) const {
+        if (m_data == nullptr) {
+            return;
+        }
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t begin = (offset + page_size - 1) / page_size * page_size;
+        size_t end = std::min(offset + length, m_size);
+        if (end != m_size) {
+            end = end / page_size * page_size;
+        }
+        if (begin < end) {
+            madvise(const_cast<char *>(m_data) + begin, end - begin, MADV_DONTNEED);
+        }
+    }
+
+    // Hints that the mapping is about to be read front to back
+    void advise_sequential() const {
+        if (m_data != nullptr) {
+            madvise(const_cast<char *>(m_data), m_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    std::string_view view() const {
+        return std::string_view{m_data, m_size};
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+};
+
+// Writes every chunk to fd in order, IOV_MAX chunks per writev, picking up where a short
+// write left off
+inline bool write_all(int fd, std::vector<std::string_view> const &chunks) {
+    std::vector<iovec> iovecs;
+    iovecs.reserve(chunks.size());
+    for (std::string_view chunk : chunks) {
+        if (!chunk.empty()) {
+            iovecs.push_back(iovec{const_cast<char *>(chunk.data()), chunk.size()});
+        }
+    }
+
+    size_t first = 0;
+    while (first < iovecs.size()) {
+        int count = (int)std::min<size_t>(iovecs.size() - first, IOV_MAX);
+        ssize_t written = writev(fd, iovecs.data() + first, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // skip past everything that made it out, trimming a partially written iovec
+        size_t remaining = written;
+        while (first < iovecs.size() && remaining >= iovecs[first].iov_len) {
+            remaining -= iovecs[first].iov_len;
+            first++;
+        }
+        if (remaining > 0) {
+            iovecs[first].iov_base = static_cast<char *>(iovecs[first].iov_base) + remaining;
+            iovecs[first].iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+// Enough of a file's metadata to tell whether it has been replaced or changed since
+struct FileStamp {
+    uint64_t m_inode;
+    uint64_t m_size;
+    int64_t m_mtime_ns;
+
+    bool operator==(FileStamp const &) const = default;
+};
+
+// Flushes directory's entries to disk, so files just created or renamed in it survive a crash
+inline void sync_directory(std::string const &directory) {
+    int dir_fd = ::open(directory.data(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd != -1) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
 
 class FileHandle {
     FILE *m_file_ptr;
@@ -81,17 +340,114 @@ class FileHandle {
     }
 
     void save(std::string to_write) {
+        std::string error;
+        save(std::vector<std::string_view>{to_write}, error);
+    }
+
+    // Replaces the file with chunks written back to back. Returns whether the file on
+    // disk now holds exactly those bytes; on failure the old file is left untouched and
+    // error says what went wrong.
+    bool save(std::vector<std::string_view> const &chunks, std::string &error) {
         if (m_file_ptr == nullptr) {
-            std::runtime_error("FileHandle save(): Can't save to an unspecified file!");
+            throw std::runtime_error("FileHandle save(): Can't save to an unspecified file!");
+        }
+        if (!write_atomically(m_pathname, chunks, error)) {
+            return false;
         }
+        reopen();
+        return true;
+    }
 
-        clear_file();
-        reset_to_beginning();
+    // Writes chunks into a temporary file next to pathname, syncs it, and renames it over
+    // pathname. A crash at any point leaves either the old or the new contents on disk,
+    // never a truncated file, and the old file stays intact for anyone who has it mapped.
+    // The chunks are handed to writev as they are, so no contiguous copy is built. Returns
+    // whether it worked, and if not says why in error; this runs on the saver's thread, so
+    // it's for the caller to show.
+    //
+    // A symlink is followed, so the file it points at is replaced and the link stays. The
+    // new file gets the old one's owner, where we're allowed to give it, and permissions.
+    // Other hard links to the old file keep the old contents: writing in place instead
+    // would change the pages our own mapping of it still reads the buffer from.
+    static bool write_atomically(std::string const &link_pathname,
+                                 std::vector<std::string_view> const &chunks, std::string &error) {
+        std::string pathname = link_pathname;
+        if (char *resolved = realpath(link_pathname.data(), nullptr)) {
+            pathname = resolved;
+            free(resolved);
+        }
+        // the temporary has to be on the same filesystem for the rename to be atomic
+        size_t slash_idx = pathname.rfind('/');
+        std::string directory = slash_idx == std::string::npos ? "." : pathname.substr(0, slash_idx + 1);
+        std::string basename = slash_idx == std::string::npos ? pathname : pathname.substr(slash_idx + 1);
+        std::string temp_pathname = directory + (slash_idx == std::string::npos ? "/." : ".") + basename +
+                                    ".elditor-XXXXXX";
+
+        auto describe = [&](char const *what) {
+            int errsv = errno;
+            error = std::string(what) + ": " + strerror(errsv);
+        };
+        int temp_fd = mkstemp(temp_pathname.data());
+        if (temp_fd == -1) {
+            describe("Error creating temporary file");
+            return false;
+        }
+
+        auto fail = [&](char const *what) {
+            describe(what);
+            close(temp_fd);
+            unlink(temp_pathname.data());
+            return false;
+        };
+
+        // keep the owner and permissions of the file we are replacing; mkstemp creates it
+        // as ours with 0600. Only root may give a file to someone else, so otherwise it
+        // stays ours; the owner goes first, as changing it clears setuid bits.
+        struct stat statbuf;
+        if (stat(pathname.data(), &statbuf) == 0) {
+            if (fchown(temp_fd, statbuf.st_uid, statbuf.st_gid) == -1 &&
+                fchown(temp_fd, (uid_t)-1, statbuf.st_gid) == -1) {
+                // the group isn't one of ours either; keep our own
+            }
+            if (fchmod(temp_fd, statbuf.st_mode & 07777) == -1) {
+                return fail("Error copying file permissions");
+            }
+        }
 
-        size_t written_count = fwrite(to_write.data(), sizeof(char), to_write.size(), m_file_ptr);
-        if (written_count < to_write.size()) {
-            std::cerr << "FileHandle save(): Error writing to file. ";
+        if (!write_all(temp_fd, chunks)) {
+            return fail("Error writing to file");
+        }
+        if (fsync(temp_fd) == -1) {
+            return fail("Error syncing file");
+        }
+        if (close(temp_fd) == -1) {
+            describe("Error closing file");
+            unlink(temp_pathname.data());
+            return false;
+        }
+
+        if (rename(temp_pathname.data(), pathname.data()) == -1) {
+            describe("Error replacing file");
+            unlink(temp_pathname.data());
+            return false;
+        }
+
+        // the rename itself only survives a crash once the directory entry is on disk
+        sync_directory(directory);
+        return true;
+    }
+
+    // Points the handle at whatever is at our pathname now, e.g. after it was replaced by a save
+    void reopen() {
+        if (m_file_ptr != nullptr) {
+            fclose(m_file_ptr);
         }
+        if ((m_file_ptr = fopen(m_pathname.data(), "a+")) == nullptr) {
+            int errsv = errno;
+            std::cerr << "FileHandle reopen(): Error reopening file. " << strerror(errsv) << std::endl;
+            exit(1);
+        }
+        reset_to_beginning();
     }
 
     void open(std::string pathname) {
@@ -105,7 +461,7 @@ class FileHandle {
 
     std::string read() {
         if (m_file_ptr == nullptr) {
-            std::runtime_error("FileHandle read(): Can't read an unspecified file!");
+            throw std::runtime_error("FileHandle read(): Can't read an unspecified file!");
         }
         reset_to_beginning();
 
@@ -124,7 +480,71 @@ class FileHandle {
         return to_return;
     }
 
-    std::string pathname() const {
+    // Maps the file's current contents without copying them
+    MappedFile map() {
+        if (m_file_ptr == nullptr) {
+            throw std::runtime_error("FileHandle map(): Can't map an unspecified file!");
+        }
+
+        struct stat statbuf;
+        if (fstat(fileno(m_file_ptr), &statbuf) == -1) {
+            int errsv = errno;
+            std::cerr << "FileHandle map(): Error trying to stat file. " << strerror(errsv) << std::endl;
+            exit(1);
+        }
+        return MappedFile(fileno(m_file_ptr), statbuf.st_size);
+    }
+
+    // Reads up to length bytes from offset of the file the handle has open; fewer come
+    // back if the file ends sooner or can't be read
+    std::string read_range(size_t offset, size_t length) const {
+        assert(m_file_ptr != nullptr);
+        std::string contents(length, '\0');
+        size_t count = 0;
+        while (count < length) {
+            ssize_t read_count =
+                pread(fileno(m_file_ptr), contents.data() + count, length - count, offset + count);
+            if (read_count == -1 && errno == EINTR) {
+                continue;
+            }
+            if (read_count <= 0) {
+                break;
+            }
+            count += read_count;
+        }
+        contents.resize(count);
+        return contents;
+    }
+
+    // The stamp of the file the handle has open, which after a save is the new one
+    FileStamp stamp() const {
+        assert(m_file_ptr != nullptr);
+        struct stat statbuf;
+        if (fstat(fileno(m_file_ptr), &statbuf) == -1) {
+            int errsv = errno;
+            std::cerr << "FileHandle stamp(): Error trying to stat file. " << strerror(errsv) << std::endl;
+            return FileStamp{0, 0, 0};
+        }
+        return stamp_from(statbuf);
+    }
+
+    // The stamp of whatever is at our pathname now, which isn't the file we have open if
+    // something was renamed over it; nullopt if there's nothing there
+    std::optional<FileStamp> stamp_on_disk() const {
+        struct stat statbuf;
+        if (stat(m_pathname.data(), &statbuf) == -1) {
+            return std::nullopt;
+        }
+        return stamp_from(statbuf);
+    }
+
+    std::string const &pathname() const {
         return m_pathname;
     }
+
+  private:
+    static FileStamp stamp_from(struct stat const &statbuf) {
+        int64_t mtime_ns = (int64_t)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec;
+        return FileStamp{(uint64_t)statbuf.st_ino, (uint64_t)statbuf.st_size, mtime_ns};
+    }
 };
\ No newline at end of file
@@ -49,10 +49,25 @@
 // BACKSPACE
 #define CONTROL_BACKSPACE 8
 
+// Bracketed paste markers (ESC[200~ and ESC[201~); these aren't in terminfo, so
+// InputReader registers them with define_key under codes of our own
+#define PASTE_BEGIN_CODE 2000
+#define PASTE_END_CODE 2001
+
 // Special key combinations; only have to list the non alphabetical ones
 #define CONTROL_SLASH 31
+#define CONTROL_D 4
+#define CONTROL_E 5
+#define CONTROL_F 6
+#define CONTROL_G 7
+#define CONTROL_N 14
+#define CONTROL_T 20
+#define CONTROL_Y 25
+#define CONTROL_Z 26
 #define CONTROL_Q 17
+#define CONTROL_R 18
 #define CONTROL_S 19
+#define CONTROL_W 23
 
 enum KeyType {
     ALPHA,
@@ -198,8 +213,18 @@ const std::unordered_map<int, const Key> reserved_keycode_to_key{
     {ENTER_CODE, {ENTER_CODE, KeyType::ENTER, KeyModifier::NONE}},
     // MISC Key combinations
     {CONTROL_SLASH, {'/', KeyType::PUNCTUATION, KeyModifier::CTRL}},
+    {CONTROL_D, {'D', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_E, {'E', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_F, {'F', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_G, {'G', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_N, {'N', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_T, {'T', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_Y, {'Y', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_Z, {'Z', KeyType::ALPHA, KeyModifier::CTRL}},
     {CONTROL_Q, {'Q', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_R, {'R', KeyType::ALPHA, KeyModifier::CTRL}},
     {CONTROL_S, {'S', KeyType::ALPHA, KeyModifier::CTRL}},
+    {CONTROL_W, {'W', KeyType::ALPHA, KeyModifier::CTRL}},
 };
 
 std::optional<Key> keycode_to_key(int keycode);
\ No newline at end of file
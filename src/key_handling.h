@@ -0,0 +1,164 @@
+#pragma once
+
+#include <string>
+
+#include "Model.h"
+#include "key_codes.h"
+
+// What each key does to the model. Kept apart from the main loop so the same handling can
+// be driven without a terminal, e.g. by the benchmarks.
+
+// While a prompt is open, keys edit the prompt instead of the buffer
+inline void handle_prompt_key(Model &model, Key key) {
+    if (key.is_insertable()) {
+        model.prompt_insert(key.get_char());
+    } else if (key.is_type(KeyType::BACKSPACE) && !key.is_modified()) {
+        model.prompt_backspace();
+    } else if (key.is_type(KeyType::ENTER) && !key.is_modified()) {
+        model.submit_prompt();
+    } else if (key.is_type(KeyType::ESCAPE)) {
+        model.cancel_prompt();
+    }
+}
+
+// Inserts a run of typed or pasted text with a single edit. Typed runs still fold into the
+// previous keystrokes' undo group; a paste gets a group of its own.
+inline void handle_text(Model &model, std::string &&text, bool is_paste) {
+    if (!model.in_prompt()) {
+        model.insert_string(std::move(text), !is_paste);
+        return;
+    }
+    // an open prompt takes the text a character at a time, and a newline submits it. Typed
+    // text after that goes on into the buffer, as it would have a key at a time; the rest
+    // of a paste is dropped, so pasting into a prompt can't edit the file.
+    size_t idx = 0;
+    for (; idx < text.size() && model.in_prompt(); ++idx) {
+        if (text[idx] == '\n') {
+            model.submit_prompt();
+        } else {
+            model.prompt_insert(text[idx]);
+        }
+    }
+    if (idx < text.size() && !is_paste) {
+        model.insert_string(text.substr(idx), true);
+    }
+}
+
+inline void handle_key(Model &model, Key key) {
+    if (model.in_prompt()) {
+        handle_prompt_key(model, key);
+        return;
+    }
+
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'G') {
+        model.open_prompt(PromptType::GO_TO_LINE);
+        return;
+    }
+
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'F') {
+        model.open_prompt(PromptType::FIND);
+        return;
+    }
+
+    // like vi's /
+    if (key.is_type(KeyType::PUNCTUATION) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == '/') {
+        model.open_prompt(PromptType::FIND_REGEX);
+        return;
+    }
+
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'R') {
+        model.open_prompt(PromptType::REPLACE);
+        return;
+    }
+
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'N') {
+        model.find_next();
+        return;
+    }
+
+    // a cursor on every match of the search, to edit them all at once
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'D') {
+        model.select_all_matches();
+        return;
+    }
+
+    if (key.is_type(KeyType::ESCAPE)) {
+        model.clear_search();
+        model.clear_extra_cursors();
+        return;
+    }
+
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'T') {
+        model.toggle_trace_overlay();
+        return;
+    }
+
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'W') {
+        model.toggle_word_wrap();
+        return;
+    }
+
+    // like tail -f
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'E') {
+        model.toggle_follow();
+        return;
+    }
+
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'Z') {
+        model.undo();
+        return;
+    }
+
+    if (key.is_type(KeyType::ALPHA) && key.is_modified_by(KeyModifier::CTRL) && key.get_char() == 'Y') {
+        model.redo();
+        return;
+    }
+
+    if (key.is_insertable()) {
+        model.insert_string(std::string(1, key.get_char()));
+        return;
+    }
+
+    // if (key.is_modified()) {
+    //   return;
+    // }
+
+    if (key.is_type(KeyType::ENTER) && !key.is_modified()) {
+        model.insert_string(std::string("\n"));
+    }
+
+    if (key.is_type(KeyType::BACKSPACE) && !key.is_modified()) {
+        model.remove_char();
+    }
+
+    if (key.is_type(KeyType::ARROW)) {
+        // std::cerr << "key modifier:[" << key.modifier() << "]" << std::endl;
+        if (!key.is_modified()) {
+            if (key.has_keycode(UP)) {
+                model.move_cursor_up();
+            }
+            if (key.has_keycode(DOWN)) {
+                model.move_cursor_down();
+            }
+            if (key.has_keycode(LEFT)) {
+                model.move_cursor_left();
+            }
+            if (key.has_keycode(RIGHT)) {
+                model.move_cursor_right();
+            }
+        } else if (key.is_modified_by(KeyModifier::SHIFT)) {
+            if (key.has_keycode(SHIFT_UP)) {
+                model.shift_cursor_up();
+            }
+            if (key.has_keycode(SHIFT_DOWN)) {
+                model.shift_cursor_down();
+            }
+            if (key.has_keycode(SHIFT_LEFT)) {
+                model.shift_cursor_left();
+            }
+            if (key.has_keycode(SHIFT_RIGHT)) {
+                model.shift_cursor_right();
+            }
+        }
+    }
+}
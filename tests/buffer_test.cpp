@@ -0,0 +1,133 @@
+// Makes random edits to a buffer and to a plain string side by side, and checks that the
+// buffer's text, line index and diffing against other text agree with the string's.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "TextBuffer.h"
+#include "check.h"
+
+static std::vector<std::string> lines_of(std::string const &text) {
+    std::vector<std::string> lines{""};
+    for (char c : text) {
+        if (c == '\n') {
+            lines.emplace_back();
+        } else {
+            lines.back().push_back(c);
+        }
+    }
+    return lines;
+}
+
+static void check_same(TextBuffer const &buffer, std::string const &text) {
+    CHECK(buffer.size() == text.size());
+    CHECK(buffer.substr(0, buffer.size()) == text);
+    std::vector<std::string> lines = lines_of(text);
+    CHECK(buffer.num_lines() == lines.size());
+    Text rows = buffer.get_lines(0, buffer.num_lines());
+    CHECK(rows.num_lines() == lines.size());
+    size_t offset = 0;
+    for (size_t row = 0; row < lines.size(); ++row) {
+        CHECK(rows.get_line_at(row) == lines[row]);
+        CHECK(buffer.line_length(row) == lines[row].size());
+        CHECK(buffer.offset_of(CursorPoint{row, 0, 0}) == offset);
+        offset += lines[row].size() + 1;
+    }
+}
+
+static void test_random_edits() {
+    std::mt19937 rng(1);
+    std::string text = "one\ntwo\nthree\n";
+    TextBuffer buffer{text};
+    // where the last insert ended; typing on from there is what the piece table merges
+    size_t typed_end = 0;
+    for (size_t round = 0; round < 3000; ++round) {
+        size_t offset = rng() % 2 == 0 ? std::min(typed_end, text.size()) : rng() % (text.size() + 1);
+        if (rng() % 3 != 0 || text.empty()) {
+            std::string inserted(rng() % 6 + 1, "ab\n"[rng() % 3]);
+            buffer.insert_at(offset, inserted);
+            text.insert(offset, inserted);
+            typed_end = offset + inserted.size();
+        } else {
+            size_t length = std::min<size_t>(rng() % 8 + 1, text.size() - std::min(offset, text.size()));
+            offset = std::min(offset, text.size() - length);
+            buffer.remove_at(offset, length);
+            text.erase(offset, length);
+        }
+        if (round % 100 == 0) {
+            check_same(buffer, text);
+        }
+    }
+    check_same(buffer, text);
+}
+
+// Random sorted ranges, empty ones included, replaced all at once by one text or by one
+// text each, against splicing a string
+static void test_replace_ranges() {
+    TextBuffer lines{std::string{"a-b-c-d\ne-f\n"}};
+    lines.replace_ranges({{1, 1}, {5, 1}, {9, 1}}, "\n");
+    check_same(lines, "a\nb-c\nd\ne\nf\n");
+
+    std::mt19937 rng(4);
+    std::string text = "one\ntwo\nthree\n";
+    TextBuffer buffer{text};
+    for (size_t round = 0; round < 500; ++round) {
+        std::vector<TextRange> ranges;
+        std::vector<std::string> replacements;
+        for (size_t at = rng() % 4; at <= text.size(); at += rng() % 6) {
+            // removing a little more than goes in keeps the text from running away
+            size_t length = std::min<size_t>(rng() % 4, text.size() - at);
+            ranges.push_back(TextRange{at, length});
+            replacements.push_back(std::string("xy\n").substr(0, rng() % 3));
+            at += length;
+        }
+        bool one_text = rng() % 2 == 0;
+        std::string spliced;
+        size_t kept_from = 0;
+        for (size_t idx = 0; idx < ranges.size(); ++idx) {
+            spliced += text.substr(kept_from, ranges[idx].m_offset - kept_from);
+            spliced += one_text ? replacements[0] : replacements[idx];
+            kept_from = ranges[idx].m_offset + ranges[idx].m_length;
+        }
+        spliced += text.substr(std::min(kept_from, text.size()));
+        if (one_text) {
+            buffer.replace_ranges(ranges, replacements.empty() ? "" : replacements[0]);
+        } else {
+            std::vector<std::string_view> each(replacements.begin(), replacements.end());
+            buffer.replace_ranges(ranges, each);
+        }
+        text = spliced;
+        check_same(buffer, text);
+        if (text.size() < 10) {
+            buffer.insert_at(0, "more\ntext\n");
+            text.insert(0, "more\ntext\n");
+        }
+    }
+}
+
+// What reloading a changed file keeps of the buffer: the common start and end
+static void test_common_prefix_and_suffix() {
+    TextBuffer buffer{std::string{"first line\nmiddle\nlast line\n"}};
+    buffer.insert_at(6, "long ");
+    buffer.remove_at(0, 1);
+    std::string const current = "irst long line\nmiddle\nlast line\n";
+    check_same(buffer, current);
+
+    std::string changed = "irst long line\nMIDDLE!\nlast line\n";
+    size_t prefix = buffer.common_prefix_with(changed);
+    CHECK(prefix == 15);
+    CHECK(buffer.common_suffix_with(changed, prefix) == 11);
+
+    CHECK(buffer.common_prefix_with(current) == current.size());
+    CHECK(buffer.common_suffix_with(current, current.size()) == 0);
+    CHECK(buffer.common_suffix_with("x\nlast line\n", 0) == 11);
+}
+
+int main() {
+    test_random_edits();
+    test_replace_ranges();
+    test_common_prefix_and_suffix();
+    std::printf("buffer_test: ok\n");
+    return 0;
+}
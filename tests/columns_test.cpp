@@ -0,0 +1,112 @@
+// Checks UTF-8 decoding and widths, that every is_ascii method agrees with the others, and
+// where LineColumns puts the characters of lines mixing ASCII, wide characters, combining
+// marks and bytes that aren't valid UTF-8.
+
+#include <string>
+#include <vector>
+
+#include "LineColumns.h"
+#include "Utf8.h"
+#include "check.h"
+
+static void test_is_ascii_methods_agree() {
+    std::vector<Utf8::Method> methods{Utf8::Method::SCALAR};
+#ifdef ELDITOR_X86_SIMD
+    if (Utf8::best_method() != Utf8::Method::SCALAR) {
+        methods.push_back(Utf8::Method::SSE2);
+    }
+    if (Utf8::best_method() == Utf8::Method::AVX2) {
+        methods.push_back(Utf8::Method::AVX2);
+    }
+#endif
+    // a high byte at every position of every length, so each method's blocks and tail see one
+    for (size_t size = 0; size < 300; ++size) {
+        std::string text(size, 'a');
+        for (Utf8::Method method : methods) {
+            CHECK(Utf8::is_ascii(text, method));
+        }
+        for (size_t pos = 0; pos < size; ++pos) {
+            text[pos] = '\x80';
+            for (Utf8::Method method : methods) {
+                CHECK(!Utf8::is_ascii(text, method));
+            }
+            text[pos] = 'a';
+        }
+    }
+}
+
+static void test_decode_and_width() {
+    auto decoded = [](std::string_view text, size_t expected_length) {
+        size_t length;
+        char32_t code_point = Utf8::decode(text, 0, length);
+        CHECK(length == expected_length);
+        return code_point;
+    };
+    CHECK(decoded("a", 1) == 'a');
+    CHECK(decoded("\xc3\xa9", 2) == 0xe9);
+    CHECK(decoded("\xe4\xb8\xad", 3) == 0x4e2d);
+    CHECK(decoded("\xf0\x9f\x98\x80", 4) == 0x1f600);
+    // stray continuation byte, overlong '/', a surrogate, and a sequence cut short
+    CHECK(decoded("\x80", 1) == Utf8::REPLACEMENT);
+    CHECK(decoded("\xc0\xaf", 1) == Utf8::REPLACEMENT);
+    CHECK(decoded("\xed\xa0\x80", 1) == Utf8::REPLACEMENT);
+    CHECK(decoded("\xe4\xb8", 1) == Utf8::REPLACEMENT);
+
+    CHECK(Utf8::width('a') == 1);
+    CHECK(Utf8::width(0xe9) == 1);
+    CHECK(Utf8::width(0x301) == 0);
+    CHECK(Utf8::width(0x4e2d) == 2);
+    CHECK(Utf8::width(0x1f600) == 2);
+}
+
+static void test_ascii_line() {
+    LineColumns columns{"int x;"};
+    CHECK(columns.is_ascii());
+    CHECK(columns.width() == 6);
+    CHECK(columns.column_of(3) == 3);
+    CHECK(columns.byte_at_column(8) == 8);
+}
+
+static void test_mixed_line() {
+    // 'a', e + combining acute, a wide CJK character, a bad byte, a flag, 'z'
+    std::string line = "ae\xcc\x81\xe4\xb8\xad\xff\xf0\x9f\x87\xa9\xf0\x9f\x87\xaaz";
+    LineColumns columns{line};
+    CHECK(!columns.is_ascii());
+    CHECK(columns.size() == line.size());
+    std::vector<size_t> const starts{0, 1, 4, 7, 8, 16};
+    std::vector<size_t> const column_starts{0, 1, 2, 4, 5, 7};
+    CHECK(columns.width() == 8);
+    for (size_t idx = 0; idx < starts.size(); ++idx) {
+        CHECK(columns.column_of(starts[idx]) == column_starts[idx]);
+        CHECK(columns.byte_at_column(column_starts[idx]) == starts[idx]);
+        if (idx + 1 < starts.size()) {
+            CHECK(columns.next(starts[idx]) == starts[idx + 1]);
+            CHECK(columns.prev(starts[idx + 1]) == starts[idx]);
+        }
+    }
+    // the bytes inside a character belong to it, and a range ending in one covers all of it
+    CHECK(columns.column_of(2) == 1);
+    CHECK(columns.end_column_of(2) == 2);
+    CHECK(columns.end_column_of(4) == 2);
+    // the second column of the wide character is still drawn by it
+    CHECK(columns.byte_at_column(3) == 4);
+    // past the end a byte is a column again
+    CHECK(columns.column_of(line.size() + 2) == 10);
+    CHECK(columns.byte_at_column(10) == line.size() + 2);
+
+    size_t chars = 0;
+    columns.for_each_char(0, columns.width(), [&](size_t start, size_t, size_t column, size_t) {
+        CHECK(start == starts[chars] && column == column_starts[chars]);
+        chars++;
+    });
+    CHECK(chars == starts.size());
+}
+
+int main() {
+    test_is_ascii_methods_agree();
+    test_decode_and_width();
+    test_ascii_line();
+    test_mixed_line();
+    std::printf("columns_test: ok\n");
+    return 0;
+}
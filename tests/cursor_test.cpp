@@ -0,0 +1,137 @@
+// Edits at many cursors at once: what the text comes out as, that undo and redo put it and
+// the cursors back, and that cursors whose selections run into each other are merged so
+// their ends stay in order.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Model.h"
+#include "check.h"
+
+static std::string text_of(Model const &model) {
+    Text lines = model.get_lines(0, model.num_lines());
+    std::string text;
+    for (size_t row = 0; row < lines.num_lines(); ++row) {
+        text += (row == 0 ? "" : "\n") + std::string{lines.get_line_at(row)};
+    }
+    return text;
+}
+
+// Every cursor, the primary one included, in order of where they start
+static std::vector<Cursor> all_cursors(Model const &model) {
+    std::vector<Cursor> cursors = model.get_extra_cursors();
+    cursors.push_back(model.get_cursor());
+    std::sort(cursors.begin(), cursors.end(), [](Cursor const &a, Cursor const &b) {
+        return a.get_left_point().is_behind(b.get_left_point());
+    });
+    return cursors;
+}
+
+// No two cursors overlap, touch or sit in the same place, so the extra ones are in order by
+// both of their ends
+static void check_cursors_apart(Model const &model) {
+    std::vector<Cursor> const &extra_cursors = model.get_extra_cursors();
+    for (size_t idx = 1; idx < extra_cursors.size(); ++idx) {
+        CHECK(extra_cursors[idx - 1].get_left_point().is_behind(extra_cursors[idx].get_left_point()));
+        CHECK(extra_cursors[idx - 1].get_right_point().is_behind(extra_cursors[idx].get_right_point()));
+    }
+    std::vector<Cursor> cursors = all_cursors(model);
+    for (size_t idx = 1; idx < cursors.size(); ++idx) {
+        CHECK(cursors[idx - 1].get_right_point().is_behind(cursors[idx].get_left_point()));
+    }
+}
+
+static void test_typing_at_every_match() {
+    Model model = Model::initialize();
+    std::string text;
+    for (size_t row = 0; row < 100; ++row) {
+        text += "foo bar " + std::to_string(row) + "\n";
+    }
+    model.insert_string(std::string{text}, false);
+    model.start_search("foo");
+    model.select_all_matches();
+    CHECK(model.get_extra_cursors().size() == 99);
+
+    // typing replaces every selection, then goes on after it
+    model.insert_string("x");
+    model.insert_string("yz");
+    std::string typed;
+    for (size_t row = 0; row < 100; ++row) {
+        typed += "xyz bar " + std::to_string(row) + "\n";
+    }
+    CHECK(text_of(model) == typed);
+    // backspacing at the start of every row joins them all
+    model.move_cursor_left();
+    model.move_cursor_left();
+    model.move_cursor_left();
+    model.remove_char();
+    std::string joined = typed;
+    std::erase(joined, '\n');
+    CHECK(text_of(model) == joined + "\n");
+    // the first cursor had nothing before it to remove, and no two met
+    CHECK(model.get_extra_cursors().size() == 99);
+
+    model.undo();
+    CHECK(text_of(model) == typed);
+    CHECK(model.get_extra_cursors().size() == 99);
+    model.undo();
+    model.undo();
+    CHECK(text_of(model) == text);
+    // the selections are back as they were
+    for (Cursor const &cursor : all_cursors(model)) {
+        CHECK(cursor.in_selection_mode());
+        CHECK(cursor.get_right_point().col() - cursor.get_left_point().col() == 3);
+    }
+    model.redo();
+    model.redo();
+    CHECK(text_of(model) == typed);
+    model.redo();
+    CHECK(text_of(model) == joined + "\n");
+}
+
+// Selections are grown and shrunk at random, backwards past where they started too, until
+// they run into each other
+static void test_selections_that_meet_are_merged() {
+    Model model = Model::initialize();
+    std::string text;
+    for (size_t row = 0; row < 40; ++row) {
+        text += "ab cd ab ab\n";
+    }
+    model.insert_string(std::string{text}, false);
+    model.start_search("ab");
+    model.select_all_matches();
+    check_cursors_apart(model);
+    std::mt19937 rng(2);
+    size_t num_cursors = model.get_extra_cursors().size() + 1;
+    for (size_t round = 0; round < 200 && num_cursors > 1; ++round) {
+        // going up or down a row joins up every selection, so that's left for near the end
+        size_t choice = rng() % 20;
+        if (choice == 0 && round > 150) {
+            model.shift_cursor_up();
+        } else if (choice == 1 && round > 150) {
+            model.shift_cursor_down();
+        } else if (choice < 11) {
+            model.shift_cursor_left();
+        } else {
+            model.shift_cursor_right();
+        }
+        check_cursors_apart(model);
+        CHECK(model.get_extra_cursors().size() + 1 <= num_cursors);
+        num_cursors = model.get_extra_cursors().size() + 1;
+    }
+    CHECK(num_cursors < 120);
+
+    // typing over merged selections still removes each span once
+    std::vector<Cursor> cursors = all_cursors(model);
+    model.insert_string("!");
+    std::string typed = text_of(model);
+    CHECK(std::count(typed.begin(), typed.end(), '!') == (long)cursors.size());
+}
+
+int main() {
+    test_typing_at_every_match();
+    test_selections_that_meet_are_merged();
+    std::printf("cursor_test: ok\n");
+    return 0;
+}
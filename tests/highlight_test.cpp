@@ -0,0 +1,89 @@
+// Checks that the highlight worker's results are mapped through edits made since they were
+// lexed, and that once it catches up every row starts in the state the edits left it in.
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HighlightWorker.h"
+#include "check.h"
+
+// Waits for the worker to finish and picks up what it sent back; a result it hasn't handed
+// over yet counts as busy, so each wait also takes one
+static void wait_for_result(HighlightWorker &worker, TextBuffer const &buffer) {
+    while (worker.busy()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        worker.update(buffer, {}, 0, buffer.num_lines());
+    }
+}
+
+// Hands over buffer's edits and waits for the worker to send back a result covering them
+static void catch_up(HighlightWorker &worker, TextBuffer &buffer) {
+    std::vector<LineChange> changes;
+    buffer.take_line_changes(changes);
+    worker.update(buffer, changes, 0, buffer.num_lines());
+    wait_for_result(worker, buffer);
+}
+
+static void test_rows_map_through_unreported_edits() {
+    TextBuffer buffer{std::string{"/*\na\nb\nc\n*/\nd\n"}};
+    HighlightWorker worker{Language::CPP};
+    catch_up(worker, buffer);
+    std::vector<LexState> const expected{LexState::NORMAL,        LexState::BLOCK_COMMENT,
+                                         LexState::BLOCK_COMMENT, LexState::BLOCK_COMMENT,
+                                         LexState::BLOCK_COMMENT, LexState::NORMAL};
+    for (size_t row = 0; row < expected.size(); ++row) {
+        CHECK(worker.start_state(row) == expected[row]);
+    }
+
+    // a new row 1; the result still describes the old rows until the next update takes it
+    buffer.insert_at(buffer.offset_of(CursorPoint{1, 0, 0}), "x\n");
+    std::vector<LineChange> changes;
+    buffer.take_line_changes(changes);
+    worker.update(buffer, changes, 0, buffer.num_lines());
+    CHECK(worker.start_state(0) == LexState::NORMAL);
+    CHECK(worker.start_state(1) == LexState::BLOCK_COMMENT);
+    // rows after an edited one aren't known yet
+    CHECK(!worker.start_state(2).has_value());
+    CHECK(!worker.start_state(3).has_value());
+    // further down they are old rows moved down by one
+    CHECK(worker.start_state(4) == LexState::BLOCK_COMMENT);
+    CHECK(worker.start_state(5) == LexState::BLOCK_COMMENT);
+    CHECK(worker.start_state(6) == LexState::NORMAL);
+
+    wait_for_result(worker, buffer);
+    for (size_t row = 1; row < 6; ++row) {
+        CHECK(worker.start_state(row) == LexState::BLOCK_COMMENT);
+    }
+    CHECK(worker.start_state(6) == LexState::NORMAL);
+}
+
+// Opening a comment at the top changes every row below it, and closing it changes them back
+static void test_edit_relexes_everything_below() {
+    std::string text;
+    for (size_t row = 0; row < 5000; ++row) {
+        text += "int x = 1;\n";
+    }
+    TextBuffer buffer{text};
+    HighlightWorker worker{Language::CPP};
+    catch_up(worker, buffer);
+    CHECK(worker.start_state(4000) == LexState::NORMAL);
+
+    buffer.insert_at(0, "/*\n");
+    catch_up(worker, buffer);
+    CHECK(worker.start_state(1) == LexState::BLOCK_COMMENT);
+    CHECK(worker.start_state(4000) == LexState::BLOCK_COMMENT);
+    CHECK(worker.start_state(buffer.num_lines() - 1) == LexState::BLOCK_COMMENT);
+
+    buffer.remove_at(0, 3);
+    catch_up(worker, buffer);
+    CHECK(worker.start_state(4000) == LexState::NORMAL);
+}
+
+int main() {
+    test_rows_map_through_unreported_edits();
+    test_edit_relexes_everything_below();
+    std::printf("highlight_test: ok\n");
+    return 0;
+}
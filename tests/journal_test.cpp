@@ -0,0 +1,229 @@
+// Replays edit journals, whole and cut short or damaged the ways a crash can leave them, and
+// checks that the buffer always comes out as the file with some prefix of the edits applied.
+
+#include <chrono>
+#include <fcntl.h>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "EditJournal.h"
+#include "TextBuffer.h"
+#include "check.h"
+
+static FileStamp const BASE_STAMP{1, 12, 100};
+static std::string const BASE_TEXT = "hello world\n";
+
+// An edit, applied both to the journal and to a plain string the replay is checked against
+struct Edit {
+    std::function<void(EditJournal &)> m_record;
+    std::function<void(std::string &)> m_apply;
+};
+
+static std::vector<Edit> make_edits() {
+    std::vector<Edit> edits;
+    auto insert = [&](size_t offset, std::string text) {
+        edits.push_back({[=](EditJournal &journal) { journal.record_insert(offset, text); },
+                         [=](std::string &state) { state.insert(offset, text); }});
+    };
+    auto remove = [&](size_t offset, size_t length) {
+        edits.push_back({[=](EditJournal &journal) { journal.record_remove(offset, length); },
+                         [=](std::string &state) { state.erase(offset, length); }});
+    };
+    insert(5, ",");
+    insert(6, " big");
+    remove(0, 1);
+    insert(0, "J");
+    edits.push_back({[](EditJournal &journal) { journal.record_replace({{0, 1}, {11, 5}}, "X"); },
+                     [](std::string &state) {
+                         state.replace(11, 5, "X");
+                         state.replace(0, 1, "X");
+                     }});
+    remove(3, 2);
+    return edits;
+}
+
+// What the file looks like with the first count edits applied, for count from 0 to all
+static std::vector<std::string> prefix_states(std::vector<Edit> const &edits, std::string state) {
+    std::vector<std::string> states{state};
+    for (Edit const &edit : edits) {
+        edit.m_apply(state);
+        states.push_back(state);
+    }
+    return states;
+}
+
+static std::string text_of(TextBuffer const &buffer) {
+    return buffer.substr(0, buffer.size());
+}
+
+static std::string read_all(std::string const &pathname) {
+    std::string contents;
+    int fd = open(pathname.data(), O_RDONLY);
+    CHECK(fd != -1);
+    char block[4096];
+    ssize_t count;
+    while ((count = read(fd, block, sizeof(block))) > 0) {
+        contents.append(block, count);
+    }
+    close(fd);
+    return contents;
+}
+
+static void write_all_to(std::string const &pathname, std::string const &contents) {
+    int fd = open(pathname.data(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    CHECK(fd != -1);
+    CHECK(write(fd, contents.data(), contents.size()) == (ssize_t)contents.size());
+    close(fd);
+}
+
+// Writes a journal of edits over BASE_STAMP and returns what ended up on disk
+static std::string write_journal(std::string const &pathname, std::vector<Edit> const &edits) {
+    {
+        EditJournal journal{pathname, BASE_STAMP};
+        for (Edit const &edit : edits) {
+            edit.m_record(journal);
+        }
+    }
+    return read_all(pathname);
+}
+
+// Replays a journal that is there to be read
+static std::optional<JournalReplay> replay_journal(std::string const &pathname, FileStamp const &stamp,
+                                                   TextBuffer &buffer) {
+    std::string error;
+    std::optional<JournalReplay> replay = EditJournal::replay(pathname, stamp, buffer, error);
+    CHECK(error.empty());
+    return replay;
+}
+
+static void test_replays_every_edit(std::string const &pathname) {
+    std::vector<Edit> edits = make_edits();
+    write_journal(pathname, edits);
+    TextBuffer buffer{BASE_TEXT};
+    std::optional<JournalReplay> replay = replay_journal(pathname, BASE_STAMP, buffer);
+    CHECK(replay.has_value());
+    CHECK(replay->m_matched);
+    CHECK(replay->m_num_edits == edits.size());
+    CHECK(text_of(buffer) == prefix_states(edits, BASE_TEXT).back());
+}
+
+static void test_journal_for_another_file(std::string const &pathname) {
+    write_journal(pathname, make_edits());
+    TextBuffer buffer{BASE_TEXT};
+    FileStamp other = BASE_STAMP;
+    other.m_mtime_ns++;
+    std::optional<JournalReplay> replay = replay_journal(pathname, other, buffer);
+    CHECK(replay.has_value());
+    CHECK(!replay->m_matched);
+    CHECK(text_of(buffer) == BASE_TEXT);
+}
+
+// A crash can tear the journal off anywhere
+static void test_truncated_journal(std::string const &pathname) {
+    std::vector<Edit> edits = make_edits();
+    std::vector<std::string> states = prefix_states(edits, BASE_TEXT);
+    std::string journal = write_journal(pathname, edits);
+    size_t previous_edits = 0;
+    for (size_t length = 0; length <= journal.size(); ++length) {
+        write_all_to(pathname, journal.substr(0, length));
+        TextBuffer buffer{BASE_TEXT};
+        std::optional<JournalReplay> replay = replay_journal(pathname, BASE_STAMP, buffer);
+        CHECK(replay.has_value());
+        CHECK(replay->m_length <= length);
+        CHECK(replay->m_num_edits >= previous_edits);
+        CHECK(replay->m_num_edits <= edits.size());
+        CHECK(text_of(buffer) == states[replay->m_num_edits]);
+        previous_edits = replay->m_num_edits;
+    }
+    CHECK(previous_edits == edits.size());
+}
+
+// Damage anywhere stops the replay at the record it's in, or rejects the whole journal if
+// it's in the header
+static void test_corrupt_journal(std::string const &pathname) {
+    std::vector<Edit> edits = make_edits();
+    std::vector<std::string> states = prefix_states(edits, BASE_TEXT);
+    std::string journal = write_journal(pathname, edits);
+    for (size_t pos = 0; pos < journal.size(); ++pos) {
+        std::string damaged = journal;
+        damaged[pos] ^= 0x5a;
+        write_all_to(pathname, damaged);
+        TextBuffer buffer{BASE_TEXT};
+        std::optional<JournalReplay> replay = replay_journal(pathname, BASE_STAMP, buffer);
+        CHECK(replay.has_value());
+        CHECK(replay->m_num_edits < edits.size());
+        CHECK(text_of(buffer) == states[replay->m_num_edits]);
+    }
+}
+
+// Bytes appended to the file behind our back come after every edit, so the edits replay
+// over the longer file
+static void test_replays_over_appended_file(std::string const &pathname) {
+    std::vector<Edit> edits = make_edits();
+    std::string appended = "more\n";
+    FileStamp appended_stamp{BASE_STAMP.m_inode, BASE_STAMP.m_size + appended.size(), 200};
+    {
+        EditJournal journal{pathname, BASE_STAMP};
+        for (size_t idx = 0; idx < 3; ++idx) {
+            edits[idx].m_record(journal);
+        }
+        journal.mark_appended(appended_stamp);
+        for (size_t idx = 3; idx < edits.size(); ++idx) {
+            edits[idx].m_record(journal);
+        }
+    }
+    std::string expected = BASE_TEXT;
+    for (size_t idx = 0; idx < 3; ++idx) {
+        edits[idx].m_apply(expected);
+    }
+    expected += appended;
+    for (size_t idx = 3; idx < edits.size(); ++idx) {
+        edits[idx].m_apply(expected);
+    }
+
+    TextBuffer buffer{BASE_TEXT + appended};
+    std::optional<JournalReplay> replay = replay_journal(pathname, appended_stamp, buffer);
+    CHECK(replay.has_value());
+    CHECK(replay->m_matched);
+    CHECK(text_of(buffer) == expected);
+}
+
+// The worker can't print what goes wrong, so it's kept for whoever shows it
+static void test_write_errors_are_kept() {
+    EditJournal journal{"/nonexistent/journal", BASE_STAMP};
+    journal.record_insert(0, "x");
+    std::string error;
+    for (size_t wait = 0; wait < 500 && error.empty(); ++wait) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        error = journal.take_error();
+    }
+    CHECK(error.starts_with("Error opening journal"));
+    CHECK(journal.take_error().empty());
+
+    std::string read_error;
+    TextBuffer buffer{BASE_TEXT};
+    CHECK(!EditJournal::replay("/nonexistent/journal", BASE_STAMP, buffer, read_error).has_value());
+    // a journal that isn't there is nothing to report
+    CHECK(read_error.empty());
+}
+
+int main() {
+    char directory[] = "/tmp/journal_test.XXXXXX";
+    CHECK(mkdtemp(directory) != nullptr);
+    std::string pathname = std::string(directory) + "/journal";
+
+    test_replays_every_edit(pathname);
+    test_journal_for_another_file(pathname);
+    test_truncated_journal(pathname);
+    test_corrupt_journal(pathname);
+    test_replays_over_appended_file(pathname);
+    test_write_errors_are_kept();
+
+    unlink(pathname.data());
+    rmdir(directory);
+    std::printf("journal_test: ok\n");
+    return 0;
+}
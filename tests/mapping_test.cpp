@@ -0,0 +1,48 @@
+// Cuts a file short under its mapping and checks that reading past the new end gives zero
+// bytes and is noticed, while a SIGBUS that isn't about our mappings still goes to the
+// handler that was there before, every time.
+
+#include <string>
+
+#include "check.h"
+#include "file.h"
+
+static int previous_handler_calls = 0;
+
+static void previous_handler(int) {
+    previous_handler_calls++;
+}
+
+int main() {
+    signal(SIGBUS, previous_handler);
+    char pathname[] = "/tmp/mapping_test.XXXXXX";
+    int fd = mkstemp(pathname);
+    CHECK(fd != -1);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    std::string contents(3 * page_size, 'x');
+    CHECK(write(fd, contents.data(), contents.size()) == (ssize_t)contents.size());
+
+    MappedFile mapping{fd, contents.size()};
+    CHECK(mapping.view() == contents);
+
+    raise(SIGBUS);
+    CHECK(previous_handler_calls == 1);
+    CHECK(!MappingGuard::take_cut_short());
+
+    CHECK(ftruncate(fd, 10) == 0);
+    CHECK(mapping.view()[2 * page_size + 5] == '\0');
+    CHECK(MappingGuard::take_cut_short());
+    CHECK(!MappingGuard::take_cut_short());
+
+    // still installed after passing a signal on
+    raise(SIGBUS);
+    CHECK(previous_handler_calls == 2);
+    CHECK(ftruncate(fd, 0) == 0);
+    CHECK(mapping.view()[5] == '\0');
+    CHECK(MappingGuard::take_cut_short());
+
+    close(fd);
+    unlink(pathname);
+    std::printf("mapping_test: ok\n");
+    return 0;
+}
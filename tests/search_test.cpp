@@ -0,0 +1,178 @@
+// Checks literal and regex search over a buffer broken into many pieces against searching a
+// plain copy of its text, with matches placed across piece and find_all slice boundaries.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "LiteralMatcher.h"
+#include "Regex.h"
+#include "TextBuffer.h"
+#include "ThreadPool.h"
+#include "check.h"
+
+// find_all's slices are at least this big, so a buffer a few times over it has several
+static constexpr size_t SLICE_SIZE = 1 << 20;
+
+// Builds the buffer a block at a time from the back, so that no two blocks share a piece
+static TextBuffer fragmented_buffer(std::string const &text, size_t block_size) {
+    TextBuffer buffer{std::string{}};
+    for (size_t end = text.size(); end > 0;) {
+        size_t begin = end > block_size ? end - block_size : 0;
+        buffer.insert_at(0, std::string_view{text}.substr(begin, end - begin));
+        end = begin;
+    }
+    CHECK(buffer.substr(0, buffer.size()) == text);
+    return buffer;
+}
+
+// Random text with a needle every so often, some of them at the very ends
+static std::string text_with_needles(size_t size, size_t every) {
+    std::mt19937 rng(11);
+    std::string text;
+    text.reserve(size);
+    while (text.size() < size) {
+        text.push_back("bcdefg\n"[rng() % 7]);
+    }
+    for (size_t pos = every; pos + 6 < text.size(); pos += every + rng() % 7) {
+        text.replace(pos, 6, "needle");
+    }
+    text.replace(0, 6, "needle");
+    text.replace(text.size() - 6, 6, "needle");
+    return text;
+}
+
+// Leftmost matches without overlaps, the way find_all reports them
+static std::vector<size_t> naive_find_all(std::string const &text, std::string const &pattern) {
+    std::vector<size_t> matches;
+    size_t pos = text.find(pattern);
+    while (pos != std::string::npos) {
+        matches.push_back(pos);
+        pos = text.find(pattern, pos + pattern.size());
+    }
+    return matches;
+}
+
+static std::string text_with_matches_across_slices() {
+    std::mt19937 rng(11);
+    std::string text;
+    text.reserve(3 * SLICE_SIZE + SLICE_SIZE / 2);
+    while (text.size() < 3 * SLICE_SIZE + SLICE_SIZE / 2) {
+        text.push_back("bcdefg\n"[rng() % 7]);
+    }
+    // matches straddling each slice boundary, at every split of the pattern
+    for (size_t boundary = SLICE_SIZE; boundary < text.size(); boundary += SLICE_SIZE) {
+        text.replace(boundary - 3, 6, "needle");
+        text.replace(boundary - 1000, 6, "needle");
+        text.replace(boundary + 1000 - 5, 6, "needle");
+        // a run that overlapping matches could be found in, crossing the boundary
+        text.replace(boundary - 50, 7, "aaaaaaa");
+    }
+    text.replace(0, 6, "needle");
+    text.replace(text.size() - 6, 6, "needle");
+    return text;
+}
+
+static void test_find_all_across_slices() {
+    std::string text = text_with_matches_across_slices();
+    TextBuffer buffer = fragmented_buffer(text, 4093);
+    for (size_t num_threads : {1, 3, 8}) {
+        ThreadPool pool{num_threads};
+        for (std::string pattern : {"needle", "aaa", "a", "e\nb"}) {
+            LiteralMatcher matcher{pattern, false};
+            CHECK(buffer.find_all(matcher, pool) == naive_find_all(text, pattern));
+        }
+    }
+}
+
+static void test_find_next_across_pieces() {
+    std::string text = text_with_needles(1 << 20, 997);
+    TextBuffer buffer = fragmented_buffer(text, 4093);
+    LiteralMatcher matcher{"needle", false};
+    std::mt19937 rng(5);
+    for (size_t round = 0; round < 200; ++round) {
+        size_t from = rng() % text.size();
+        std::optional<size_t> found = buffer.find(matcher, from);
+        size_t expected = text.find("needle", from);
+        CHECK(found.has_value() == (expected != std::string::npos));
+        CHECK(!found.has_value() || *found == expected);
+    }
+    // the last needle ends the buffer, so past its start there is nothing
+    CHECK(!buffer.find(matcher, text.size() - 5).has_value());
+}
+
+static std::shared_ptr<Regex> compile(std::string_view pattern) {
+    std::string error;
+    std::shared_ptr<Regex> regex = Regex::compile(pattern, false, error);
+    CHECK(regex != nullptr);
+    return regex;
+}
+
+static void test_regex_is_leftmost_longest() {
+    auto check_match = [](std::string_view pattern, std::string_view line, size_t offset, size_t length) {
+        std::optional<RegexMatch> match = compile(pattern)->find(line);
+        CHECK(match.has_value());
+        CHECK(match->m_offset == offset);
+        CHECK(match->m_length == length);
+    };
+    check_match("a|ab", "xab", 1, 2);
+    check_match("abcd|c", "abcd", 0, 4);
+    check_match("a+", "baaab", 1, 3);
+    check_match("(ab)+", "xababab", 1, 6);
+    check_match("^b", "bb", 0, 1);
+    check_match("b$", "bb", 1, 1);
+    check_match("x[ab]*y", "xaby xy", 0, 4);
+    CHECK(!compile("^b")->find("ab").has_value());
+
+    std::string error;
+    CHECK(Regex::compile("a*", false, error) == nullptr);
+}
+
+// The first match at or after from, by searching a copy of each line
+static std::optional<RegexMatch> naive_regex_find(std::string const &text, Regex const &regex, size_t from) {
+    size_t line_start = text.rfind('\n', from == 0 ? 0 : from - 1);
+    line_start = from == 0 || line_start == std::string::npos ? 0 : line_start + 1;
+    while (line_start <= text.size()) {
+        size_t line_end = std::min(text.find('\n', line_start), text.size());
+        std::string_view line = std::string_view{text}.substr(line_start, line_end - line_start);
+        std::optional<RegexMatch> match = regex.find(line, std::max(from, line_start) - line_start);
+        if (match.has_value()) {
+            match->m_offset += line_start;
+            return match;
+        }
+        line_start = line_end + 1;
+    }
+    return std::nullopt;
+}
+
+// Matches are pinned down over the pieces of a line, so lines are made to run across many
+static void test_regex_find_across_pieces() {
+    std::mt19937 rng(3);
+    std::string text;
+    for (size_t idx = 0; idx < 20000; ++idx) {
+        text.push_back("abcxy\n"[rng() % (idx % 4000 < 3000 ? 5 : 6)]);
+    }
+    TextBuffer buffer = fragmented_buffer(text, 7);
+    for (std::string_view pattern : {"ab", "a+b", "abcd|c", "^a", "b$", "x[ab]*y", "a.*b", "(ab)+"}) {
+        std::shared_ptr<Regex> regex = compile(pattern);
+        for (size_t round = 0; round < 50; ++round) {
+            size_t from = rng() % (text.size() + 1);
+            std::optional<RegexMatch> found = buffer.find(*regex, from);
+            std::optional<RegexMatch> expected = naive_regex_find(text, *regex, from);
+            CHECK(found.has_value() == expected.has_value());
+            if (found.has_value()) {
+                CHECK(found->m_offset == expected->m_offset);
+                CHECK(found->m_length == expected->m_length);
+            }
+        }
+    }
+}
+
+int main() {
+    test_find_all_across_slices();
+    test_find_next_across_pieces();
+    test_regex_is_leftmost_longest();
+    test_regex_find_across_pieces();
+    std::printf("search_test: ok\n");
+    return 0;
+}
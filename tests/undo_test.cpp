@@ -0,0 +1,85 @@
+// Checks how the undo history groups keystrokes and keeps under its memory cap, and that
+// undoing and redoing hands groups back without copying them.
+
+#include <string>
+
+#include "Tracer.h"
+#include "UndoHistory.h"
+#include "check.h"
+
+static Cursor const CURSOR{0, 0, 0};
+
+static EditRecord insert(size_t offset, std::string text) {
+    return EditRecord{EditType::INSERT, offset, std::move(text)};
+}
+
+static void test_keystrokes_fold_into_a_group() {
+    UndoHistory history;
+    history.record(insert(0, "a"), CURSOR, CURSOR, true);
+    history.record(insert(1, "b"), CURSOR, CURSOR, true);
+    // a newline ends the group
+    history.record(insert(2, "\n"), CURSOR, CURSOR, true);
+    history.record(insert(3, "c"), CURSOR, CURSOR, true);
+    // somewhere else starts a new one
+    history.record(insert(0, "d"), CURSOR, CURSOR, true);
+
+    EditGroup const *group = history.undo();
+    CHECK(group != nullptr && group->m_edits.size() == 1 && group->m_edits[0].m_text == "d");
+    group = history.undo();
+    CHECK(group != nullptr && group->m_edits[0].m_text == "c");
+    group = history.undo();
+    CHECK(group != nullptr && group->m_edits[0].m_text == "ab\n");
+    CHECK(history.undo() == nullptr);
+    group = history.redo();
+    CHECK(group != nullptr && group->m_edits[0].m_text == "ab\n");
+}
+
+static void test_memory_cap_drops_the_oldest_groups() {
+    std::string const text(1000, 'x');
+    size_t group_size = EditGroup{{insert(0, text)}, CURSOR, CURSOR}.memory_used();
+    UndoHistory history{5 * group_size};
+    for (size_t idx = 0; idx < 8; ++idx) {
+        history.record(insert(idx * text.size(), text), CURSOR, CURSOR, false);
+        CHECK(history.memory_used() <= 5 * group_size);
+    }
+    CHECK(history.memory_used() == 5 * group_size);
+    // the newest five are left, newest first
+    for (size_t idx = 8; idx-- > 3;) {
+        EditGroup const *group = history.undo();
+        CHECK(group != nullptr && group->m_edits[0].m_offset == idx * text.size());
+    }
+    CHECK(history.undo() == nullptr);
+
+    // undone groups are what goes first when the cap comes down
+    history.set_memory_limit(3 * group_size);
+    CHECK(history.memory_used() <= 3 * group_size);
+    history.set_memory_limit(0);
+    CHECK(history.memory_used() == 0);
+    CHECK(history.redo() == nullptr);
+}
+
+static void test_undo_and_redo_copy_nothing() {
+    UndoHistory history;
+    history.record(insert(0, std::string(1000, 'x')), CURSOR, CURSOR, false);
+    size_t allocations = allocation_count;
+    EditGroup const *undone = history.undo();
+    EditGroup const *redone = history.redo();
+    CHECK(undone != nullptr && redone != nullptr);
+    CHECK(redone->m_edits[0].m_text.size() == 1000);
+    // the first move onto each stack may grow it, but the text isn't copied
+    CHECK(allocation_count - allocations <= 2);
+    allocations = allocation_count;
+    for (size_t idx = 0; idx < 100; ++idx) {
+        CHECK(history.undo() != nullptr);
+        CHECK(history.redo() != nullptr);
+    }
+    CHECK(allocation_count == allocations);
+}
+
+int main() {
+    test_keystrokes_fold_into_a_group();
+    test_memory_cap_drops_the_oldest_groups();
+    test_undo_and_redo_copy_nothing();
+    std::printf("undo_test: ok\n");
+    return 0;
+}
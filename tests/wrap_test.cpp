@@ -0,0 +1,117 @@
+// Checks the wrap layout's row and visual line bookkeeping, and the Fenwick trees under it,
+// against plain vectors that are summed from the start every time.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "FenwickTree.h"
+#include "WrapLayout.h"
+#include "check.h"
+
+static void test_fenwick_tree() {
+    std::mt19937 rng(7);
+    std::vector<size_t> counts(1000);
+    for (size_t &count : counts) {
+        count = rng() % 5;
+    }
+    FenwickTree tree;
+    tree.assign(counts);
+    for (size_t round = 0; round < 2000; ++round) {
+        size_t idx = rng() % counts.size();
+        size_t count = rng() % 5;
+        tree.update(idx, counts[idx], count);
+        counts[idx] = count;
+
+        size_t prefix = rng() % (counts.size() + 1);
+        size_t sum = 0;
+        for (size_t before = 0; before < prefix; ++before) {
+            sum += counts[before];
+        }
+        CHECK(tree.prefix_sum(prefix) == sum);
+        // the largest k whose prefix sum is within value
+        size_t value = rng() % (tree.total() + 2);
+        size_t within = 0;
+        for (size_t running = 0; within < counts.size() && running + counts[within] <= value; ++within) {
+            running += counts[within];
+        }
+        CHECK(tree.count_within(value) == within);
+    }
+}
+
+static void test_segment_starts() {
+    using starts = std::vector<size_t>;
+    CHECK(WrapLayout::segment_starts("hello world", 6) == (starts{0, 6}));
+    CHECK(WrapLayout::segment_starts("ab cd", 4) == (starts{0, 3}));
+    CHECK(WrapLayout::segment_starts("abcdef", 3) == (starts{0, 3, 6}));
+    // filling the last line exactly leaves an empty one for the cursor
+    CHECK(WrapLayout::segment_starts("abc", 3) == (starts{0, 3}));
+    CHECK(WrapLayout::segment_starts("ab", 3) == (starts{0}));
+    // a two column character doesn't get cut in half, so it moves down and fills its line
+    CHECK(WrapLayout::segment_starts("a\xe4\xb8\xad", 2) == (starts{0, 1, 4}));
+}
+
+// Line counts kept the slow way: 0 for a row that hasn't been measured, which takes one line
+static void check_same(WrapLayout const &layout, std::vector<size_t> const &counts, std::mt19937 &rng) {
+    CHECK(layout.num_rows() == counts.size());
+    std::vector<size_t> first_lines;
+    size_t lines = 0;
+    for (size_t count : counts) {
+        first_lines.push_back(lines);
+        lines += count == 0 ? 1 : count;
+    }
+    CHECK(layout.num_visual_lines() == lines);
+    for (size_t round = 0; round < 20; ++round) {
+        size_t row = rng() % counts.size();
+        CHECK(layout.measured(row) == (counts[row] != 0));
+        CHECK(layout.first_line_of(row) == first_lines[row]);
+        CHECK(layout.lines_in(row) == (counts[row] == 0 ? 1 : counts[row]));
+
+        size_t line = rng() % lines;
+        size_t line_row =
+            std::upper_bound(first_lines.begin(), first_lines.end(), line) - first_lines.begin() - 1;
+        VisualPosition position = layout.position_of_line(line);
+        CHECK(position.m_row == line_row);
+        CHECK(position.m_segment == line - first_lines[line_row]);
+    }
+}
+
+static void test_layout_follows_edits() {
+    std::mt19937 rng(9);
+    WrapLayout layout;
+    layout.set_width(80);
+    layout.apply(LineChange{0, LineChange::ALL_ROWS, 3000});
+    std::vector<size_t> counts(3000, 0);
+    for (size_t round = 0; round < 3000; ++round) {
+        size_t choice = rng() % 10;
+        if (choice < 5) {
+            size_t row = rng() % counts.size();
+            size_t count = rng() % 4;
+            layout.set_line_count(row, count);
+            counts[row] = count;
+        } else if (choice < 9) {
+            // big edits now and then, so blocks empty out and get split
+            size_t limit = rng() % 20 == 0 ? 1000 : 5;
+            size_t first = rng() % (counts.size() + 1);
+            size_t old_count = rng() % limit;
+            size_t new_count = rng() % limit;
+            layout.apply(LineChange{first, old_count, new_count});
+            first = std::min(first, counts.size());
+            old_count = std::min(old_count, counts.size() - first);
+            counts.erase(counts.begin() + first, counts.begin() + first + old_count);
+            counts.insert(counts.begin() + first, std::max<size_t>(new_count, 1), 0);
+        } else if (rng() % 10 == 0) {
+            layout.set_width(layout.width() == 80 ? 40 : 80);
+            counts.assign(counts.size(), 0);
+        }
+        check_same(layout, counts, rng);
+    }
+}
+
+int main() {
+    test_fenwick_tree();
+    test_segment_starts();
+    test_layout_follows_edits();
+    std::printf("wrap_test: ok\n");
+    return 0;
+}